@@ -0,0 +1,172 @@
+// arena.c
+// Implements the request arena.
+//
+// Each allocation is preceded by a small header holding its size, so that
+// request_realloc() and request_free() can be used like realloc() and free():
+// the most recent allocation of a block can be grown or released in place,
+// anything else is released by the next reset.
+
+#include "arena.h"  // Header for arena declarations
+#include <stdalign.h> // For alignof
+#include <stddef.h> // For max_align_t
+#include <stdint.h> // For uintptr_t
+#include <stdlib.h> // For malloc, realloc, free
+#include <string.h> // For memcpy
+
+// Alignment of allocations, and size of the header in front of each one.
+#define ARENA_ALIGN alignof(max_align_t)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// Bytes an allocation of n bytes occupies after its header. Zero-sized
+// allocations take one unit, so every allocation has a distinct address.
+#define PAYLOAD_SIZE(n) ALIGN_UP((n) ? (n) : 1)
+
+struct arena_block {
+    arena_block_t *next;
+    size_t size; // Usable bytes after the block header
+    size_t used;
+};
+
+// Offset of the first usable byte of a block.
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(arena_block_t))
+
+static _Thread_local arena_t *s_current = NULL;
+
+static unsigned char *block_data(arena_block_t *b) {
+    return (unsigned char *) b + BLOCK_HEADER_SIZE;
+}
+
+// Returns the size stored in front of an allocation.
+static size_t *size_header(void *p) {
+    return (size_t *) ((unsigned char *) p - ARENA_ALIGN);
+}
+
+// Returns the block holding p, or NULL if p was not allocated from the arena.
+static arena_block_t *find_block(arena_t *arena, const void *p) {
+    for (arena_block_t *b = arena->head; b != NULL; b = b->next) {
+        const unsigned char *data = block_data(b);
+        if ((uintptr_t) p >= (uintptr_t) data && (uintptr_t) p < (uintptr_t) (data + b->size)) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+// Returns 1 if p is the most recent allocation of block b.
+static int is_last(arena_block_t *b, void *p) {
+    return (unsigned char *) p + PAYLOAD_SIZE(*size_header(p)) == block_data(b) + b->used;
+}
+
+void arena_init(arena_t *arena) {
+    arena->head = NULL;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *b = arena->head;
+    while (b != NULL) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head = NULL;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_block_t *keep = NULL;
+    arena_block_t *b = arena->head;
+    while (b != NULL) {
+        arena_block_t *next = b->next;
+        if (keep == NULL && b->size == ARENA_BLOCK_SIZE) {
+            keep = b;
+        } else {
+            free(b);
+        }
+        b = next;
+    }
+    if (keep != NULL) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    arena->head = keep;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size_t need = ARENA_ALIGN + PAYLOAD_SIZE(size);
+    arena_block_t *b = arena->head;
+    if (b == NULL || b->size - b->used < need) {
+        // Large allocations get a block of their own, linked behind the head
+        // so the free space of the head block is not abandoned.
+        int dedicated = need > ARENA_BLOCK_SIZE / 4;
+        size_t block_size = dedicated ? need : ARENA_BLOCK_SIZE;
+        arena_block_t *nb = malloc(BLOCK_HEADER_SIZE + block_size);
+        if (nb == NULL) {
+            return NULL;
+        }
+        nb->size = block_size;
+        nb->used = 0;
+        if (dedicated && b != NULL) {
+            nb->next = b->next;
+            b->next = nb;
+        } else {
+            nb->next = b;
+            arena->head = nb;
+        }
+        b = nb;
+    }
+    unsigned char *p = block_data(b) + b->used + ARENA_ALIGN;
+    b->used += need;
+    *size_header(p) = size;
+    return p;
+}
+
+void arena_set_current(arena_t *arena) {
+    s_current = arena;
+}
+
+arena_t *arena_current(void) {
+    return s_current;
+}
+
+void *request_alloc(size_t size) {
+    return s_current != NULL ? arena_alloc(s_current, size) : malloc(size);
+}
+
+void *request_realloc(void *p, size_t size) {
+    if (p == NULL) {
+        return request_alloc(size);
+    }
+    arena_block_t *b = s_current != NULL ? find_block(s_current, p) : NULL;
+    if (b == NULL) {
+        return realloc(p, size);
+    }
+    size_t old_size = *size_header(p);
+    if (is_last(b, p)) {
+        // Grow or shrink the most recent allocation in place if it fits.
+        size_t start = (size_t) ((unsigned char *) p - block_data(b));
+        if (size <= SIZE_MAX / 2 && start + PAYLOAD_SIZE(size) <= b->size) {
+            b->used = start + PAYLOAD_SIZE(size);
+            *size_header(p) = size;
+            return p;
+        }
+    }
+    void *np = arena_alloc(s_current, size);
+    if (np != NULL) {
+        memcpy(np, p, old_size < size ? old_size : size);
+    }
+    return np;
+}
+
+void request_free(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    arena_block_t *b = s_current != NULL ? find_block(s_current, p) : NULL;
+    if (b == NULL) {
+        free(p);
+    } else if (is_last(b, p)) {
+        b->used = (size_t) ((unsigned char *) p - ARENA_ALIGN - block_data(b)); // Release in place
+    }
+}
@@ -0,0 +1,49 @@
+// arena.h
+// Bump allocator for request-scoped memory.
+//
+// Every event loop thread owns one arena and makes it the thread's current
+// arena. Memory that only lives for the duration of one request (cJSON
+// nodes, printed strings, parse buffers) is taken from it with
+// request_alloc(), and the whole arena is reset after the request has been
+// dispatched. Allocation is a pointer bump, freeing is (almost) free, and the
+// general-purpose allocator is bypassed in steady state.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h> // For size_t
+
+// Size of a regular arena block. One such block is kept across resets;
+// larger requests get dedicated blocks that are released by the reset.
+#define ARENA_BLOCK_SIZE (64u * 1024)
+
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    arena_block_t *head; // Block allocations are bumped from; older blocks follow
+} arena_t;
+
+void arena_init(arena_t *arena);
+
+// Releases every block.
+void arena_free(arena_t *arena);
+
+// Releases everything allocated since the last reset. Keeps one regular
+// block, so the next request does not have to allocate one.
+void arena_reset(arena_t *arena);
+
+// Returns size bytes aligned for any type, or NULL if memory is exhausted.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Sets or returns the calling thread's current arena (NULL for none).
+void arena_set_current(arena_t *arena);
+arena_t *arena_current(void);
+
+// malloc/realloc/free counterparts that use the calling thread's current
+// arena, or the C library allocator on threads without one. Suitable as
+// cJSON hooks. Memory from an arena must not be used after its reset.
+void *request_alloc(size_t size);
+void *request_realloc(void *p, size_t size);
+void request_free(void *p);
+
+#endif // ARENA_H
@@ -0,0 +1,399 @@
+// batch.c
+// Batch domain validation on top of libtld, and a fixed-size worker pool with
+// work stealing used to spread large batches over every core.
+//
+// Each participant in a parallel_for owns a range of chunk indices packed into
+// one 64-bit atomic (low 32 bits: next chunk, high 32 bits: end). The owner
+// takes chunks from the front; an idle thread steals the back half of another
+// participant's range with a single compare-and-swap. No locks are taken while
+// chunks are being processed.
+//
+// The task queue is a plain mutex-protected FIFO: tasks are whole requests,
+// so one lock round trip per task does not matter.
+
+#define _POSIX_C_SOURCE 200809L // For sysconf
+
+#include "batch.h"
+#include "libtld.h"      // For is_valid_domain_simd, tld_check_domain_simd
+#include <pthread.h>     // For worker threads
+#include <stdatomic.h>   // For the per-participant chunk ranges
+#include <stdlib.h>      // For malloc, calloc, free
+#include <unistd.h>      // For sysconf
+
+// Domains per chunk. A multiple of 64, so every chunk writes whole bitmap
+// words and no two threads ever write the same word.
+#define BATCH_CHUNK_SIZE 4096
+
+// Batches smaller than this are validated on the calling thread.
+#define BATCH_PARALLEL_MIN (4 * BATCH_CHUNK_SIZE)
+
+struct worker_pool {
+    pthread_t *threads;
+    size_t num_threads;       // Background threads (participants - 1)
+
+    pthread_mutex_t lock;     // Protects the fields below
+    pthread_cond_t work_cv;   // Signaled when a new job is published
+    pthread_cond_t done_cv;   // Signaled when the last worker finishes a job
+    unsigned long generation; // Incremented for every job
+    size_t active;            // Background threads still working on the job
+    int shutdown;
+
+    pthread_mutex_t job_lock; // Serializes worker_pool_parallel_for callers
+
+    // Current job, published under lock.
+    parallel_chunk_fn fn;
+    void *arg;
+    _Atomic uint64_t *ranges; // One packed [next, end) range per participant
+};
+
+static inline uint64_t pack_range(uint32_t next, uint32_t end) {
+    return (uint64_t)next | ((uint64_t)end << 32);
+}
+
+static inline uint32_t range_next(uint64_t r) { return (uint32_t)r; }
+static inline uint32_t range_end(uint64_t r) { return (uint32_t)(r >> 32); }
+
+// Claims the next chunk of the participant's own range. Returns 0 if it is empty.
+static int take_own(_Atomic uint64_t *range, uint32_t *chunk) {
+    uint64_t r = atomic_load_explicit(range, memory_order_relaxed);
+    while (range_next(r) < range_end(r)) {
+        if (atomic_compare_exchange_weak_explicit(range, &r, pack_range(range_next(r) + 1, range_end(r)),
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *chunk = range_next(r);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Steals the back half of another participant's range into self's (empty) range.
+// Returns 0 if no participant has work left.
+static int steal(worker_pool_t *pool, size_t self, size_t participants) {
+    for (size_t k = 1; k < participants; k++) {
+        _Atomic uint64_t *victim = &pool->ranges[(self + k) % participants];
+        uint64_t r = atomic_load_explicit(victim, memory_order_relaxed);
+        while (range_next(r) < range_end(r)) {
+            uint32_t next = range_next(r), end = range_end(r);
+            uint32_t mid = next + (end - next) / 2; // Leaves the victim at least one chunk if it has two
+            if (atomic_compare_exchange_weak_explicit(victim, &r, pack_range(next, mid),
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                // Nobody else writes an empty range, so a plain store is enough.
+                atomic_store_explicit(&pool->ranges[self], pack_range(mid, end), memory_order_relaxed);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Processes chunks until every participant's range is empty.
+static void run_job(worker_pool_t *pool, size_t self) {
+    size_t participants = pool->num_threads + 1;
+    uint32_t chunk;
+    for (;;) {
+        while (take_own(&pool->ranges[self], &chunk)) {
+            pool->fn(pool->arg, chunk, (size_t)chunk + 1);
+        }
+        if (!steal(pool, self, participants)) {
+            return;
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker_pool_t *pool = arg;
+    size_t self = 0;
+    unsigned long seen = 0;
+
+    // Each thread's participant index is fixed by its position in threads[].
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        if (pthread_equal(pool->threads[i], pthread_self())) {
+            self = i + 1; // Participant 0 is the calling thread
+        }
+    }
+    seen = pool->generation;
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_job(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->done_cv);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+worker_pool_t *worker_pool_create(size_t num_threads) {
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 1 ? (size_t)cpus - 1 : 0;
+    }
+
+    worker_pool_t *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->ranges = calloc(num_threads + 1, sizeof(*pool->ranges));
+    pool->threads = calloc(num_threads > 0 ? num_threads : 1, sizeof(*pool->threads));
+    if (pool->ranges == NULL || pool->threads == NULL) {
+        free(pool->ranges);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->job_lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    // Hold the lock so workers see the complete threads[] array when they start.
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return pool;
+}
+
+void worker_pool_destroy(worker_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->job_lock);
+    free(pool->ranges);
+    free(pool->threads);
+    free(pool);
+}
+
+void worker_pool_parallel_for(worker_pool_t *pool, size_t num_chunks, parallel_chunk_fn fn, void *arg) {
+    if (num_chunks == 0) {
+        return;
+    }
+    if (pool == NULL || pool->num_threads == 0 || num_chunks == 1 || num_chunks > UINT32_MAX) {
+        fn(arg, 0, num_chunks);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->job_lock);
+
+    // Split the chunks evenly; stealing evens out the rest.
+    size_t participants = pool->num_threads + 1;
+    for (size_t i = 0; i < participants; i++) {
+        size_t begin = num_chunks * i / participants;
+        size_t end = num_chunks * (i + 1) / participants;
+        atomic_store_explicit(&pool->ranges[i], pack_range((uint32_t)begin, (uint32_t)end), memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->active = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_job(pool, 0);
+
+    // Chunks stolen by other threads may still be running.
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->job_lock);
+}
+
+// Validates domains [begin, end) into bitmap (and rejects, if not NULL).
+// begin must be a multiple of 64.
+static size_t validate_range(const domain_slice_t *domains, size_t begin, size_t end, uint64_t *bitmap,
+                             batch_reject_t *rejects) {
+    size_t valid = 0;
+    for (size_t base = begin; base < end; base += 64) {
+        size_t stop = end - base < 64 ? end - base : 64;
+        uint64_t word = 0;
+        for (size_t j = 0; j < stop; j++) {
+            const domain_slice_t *d = &domains[base + j];
+            uint64_t ok;
+            if (rejects != NULL) {
+                size_t offset;
+                tld_reason_t reason = tld_check_domain_simd(d->p, d->len, &offset);
+                rejects[base + j].reason = (uint16_t)reason;
+                rejects[base + j].offset = (uint16_t)offset;
+                ok = reason == TLD_OK;
+            } else {
+                ok = (uint64_t)is_valid_domain_simd(d->p, d->len);
+            }
+            word |= ok << j;
+            valid += (size_t)ok;
+        }
+        bitmap[base / 64] = word;
+    }
+    return valid;
+}
+
+size_t validate_domains(const domain_slice_t *domains, size_t count, uint64_t *bitmap, batch_reject_t *rejects) {
+    return validate_range(domains, 0, count, bitmap, rejects);
+}
+
+// Shared state of one validate_domains_parallel() call.
+typedef struct {
+    const domain_slice_t *domains;
+    size_t count;
+    uint64_t *bitmap;
+    batch_reject_t *rejects;
+    atomic_size_t valid;
+} validate_job_t;
+
+static void validate_chunks(void *arg, size_t begin, size_t end) {
+    validate_job_t *job = arg;
+    size_t lo = begin * BATCH_CHUNK_SIZE;
+    size_t hi = end * BATCH_CHUNK_SIZE < job->count ? end * BATCH_CHUNK_SIZE : job->count;
+    size_t valid = validate_range(job->domains, lo, hi, job->bitmap, job->rejects);
+    atomic_fetch_add_explicit(&job->valid, valid, memory_order_relaxed);
+}
+
+size_t validate_domains_parallel(worker_pool_t *pool, const domain_slice_t *domains, size_t count, uint64_t *bitmap,
+                                 batch_reject_t *rejects) {
+    if (pool == NULL || count < BATCH_PARALLEL_MIN) {
+        return validate_domains(domains, count, bitmap, rejects);
+    }
+    validate_job_t job = {domains, count, bitmap, rejects, 0};
+    size_t num_chunks = (count + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE;
+    worker_pool_parallel_for(pool, num_chunks, validate_chunks, &job);
+    return atomic_load_explicit(&job.valid, memory_order_relaxed);
+}
+
+// A queued task.
+typedef struct task {
+    task_fn fn;
+    void *arg;
+    struct task *next;
+} task_t;
+
+struct task_queue {
+    pthread_t *threads;
+    size_t num_threads;
+
+    pthread_mutex_t lock;   // Protects the fields below
+    pthread_cond_t task_cv; // Signaled when a task is queued or on shutdown
+    task_t *head;           // Oldest task, or NULL
+    task_t **tail;          // Link to append the next task to
+    int shutdown;
+};
+
+static void *task_main(void *arg) {
+    task_queue_t *queue = arg;
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        while (queue->head == NULL && !queue->shutdown) {
+            pthread_cond_wait(&queue->task_cv, &queue->lock);
+        }
+        task_t *task = queue->head;
+        if (task == NULL) {
+            break; // Shut down and nothing left to run
+        }
+        queue->head = task->next;
+        if (queue->head == NULL) {
+            queue->tail = &queue->head;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        task->fn(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+task_queue_t *task_queue_create(size_t num_threads) {
+    task_queue_t *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->threads = calloc(num_threads > 0 ? num_threads : 1, sizeof(*queue->threads));
+    if (queue->threads == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->task_cv, NULL);
+    queue->tail = &queue->head;
+    for (size_t i = 0; i < (num_threads > 0 ? num_threads : 1); i++) {
+        if (pthread_create(&queue->threads[i], NULL, task_main, queue) != 0) {
+            break;
+        }
+        queue->num_threads++;
+    }
+    if (queue->num_threads == 0) {
+        task_queue_destroy(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void task_queue_destroy(task_queue_t *queue) {
+    if (queue == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = 1;
+    pthread_cond_broadcast(&queue->task_cv);
+    pthread_mutex_unlock(&queue->lock);
+    for (size_t i = 0; i < queue->num_threads; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+    // Without threads, nothing ran the queue; tasks own their arg.
+    while (queue->head != NULL) {
+        task_t *task = queue->head;
+        queue->head = task->next;
+        task->fn(task->arg);
+        free(task);
+    }
+    pthread_cond_destroy(&queue->task_cv);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->threads);
+    free(queue);
+}
+
+int task_queue_submit(task_queue_t *queue, task_fn fn, void *arg) {
+    task_t *task = malloc(sizeof(*task));
+    if (task == NULL) {
+        return -1;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    *queue->tail = task;
+    queue->tail = &task->next;
+    pthread_cond_signal(&queue->task_cv);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
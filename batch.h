@@ -0,0 +1,85 @@
+// batch.h
+// Batch domain validation and the worker pool that parallelizes it.
+// Used by the bulk validation endpoint and by the offline tools. Also a task
+// queue that runs whole requests off the event loop threads.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint64_t
+
+// A domain as a slice of a larger buffer; it is not NUL-terminated.
+typedef struct {
+    const char *p;
+    size_t len;
+} domain_slice_t;
+
+// Why a domain was rejected: a tld_reason_t (TLD_OK for valid entries) and the
+// offset reported with it. Offsets never exceed TLD_MAX_IDN_INPUT_LEN.
+typedef struct {
+    uint16_t reason;
+    uint16_t offset;
+} batch_reject_t;
+
+// Number of 64-bit words needed for a result bitmap of count entries.
+#define BATCH_BITMAP_WORDS(count) (((count) + 63) / 64)
+
+// Returns 1 if bit i of bitmap is set (entry i is valid).
+#define BATCH_BITMAP_TEST(bitmap, i) ((int)(((bitmap)[(i) / 64] >> ((i) % 64)) & 1))
+
+// Callback for worker_pool_parallel_for(): processes chunks [begin, end).
+typedef void (*parallel_chunk_fn)(void *arg, size_t begin, size_t end);
+
+// Fixed-size pool of worker threads. Opaque; see batch.c.
+typedef struct worker_pool worker_pool_t;
+
+// Validates count domains on the calling thread.
+// bitmap: Receives one bit per domain (bit i of word i / 64 is set if domains[i]
+//         is valid). Must hold BATCH_BITMAP_WORDS(count) words.
+// rejects: If not NULL, receives the reason for every entry (count entries),
+//          from the same pass that computes the verdict.
+// Returns the number of valid domains.
+size_t validate_domains(const domain_slice_t *domains, size_t count, uint64_t *bitmap, batch_reject_t *rejects);
+
+// Same as validate_domains(), but splits the batch across the pool's threads
+// (and the calling thread). Falls back to validate_domains() when pool is NULL
+// or the batch is too small to be worth splitting.
+size_t validate_domains_parallel(worker_pool_t *pool, const domain_slice_t *domains, size_t count, uint64_t *bitmap,
+                                 batch_reject_t *rejects);
+
+// Creates a pool with num_threads background threads. 0 means one per online
+// CPU minus one, as the thread calling into the pool also does work.
+// Returns NULL on failure.
+worker_pool_t *worker_pool_create(size_t num_threads);
+
+// Stops and joins the pool's threads and frees the pool. NULL is ignored.
+void worker_pool_destroy(worker_pool_t *pool);
+
+// Runs fn over num_chunks chunks on every thread of the pool and returns when
+// all chunks are done. The chunks are first split evenly between threads;
+// a thread that runs out of work steals half of the remaining range of another.
+// Calls from different threads are serialized.
+void worker_pool_parallel_for(worker_pool_t *pool, size_t num_chunks, parallel_chunk_fn fn, void *arg);
+
+// Function run by a task_queue_t thread.
+typedef void (*task_fn)(void *arg);
+
+// Background threads that run submitted tasks one at a time each, in the
+// order they were submitted. Unlike the worker pool, its threads may call
+// into the pool (worker_pool_parallel_for() calls are serialized), so a task
+// can hand a large batch on to every core. Opaque; see batch.c.
+typedef struct task_queue task_queue_t;
+
+// Creates a queue with num_threads (at least 1) threads. Returns NULL on failure.
+task_queue_t *task_queue_create(size_t num_threads);
+
+// Runs the tasks still queued, then stops and joins the threads and frees
+// the queue. NULL is ignored.
+void task_queue_destroy(task_queue_t *queue);
+
+// Queues fn(arg) to run on one of the queue's threads.
+// Returns 0 on success, or -1 if memory is exhausted.
+int task_queue_submit(task_queue_t *queue, task_fn fn, void *arg);
+
+#endif // BATCH_H
@@ -0,0 +1,370 @@
+// bench.c
+// Microbenchmarks for the domain validators, the router and the item
+// serializers. Usage: microbench [-f filter] [-r repetitions] [-t min_ms]
+//
+// Every benchmark is a loop body run for a given number of iterations. The
+// count is doubled until one run takes at least min_ms (default 50), then the
+// run is repeated (default 5 times) and the median and fastest time per
+// iteration are reported. Corpora are generated from a fixed seed, so numbers
+// from different builds are comparable.
+//
+// Build with optimization for meaningful numbers (see Cmake.makefile).
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "libtld.h"      // Validators under test
+#include "router.h"      // For router_init, router_dispatch
+#include "handlers.h"    // For handlers_init
+#include "utils.h"       // For static_responses_init
+#include "json_writer.h" // For the item serializer
+#include "json_reader.h" // For the item parser
+#include "store.h"       // For item_t
+#include "arena.h"       // For the request arena
+#include "log.h"         // To keep access logging out of the measurements
+#include "mongoose.h"    // For mg_http_parse, mg_iobuf_free
+#include "cJSON.h"       // For cJSON_InitHooks
+#include <stdint.h>      // For uint64_t
+#include <stdio.h>       // For printf
+#include <stdlib.h>      // For malloc, free, qsort, strtol
+#include <string.h>      // For memset, strlen, strstr, strcmp
+#include <time.h>        // For clock_gettime
+
+// Domains per corpus. Small enough to stay in L1/L2, like a hot batch.
+#define CORPUS_SIZE 4096
+#define MAX_REPETITIONS 64
+
+// One domain of a corpus, NUL-terminated for is_valid_domain().
+typedef struct {
+    char name[TLD_MAX_DOMAIN_LEN + 1];
+    size_t len;
+} corpus_entry_t;
+
+typedef enum { CORPUS_SHORT, CORPUS_LONG, CORPUS_INVALID_EARLY, CORPUS_INVALID_LATE, CORPUS_IDN, CORPUS_COUNT } corpus_id_t;
+
+static corpus_entry_t *corpora[CORPUS_COUNT];
+
+// Sink for results, so the compiler cannot drop the work being measured.
+static volatile uint64_t s_sink;
+
+// --- Corpus generation ---
+
+static uint64_t s_rng = 0x9E3779B97F4A7C15ull;
+
+// xorshift64*; deterministic across platforms.
+static uint32_t rng_next(void) {
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return (uint32_t)((s_rng * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static size_t rng_range(size_t lo, size_t hi) {
+    return lo + rng_next() % (hi - lo + 1);
+}
+
+// Appends a label of len letters, digits and inner hyphens.
+static size_t put_label(char *p, size_t len) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    for (size_t i = 0; i < len; i++) {
+        int inner = i > 0 && i + 1 < len;
+        p[i] = (inner && rng_next() % 12 == 0) ? '-' : chars[rng_next() % (sizeof(chars) - 1)];
+    }
+    return len;
+}
+
+static const char *const tlds[] = {"com", "net", "org", "de", "uk", "io"};
+
+// Builds labels of the given length range, then a TLD.
+static size_t make_domain(char *p, size_t num_labels, size_t min_len, size_t max_len) {
+    size_t len = 0;
+    for (size_t i = 0; i < num_labels; i++) {
+        len += put_label(p + len, rng_range(min_len, max_len));
+        p[len++] = '.';
+    }
+    const char *tld = tlds[rng_next() % (sizeof(tlds) / sizeof(tlds[0]))];
+    memcpy(p + len, tld, strlen(tld));
+    return len + strlen(tld);
+}
+
+static void build_corpora(void) {
+    static const char *const idn_labels[] = {"bücher", "müller", "пример", "例え", "ελληνικά", "mañana"};
+    for (int c = 0; c < CORPUS_COUNT; c++) {
+        corpora[c] = calloc(CORPUS_SIZE, sizeof(corpus_entry_t));
+        if (corpora[c] == NULL) {
+            fprintf(stderr, "microbench: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < CORPUS_SIZE; i++) {
+            corpus_entry_t *e = &corpora[c][i];
+            switch ((corpus_id_t)c) {
+            case CORPUS_SHORT: // www.example.com and the like
+                e->len = make_domain(e->name, rng_range(1, 2), 3, 12);
+                break;
+            case CORPUS_LONG: // Three labels of 50-63 bytes: about 190 bytes
+                e->len = make_domain(e->name, 3, 50, 63);
+                break;
+            case CORPUS_INVALID_EARLY: // Bad character in the first three bytes
+                e->len = make_domain(e->name, 2, 8, 20);
+                e->name[rng_range(0, 2)] = '_';
+                break;
+            case CORPUS_INVALID_LATE: // Long domain with a bad character in the TLD
+                e->len = make_domain(e->name, 3, 50, 63);
+                e->name[e->len - 1] = '!';
+                break;
+            case CORPUS_IDN: { // One Unicode label under an ASCII name
+                const char *label = idn_labels[rng_next() % (sizeof(idn_labels) / sizeof(idn_labels[0]))];
+                size_t n = strlen(label);
+                memcpy(e->name, label, n);
+                e->name[n] = '.';
+                e->len = n + 1 + make_domain(e->name + n + 1, 1, 3, 12);
+                break;
+            }
+            default:
+                break;
+            }
+            e->name[e->len] = '\0';
+        }
+    }
+}
+
+// --- Validator benchmarks ---
+
+// The corpus the validator benchmarks run on; set before each run.
+static const corpus_entry_t *s_corpus;
+
+static void bench_is_valid_domain(size_t iters) {
+    uint64_t valid = 0;
+    for (size_t i = 0; i < iters; i++) {
+        valid += (uint64_t)is_valid_domain(s_corpus[i % CORPUS_SIZE].name);
+    }
+    s_sink += valid;
+}
+
+static void bench_is_valid_domain_n(size_t iters) {
+    uint64_t valid = 0;
+    for (size_t i = 0; i < iters; i++) {
+        const corpus_entry_t *e = &s_corpus[i % CORPUS_SIZE];
+        valid += (uint64_t)is_valid_domain_n(e->name, e->len);
+    }
+    s_sink += valid;
+}
+
+static void bench_is_valid_domain_simd(size_t iters) {
+    uint64_t valid = 0;
+    for (size_t i = 0; i < iters; i++) {
+        const corpus_entry_t *e = &s_corpus[i % CORPUS_SIZE];
+        valid += (uint64_t)is_valid_domain_simd(e->name, e->len);
+    }
+    s_sink += valid;
+}
+
+static void bench_tld_check_domain_simd(size_t iters) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iters; i++) {
+        const corpus_entry_t *e = &s_corpus[i % CORPUS_SIZE];
+        size_t offset;
+        sum += (uint64_t)tld_check_domain_simd(e->name, e->len, &offset) + offset;
+    }
+    s_sink += sum;
+}
+
+static void bench_tld_check_domain_idna(size_t iters) {
+    uint64_t sum = 0;
+    char out[TLD_ASCII_BUF_SIZE];
+    for (size_t i = 0; i < iters; i++) {
+        const corpus_entry_t *e = &s_corpus[i % CORPUS_SIZE];
+        const char *ascii;
+        size_t ascii_len, offset;
+        sum += (uint64_t)tld_check_domain_idna(e->name, e->len, out, &ascii, &ascii_len, &offset) + ascii_len;
+    }
+    s_sink += sum;
+}
+
+// --- Router and serializer benchmarks ---
+
+// Scratch connection the handlers write their responses into. It has no
+// socket: mg_send() only appends to c->send, which is emptied after each
+// iteration.
+static struct mg_connection s_conn;
+static struct mg_http_message s_hm;
+static arena_t s_arena;
+
+// Parses a raw request into s_hm. The text must outlive the benchmark.
+static void set_request(const char *raw) {
+    if (mg_http_parse(raw, strlen(raw), &s_hm) <= 0) {
+        fprintf(stderr, "microbench: cannot parse request: %s\n", raw);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void bench_dispatch(size_t iters) {
+    for (size_t i = 0; i < iters; i++) {
+        router_dispatch(&s_conn, &s_hm);
+        s_sink += s_conn.send.len;
+        s_conn.send.len = 0;
+        arena_reset(&s_arena);
+    }
+}
+
+static void bench_write_item(size_t iters) {
+    item_t item = {42, "Sample Item 42", 4200, 1};
+    for (size_t i = 0; i < iters; i++) {
+        json_writer_t w;
+        jw_begin(&w, &s_conn, 200);
+        jw_object_open(&w);
+        jw_key(&w, "id");
+        jw_int(&w, item.id);
+        jw_key(&w, "name");
+        jw_string(&w, item.name);
+        jw_key(&w, "value");
+        jw_int(&w, item.value);
+        jw_object_close(&w);
+        s_sink += (uint64_t)jw_finish(&w) + s_conn.send.len;
+        s_conn.send.len = 0;
+    }
+}
+
+// Body parsed by the item reader benchmarks; set before each run.
+static const char *s_body;
+
+static void bench_read_item(size_t iters) {
+    size_t len = strlen(s_body);
+    for (size_t i = 0; i < iters; i++) {
+        item_fields_t fields;
+        s_sink += (uint64_t)json_read_item_fields(s_body, len, &fields) + (uint64_t)fields.value;
+        arena_reset(&s_arena); // The cJSON fallback allocates from the arena
+    }
+}
+
+// --- Driver ---
+
+typedef struct {
+    const char *name;
+    void (*fn)(size_t iters);
+    int corpus;          // Corpus for validator benchmarks, or -1
+    const char *request; // Raw request for dispatch benchmarks, or NULL
+    const char *body;    // Body for reader benchmarks, or NULL
+} benchmark_t;
+
+// One benchmark per corpus for the validator name.
+#define VALIDATOR_BENCHES(name) \
+    {#name "/short", bench_##name, CORPUS_SHORT, NULL, NULL}, \
+    {#name "/long", bench_##name, CORPUS_LONG, NULL, NULL}, \
+    {#name "/invalid_early", bench_##name, CORPUS_INVALID_EARLY, NULL, NULL}, \
+    {#name "/invalid_late", bench_##name, CORPUS_INVALID_LATE, NULL, NULL}
+
+static const benchmark_t benchmarks[] = {
+    VALIDATOR_BENCHES(is_valid_domain),
+    VALIDATOR_BENCHES(is_valid_domain_n),
+    VALIDATOR_BENCHES(is_valid_domain_simd),
+    VALIDATOR_BENCHES(tld_check_domain_simd),
+    {"tld_check_domain_idna/short", bench_tld_check_domain_idna, CORPUS_SHORT, NULL, NULL},
+    {"tld_check_domain_idna/idn", bench_tld_check_domain_idna, CORPUS_IDN, NULL, NULL},
+
+    {"router_dispatch/root", bench_dispatch, -1, "GET / HTTP/1.1\r\nHost: x\r\n\r\n", NULL},
+    {"router_dispatch/get_item", bench_dispatch, -1, "GET /api/v1/items/42 HTTP/1.1\r\nHost: x\r\n\r\n", NULL},
+    {"router_dispatch/items_page", bench_dispatch, -1, "GET /api/v1/items?limit=100 HTTP/1.1\r\nHost: x\r\n\r\n", NULL},
+    {"router_dispatch/get_domain", bench_dispatch, -1,
+     "GET /api/v1/domains/www.example.co.uk HTTP/1.1\r\nHost: x\r\n\r\n", NULL},
+    {"router_dispatch/not_found", bench_dispatch, -1, "GET /api/v2/nothing/here HTTP/1.1\r\nHost: x\r\n\r\n", NULL},
+
+    {"json/write_item", bench_write_item, -1, NULL, NULL},
+    {"json/read_item_fast", bench_read_item, -1, NULL, "{\"name\":\"Sample Item 42\",\"value\":4200}"},
+    {"json/read_item_fallback", bench_read_item, -1, NULL, "{\"name\":\"Sample \\\"Item\\\" 42\",\"value\":4.2e3}"},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const benchmark_t *b, int repetitions, uint64_t min_ns) {
+    if (b->corpus >= 0) {
+        s_corpus = corpora[b->corpus];
+    }
+    if (b->request != NULL) {
+        set_request(b->request);
+    }
+    s_body = b->body;
+
+    // Grow the iteration count until one run is long enough to time reliably.
+    size_t iters = 64;
+    for (;;) {
+        uint64_t start = now_ns();
+        b->fn(iters);
+        if (now_ns() - start >= min_ns || iters >= ((size_t)1 << 40)) {
+            break;
+        }
+        iters *= 2;
+    }
+
+    double per_iter[MAX_REPETITIONS];
+    for (int r = 0; r < repetitions; r++) {
+        uint64_t start = now_ns();
+        b->fn(iters);
+        per_iter[r] = (double)(now_ns() - start) / (double)iters;
+    }
+    qsort(per_iter, (size_t)repetitions, sizeof(per_iter[0]), compare_double);
+    printf("%-48s %10.1f ns/op  (min %.1f, %zu iterations x %d)\n", b->name, per_iter[repetitions / 2], per_iter[0],
+           iters, repetitions);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f filter] [-r repetitions] [-t min_ms]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = NULL;
+    long repetitions = 5;
+    long min_ms = 50;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            min_ms = strtol(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS || min_ms < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Same setup as the server, minus the sockets. Access log entries are
+    // below LOG_WARN, so they are discarded before being formatted.
+    log_set_level(LOG_WARN);
+    arena_init(&s_arena);
+    arena_set_current(&s_arena);
+    cJSON_Hooks hooks = {request_alloc, request_free};
+    cJSON_InitHooks(&hooks);
+    if (handlers_init(NULL) != 0 || static_responses_init() != 0 || router_init() != 0) {
+        fprintf(stderr, "microbench: server initialization failed\n");
+        return EXIT_FAILURE;
+    }
+    build_corpora();
+
+    printf("SIMD kernel: %s\n", tld_simd_kernel_name());
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (filter == NULL || strstr(benchmarks[i].name, filter) != NULL) {
+            run(&benchmarks[i], (int)repetitions, (uint64_t)min_ms * 1000000u);
+        }
+    }
+
+    mg_iobuf_free(&s_conn.send);
+    arena_free(&s_arena);
+    for (int c = 0; c < CORPUS_COUNT; c++) {
+        free(corpora[c]);
+    }
+    return EXIT_SUCCESS;
+}
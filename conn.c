@@ -0,0 +1,346 @@
+// conn.c
+// Implements per-connection state and response streaming.
+
+#include "conn.h"     // Header for connection state declarations
+#include "mongoose.h" // Mongoose types and functions
+#include "log.h"      // For log_message
+#include "utils.h"    // For send_static_response
+#include <stdlib.h>   // For calloc, free
+#include <string.h>   // For memchr, memcmp
+
+// A stream is topped up while less than this much output is queued, so any
+// one streamed response has about this much memory in flight.
+#define STREAM_LOW_WATER (64u * 1024)
+
+// Send buffer a new connection starts with: room for typical responses, so
+// they are written without regrowing it.
+#define CONN_SEND_INITIAL_BYTES 4096
+
+static unsigned s_idle_timeout_ms = CONN_DEFAULT_IDLE_TIMEOUT_MS;
+static unsigned s_max_requests = CONN_DEFAULT_MAX_REQUESTS;
+
+void conn_set_limits(unsigned idle_timeout_ms, unsigned max_requests) {
+    s_idle_timeout_ms = idle_timeout_ms;
+    s_max_requests = max_requests;
+}
+
+int conn_open(struct mg_connection *c) {
+    conn_t *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        return -1;
+    }
+    conn->last_active_ms = mg_millis();
+    c->fn_data = conn;
+    if (c->send.size < CONN_SEND_INITIAL_BYTES) {
+        mg_iobuf_resize(&c->send, CONN_SEND_INITIAL_BYTES); // Grown on demand if this fails
+    }
+    return 0;
+}
+
+// Ends the active stream and releases its state.
+static void stop_stream(struct mg_connection *c, conn_t *conn) {
+    free(conn->stream_state);
+    conn->stream = NULL;
+    conn->stream_state = NULL;
+    if (conn->close_after_stream) {
+        c->is_draining = 1;
+    }
+}
+
+void conn_close(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return;
+    }
+    free(conn->stream_state);
+    mg_iobuf_free(&conn->held);
+    free(conn->deferred_record);
+    free(conn);
+    c->fn_data = NULL;
+}
+
+conn_t *conn_get(struct mg_connection *c) {
+    return c->is_accepted ? (conn_t *) c->fn_data : NULL;
+}
+
+// Calls the stream producer once and handles its result.
+// Returns 1 if the stream is still active afterwards.
+static int step_stream(struct mg_connection *c, conn_t *conn) {
+    int rc = conn->stream(c, conn->stream_state);
+    if (rc == 0) {
+        return 1;
+    }
+    if (rc < 0) {
+        // Part of the body is already sent; the only way to signal the
+        // failure to the client is to cut the connection.
+        log_message(LOG_ERROR, "msg=\"streamed response failed, closing connection\" conn=%lu", c->id);
+        c->is_closing = 1;
+    }
+    stop_stream(c, conn);
+    return 0;
+}
+
+void conn_start_stream(struct mg_connection *c, conn_stream_fn stream, void *state) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        free(state);
+        c->is_closing = 1;
+        return;
+    }
+    conn->stream = stream;
+    conn->stream_state = state;
+    conn_continue_stream(c);
+}
+
+void conn_continue_stream(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return;
+    }
+    while (conn->stream != NULL && !c->is_closing && c->send.len < STREAM_LOW_WATER) {
+        if (!step_stream(c, conn)) {
+            break;
+        }
+    }
+}
+
+void conn_finish_stream(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return;
+    }
+    while (conn->stream != NULL && step_stream(c, conn)) {
+    }
+}
+
+void conn_drain(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn != NULL && conn->deferred) {
+        conn->last_request = 1; // Closed after the deferred response
+    } else if (conn != NULL && conn->stream != NULL) {
+        conn->close_after_stream = 1;
+    } else {
+        c->is_draining = 1;
+    }
+}
+
+// Returns whether a comma-separated header value lists token (ASCII, case
+// does not matter), as in "Connection: keep-alive, Upgrade".
+static int has_token(struct mg_str value, const char *token) {
+    size_t token_len = strlen(token);
+    size_t i = 0;
+    while (i < value.len) {
+        while (i < value.len && (value.p[i] == ' ' || value.p[i] == '\t' || value.p[i] == ',')) i++;
+        size_t start = i;
+        while (i < value.len && value.p[i] != ',') i++;
+        size_t stop = i;
+        while (stop > start && (value.p[stop - 1] == ' ' || value.p[stop - 1] == '\t')) stop--;
+        if (stop - start == token_len) {
+            size_t k = 0;
+            while (k < token_len && (value.p[start + k] | 0x20) == token[k]) k++;
+            if (k == token_len) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int conn_begin_request(struct mg_connection *c, struct mg_http_message *hm) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return 0;
+    }
+    if (conn->last_request) {
+        return -1; // Pipelined after the last request; never answered
+    }
+    conn->requests++;
+    conn->response_start = c->send.len;
+    struct mg_str *connection = mg_http_get_header(hm, "Connection");
+    int http10 = hm->proto.len == 8 && memcmp(hm->proto.p, "HTTP/1.0", 8) == 0;
+    if (connection != NULL && has_token(*connection, "close")) {
+        conn->last_request = 1;
+    } else if (http10) {
+        // HTTP/1.0 connections are kept only on request, and must say so.
+        conn->keep_alive_header = connection != NULL && has_token(*connection, "keep-alive");
+        conn->last_request = !conn->keep_alive_header;
+    }
+    if (s_max_requests != 0 && conn->requests >= s_max_requests) {
+        conn->last_request = 1;
+    }
+    return 0;
+}
+
+// Adds a header line to the response that starts at offset start of c->send,
+// right after its status line.
+static void insert_header(struct mg_connection *c, size_t start, const char *line) {
+    if (start >= c->send.len) {
+        return; // Nothing was sent
+    }
+    const unsigned char *eol = memchr(c->send.buf + start, '\n', c->send.len - start);
+    if (eol != NULL && mg_iobuf_add(&c->send, (size_t) (eol + 1 - c->send.buf), line, strlen(line)) == 0) {
+        log_message(LOG_ERROR, "msg=\"failed to add a Connection header\" conn=%lu", c->id);
+    }
+}
+
+// Hands the input held back during a deferred response to Mongoose, which
+// parses (and dispatches) it as if it had just been received.
+static void release_input(struct mg_connection *c, conn_t *conn) {
+    size_t len = conn->held.len;
+    if (len == 0) {
+        return;
+    }
+    if (conn->discard_input) {
+        mg_iobuf_free(&conn->held);
+        return;
+    }
+    if (mg_iobuf_add(&c->recv, c->recv.len, conn->held.buf, len) == 0) {
+        log_message(LOG_ERROR, "msg=\"failed to buffer pipelined requests, closing connection\" conn=%lu", c->id);
+        c->is_closing = 1;
+        mg_iobuf_free(&conn->held);
+        return;
+    }
+    mg_iobuf_free(&conn->held);
+    long n = (long) len;
+    mg_call(c, MG_EV_READ, &n);
+}
+
+void conn_end_request(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL || conn->deferred) {
+        return;
+    }
+    if (conn->last_request) {
+        insert_header(c, conn->response_start, "Connection: close\r\n");
+        conn->discard_input = 1;
+        conn_drain(c);
+    } else if (conn->keep_alive_header) {
+        insert_header(c, conn->response_start, "Connection: keep-alive\r\n");
+    }
+    release_input(c, conn);
+}
+
+int conn_defer_response(struct mg_connection *c, struct mg_http_message *hm) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL || conn->deferred) {
+        return -1;
+    }
+    // Mongoose goes on to parse whatever follows the request in c->recv;
+    // hold that back so it sees nothing more.
+    const unsigned char *end = (const unsigned char *) hm->message.p + hm->message.len;
+    if (end < c->recv.buf || end > c->recv.buf + c->recv.len) {
+        return -1; // Not a request parsed from c->recv
+    }
+    size_t rest = (size_t) (c->recv.buf + c->recv.len - end);
+    if (rest > 0 && mg_iobuf_add(&conn->held, 0, end, rest) == 0) {
+        return -1;
+    }
+    c->recv.len -= rest;
+    conn->deferred = 1;
+    return 0;
+}
+
+void conn_cancel_deferral(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL || !conn->deferred) {
+        return;
+    }
+    conn->deferred = 0;
+    // Put the held input back behind the request, where Mongoose goes on
+    // parsing. It fits the room it was taken from, so the buffer (and the
+    // request pointing into it) does not move.
+    if (conn->held.len > 0 && mg_iobuf_add(&c->recv, c->recv.len, conn->held.buf, conn->held.len) == 0) {
+        log_message(LOG_ERROR, "msg=\"failed to buffer pipelined requests, closing connection\" conn=%lu", c->id);
+        c->is_closing = 1;
+    }
+    mg_iobuf_free(&conn->held);
+}
+
+void conn_resume_response(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return;
+    }
+    conn->deferred = 0;
+    conn->response_start = c->send.len;
+    conn->last_active_ms = mg_millis();
+}
+
+struct mg_connection *conn_find(struct mg_mgr *mgr, unsigned long id) {
+    for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) {
+        if (c->id == id) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// Answers an oversized request with a fixed error and closes the connection
+// once that is flushed, ignoring whatever the client sends meanwhile.
+static void refuse_request(struct mg_connection *c, conn_t *conn, static_response_t response) {
+    log_message(LOG_DEBUG, "msg=\"request too large, closing connection\" conn=%lu buffered=%zu", c->id, c->recv.len);
+    mg_iobuf_del(&c->recv, 0, c->recv.len);
+    conn_finish_stream(c);
+    send_static_response(c, response);
+    conn->last_request = 1;
+    conn->discard_input = 1;
+    conn_drain(c);
+}
+
+void conn_check_receive(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL || c->recv.len == 0) {
+        return;
+    }
+    if (conn->discard_input) {
+        mg_iobuf_del(&c->recv, 0, c->recv.len);
+        return;
+    }
+    if (conn->deferred) {
+        // Held back until the deferred response is out, within the same
+        // bound as a single request.
+        if (conn->held.len + c->recv.len > CONN_MAX_REQUEST_BYTES ||
+            mg_iobuf_add(&conn->held, conn->held.len, c->recv.buf, c->recv.len) == 0) {
+            log_message(LOG_DEBUG, "msg=\"too much pipelined input, closing connection\" conn=%lu", c->id);
+            c->is_closing = 1;
+        }
+        mg_iobuf_del(&c->recv, 0, c->recv.len);
+        return;
+    }
+    // Runs before Mongoose parses the new data, so the first buffered
+    // request is the one still being received.
+    struct mg_http_message hm;
+    int n = mg_http_parse((const char *) c->recv.buf, c->recv.len, &hm);
+    if (n == 0 && c->recv.len > CONN_MAX_HEADER_BYTES) {
+        refuse_request(c, conn, RESP_HEADERS_TOO_LARGE);
+    } else if (n > 0 && hm.message.len > CONN_MAX_REQUEST_BYTES) {
+        refuse_request(c, conn, RESP_REQUEST_TOO_LARGE);
+    }
+    // n < 0: malformed, which Mongoose reports itself
+}
+
+void conn_touch(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn != NULL) {
+        conn->last_active_ms = mg_millis();
+    }
+}
+
+void conn_poll(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    if (conn == NULL) {
+        return;
+    }
+    if (s_idle_timeout_ms != 0 && !conn->deferred && mg_millis() - conn->last_active_ms > s_idle_timeout_ms) {
+        log_message(LOG_DEBUG, "msg=\"idle timeout, closing connection\" conn=%lu requests=%u", c->id, conn->requests);
+        c->is_closing = 1;
+        return;
+    }
+    // Keep the buffers for the next request, but not the room a large one needed.
+    if (conn->stream == NULL && c->send.len == 0 && c->send.size > CONN_BUFFER_KEEP_BYTES) {
+        mg_iobuf_resize(&c->send, CONN_BUFFER_KEEP_BYTES);
+    }
+    if (c->recv.len <= CONN_BUFFER_KEEP_BYTES && c->recv.size > CONN_BUFFER_KEEP_BYTES) {
+        mg_iobuf_resize(&c->recv, CONN_BUFFER_KEEP_BYTES);
+    }
+}
@@ -0,0 +1,140 @@
+// conn.h
+// Per-connection state, kept in c->fn_data of every accepted connection.
+// It holds the producer of a streamed response body (a response that is
+// generated piece by piece whenever the send buffer has drained, so only a
+// bounded part of it is ever buffered) and the bookkeeping of persistent
+// connections: activity for the idle timeout, the number of requests served,
+// and whether the current response is the last one.
+//
+// Limits of persistent connections:
+//   - a connection without activity for the idle timeout is closed, whether
+//     it sits between requests, in the middle of one, or has stopped reading;
+//   - after the maximum number of requests the response says "Connection:
+//     close" and the connection closes once it is flushed, as it does when
+//     the client asks for that (or speaks HTTP/1.0 without keep-alive);
+//     pipelined requests after the last one are left unanswered;
+//   - a request is refused (and the connection closed) as soon as its
+//     headers exceed CONN_MAX_HEADER_BYTES or its Content-Length exceeds
+//     CONN_MAX_REQUEST_BYTES, so the receive buffer never grows beyond that;
+//   - both buffers are kept across requests, but shrunk back to
+//     CONN_BUFFER_KEEP_BYTES once a large request or response is done.
+//
+// A handler may defer its response, to compute it on another thread. Input
+// that arrives meanwhile (pipelined requests) is held back unparsed, so the
+// responses still go out in request order; it is parsed once the deferred
+// response has been written. The idle timeout does not apply meanwhile.
+
+#ifndef CONN_H
+#define CONN_H
+
+#include "mongoose.h" // For struct mg_connection
+#include <stdint.h>   // For uint64_t
+
+// Defaults of the limits (see conn_set_limits).
+#define CONN_DEFAULT_IDLE_TIMEOUT_MS 30000
+#define CONN_DEFAULT_MAX_REQUESTS 10000
+
+// Largest request head, and largest request including its body.
+#define CONN_MAX_HEADER_BYTES (16u * 1024)
+#define CONN_MAX_REQUEST_BYTES (2u * 1024 * 1024)
+
+// Buffer capacity a connection keeps between requests. New connections
+// start with this much room for their first response.
+#define CONN_BUFFER_KEEP_BYTES (16u * 1024)
+
+// Writes the next part of a streamed response into c->send.
+// Returns 0 while more remains, 1 once the response is complete,
+// or -1 if it cannot be completed (the connection is then closed).
+typedef int (*conn_stream_fn)(struct mg_connection *c, void *state);
+
+typedef struct {
+    conn_stream_fn stream;   // Active streamed response, or NULL
+    void *stream_state;      // malloc'd state of the stream, freed when it ends
+    int close_after_stream;  // Close once the stream has been flushed
+    uint64_t last_active_ms; // Last accept, read or write (mg_millis())
+    unsigned requests;       // Requests answered so far
+    int last_request;        // The current (or last) response ends the connection
+    int keep_alive_header;   // An HTTP/1.0 client asked to keep the connection
+    int discard_input;       // Nothing more is read from the client
+    size_t response_start;   // Offset in c->send of the current response
+    int deferred;            // The current response is written later
+    struct mg_iobuf held;    // Input received while the response is deferred
+    void *deferred_record;   // malloc'd by the router for the deferred request (see router.c)
+} conn_t;
+
+// Sets the idle timeout and the maximum number of requests per connection;
+// 0 disables a limit. Call before any event loop starts.
+void conn_set_limits(unsigned idle_timeout_ms, unsigned max_requests);
+
+// Attaches a new conn_t to an accepted connection (MG_EV_ACCEPT).
+// Returns 0 on success, or -1 if memory is exhausted.
+int conn_open(struct mg_connection *c);
+
+// Releases the connection's state (MG_EV_CLOSE).
+void conn_close(struct mg_connection *c);
+
+// Returns the state of an accepted connection, or NULL for listeners.
+conn_t *conn_get(struct mg_connection *c);
+
+// Called for every request before it is dispatched (MG_EV_HTTP_MSG).
+// Returns 0 if it is to be answered, or -1 if it was pipelined after the
+// last request of the connection.
+int conn_begin_request(struct mg_connection *c, struct mg_http_message *hm);
+
+// Called once the request's response has been queued. Marks the last
+// response with "Connection: close" (or a kept HTTP/1.0 connection with
+// "Connection: keep-alive") and closes the connection after it. Does
+// nothing while the response is deferred; after a deferred response, parses
+// the input held back meanwhile.
+void conn_end_request(struct mg_connection *c);
+
+// Defers the response of the request being dispatched (from its handler):
+// the request is complete once conn_resume_response(), the response and
+// conn_end_request() follow, typically from work posted back to the loop.
+// hm is the request; input after it is held back until then.
+// Returns 0 on success, or -1 if the connection cannot defer (the handler
+// then has to respond at once).
+int conn_defer_response(struct mg_connection *c, struct mg_http_message *hm);
+
+// Undoes conn_defer_response() from the same handler, which then responds
+// at once after all.
+void conn_cancel_deferral(struct mg_connection *c);
+
+// Called before the deferred response is written.
+void conn_resume_response(struct mg_connection *c);
+
+// Returns the connection of mgr with the given id (c->id), or NULL if it
+// has been closed meanwhile.
+struct mg_connection *conn_find(struct mg_mgr *mgr, unsigned long id);
+
+// Refuses a partially received request that exceeds the size limits.
+// Call on MG_EV_READ, before the HTTP protocol handler parses the new data:
+// the checks rely on the first buffered request being the one still being
+// received. While a response is deferred, moves the input to the held buffer.
+void conn_check_receive(struct mg_connection *c);
+
+// Records that the connection made progress (MG_EV_ACCEPT, MG_EV_READ,
+// MG_EV_WRITE).
+void conn_touch(struct mg_connection *c);
+
+// Closes the connection once it has been idle for too long, and shrinks
+// buffers that are no longer needed (MG_EV_POLL).
+void conn_poll(struct mg_connection *c);
+
+// Starts streaming a response; the headers must already be in c->send.
+// state must be malloc'd and is owned by the connection from now on.
+// The first part is written immediately.
+void conn_start_stream(struct mg_connection *c, conn_stream_fn stream, void *state);
+
+// Tops up the send buffer of an active stream (MG_EV_WRITE and MG_EV_POLL).
+void conn_continue_stream(struct mg_connection *c);
+
+// Completes an active stream at once, before another response is written
+// on the same connection (a pipelined request).
+void conn_finish_stream(struct mg_connection *c);
+
+// Marks the connection to be closed once its pending output is flushed,
+// waiting for an active stream to complete first. Used when shutting down.
+void conn_drain(struct mg_connection *c);
+
+#endif // CONN_H
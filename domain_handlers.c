@@ -0,0 +1,773 @@
+// domain_handlers.c
+// Implements the domain validation endpoints on top of libtld.
+// Request bodies are parsed in place: every domain is collected as a
+// (pointer, length) slice of hm->body, so no per-domain copies are made
+// even for multi-megabyte batches. The slices are then validated in one
+// batch (see batch.c), split across the worker pool when one is configured.
+//
+// Bodies of BULK_OFFLOAD_MIN_BYTES or more are validated off the event loop:
+// the body is copied and the whole request (parsing, validation, rendering)
+// runs on a task queue thread, whose result is posted back to the loop that
+// owns the connection (see evloop.h); that loop writes the deferred response
+// (see conn.h). Smaller bodies are handled inline, where the copy and the
+// round trip between threads would cost more than they save.
+
+#define _POSIX_C_SOURCE 200809L // For pthread mutexes
+
+#include "domain_handlers.h" // Header for handler declarations
+#include "mongoose.h"        // Mongoose types and functions
+#include "libtld.h"          // For is_valid_domain_simd, tld_check_domain_idna, tld_reason_name
+#include "batch.h"           // For domain_slice_t, validate_domains_parallel
+#include "vcache.h"          // For vcache_lookup, vcache_check, vcache_get_stats
+#include "utils.h"           // For send_json_response, send_error_response, send_static_response
+#include "cJSON.h"           // For single-domain responses
+#include "arena.h"           // For request-scoped allocations
+#include "metrics.h"         // For validation counters
+#include "conn.h"            // For deferred responses
+#include "evloop.h"          // For posting offloaded results back
+#include "router.h"          // For router_record_deferred
+#include <stdio.h>           // For snprintf
+#include <stdlib.h>          // For malloc, free
+#include <string.h>          // For memchr, memcpy, memset
+#include <pthread.h>         // For the cache registry lock
+
+// Upper bound on the size of the response prefix ({"total":..,"results":[).
+#define BULK_PREFIX_MAX 128
+
+// Upper bound on one rejects entry: {"index":N,"reason":"..","offset":N},
+#define BULK_REJECT_MAX 80
+
+// Upper bound on one ascii entry without the domain: {"index":N,"domain":""},
+#define BULK_IDN_ENTRY_MAX 48
+
+// Initial slice capacity, as a guess of input bytes per domain.
+#define BULK_BYTES_PER_DOMAIN_GUESS 16
+
+// Bodies at least this large are validated on a task queue thread.
+#define BULK_OFFLOAD_MIN_BYTES (64u * 1024)
+
+// Batches of at most this many domains are validated through the event
+// loop's verdict cache. Larger ones go to validate_domains_parallel(), where
+// a single batch of new domains would also flush the cache.
+#define BULK_CACHE_MAX_DOMAINS 1024
+
+// Worker pool used for large batches; NULL validates on the event loop thread.
+static worker_pool_t *s_pool = NULL;
+
+// Task queue that large bodies are handed to; NULL handles them inline.
+static task_queue_t *s_offload = NULL;
+
+// Verdict cache of the calling event loop thread; NULL computes every lookup.
+static _Thread_local vcache_t *s_cache = NULL;
+
+// Every cache registered through domain_handlers_set_cache(), for the stats
+// endpoint. Registration happens at thread startup only.
+#define MAX_CACHES 256
+static vcache_t *s_all_caches[MAX_CACHES];
+static size_t s_num_caches = 0;
+static pthread_mutex_t s_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Growable list of domain slices pointing into the request body.
+typedef struct {
+    domain_slice_t *items;
+    size_t count;
+    size_t cap;
+} slice_list_t;
+
+// Appends one slice. Returns 0 on success, -1 if memory is exhausted.
+static int slice_list_add(slice_list_t *list, const char *p, size_t len) {
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 64;
+        domain_slice_t *items = request_realloc(list->items, new_cap * sizeof(*items));
+        if (items == NULL) {
+            return -1;
+        }
+        list->items = items;
+        list->cap = new_cap;
+    }
+    list->items[list->count].p = p;
+    list->items[list->count].len = len;
+    list->count++;
+    return 0;
+}
+
+// Returns 1 for the whitespace characters allowed around entries.
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parse results.
+#define PARSE_OK 0
+#define PARSE_INVALID -1 // Malformed body
+#define PARSE_NO_MEMORY -2
+
+// Returns the value of four hex digits at p, or -1 if they are not.
+static long hex4(const char *p) {
+    long v = 0;
+    for (int i = 0; i < 4; i++) {
+        char ch = p[i];
+        int d = ch >= '0' && ch <= '9' ? ch - '0'
+              : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+              : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : -1;
+        if (d < 0) {
+            return -1;
+        }
+        v = v * 16 + d;
+    }
+    return v;
+}
+
+// Decodes the JSON string between p and end (without its quotes) into out,
+// as UTF-8. out needs room for end - p bytes: no escape decodes to more
+// bytes than it takes. Returns the decoded length, or -1 for a malformed
+// escape or a lone surrogate.
+static long decode_json_string(const char *p, const char *end, char *out) {
+    char *o = out;
+    while (p < end) {
+        if (*p != '\\') {
+            *o++ = *p++;
+            continue;
+        }
+        if (end - p < 2) {
+            return -1;
+        }
+        char esc = p[1];
+        p += 2;
+        switch (esc) {
+        case '"': *o++ = '"'; continue;
+        case '\\': *o++ = '\\'; continue;
+        case '/': *o++ = '/'; continue;
+        case 'b': *o++ = '\b'; continue;
+        case 'f': *o++ = '\f'; continue;
+        case 'n': *o++ = '\n'; continue;
+        case 'r': *o++ = '\r'; continue;
+        case 't': *o++ = '\t'; continue;
+        case 'u': break;
+        default: return -1;
+        }
+        long cp = end - p >= 4 ? hex4(p) : -1;
+        if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+            return -1;
+        }
+        p += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            // A high surrogate must be followed by an escaped low one.
+            long lo = end - p >= 6 && p[0] == '\\' && p[1] == 'u' ? hex4(p + 2) : -1;
+            if (lo < 0xDC00 || lo > 0xDFFF) {
+                return -1;
+            }
+            p += 6;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        }
+        if (cp < 0x80) {
+            *o++ = (char)cp;
+        } else if (cp < 0x800) {
+            *o++ = (char)(0xC0 | (cp >> 6));
+            *o++ = (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            *o++ = (char)(0xE0 | (cp >> 12));
+            *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (cp & 0x3F));
+        } else {
+            *o++ = (char)(0xF0 | (cp >> 18));
+            *o++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+            *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    return (long)(o - out);
+}
+
+// Parses a JSON array of strings in place.
+// Strings with escape sequences are decoded into *decoded, a buffer taken
+// from the request arena on the first one (NULL until then) that the caller
+// frees; their slices point there. Since decoding never grows a string, one
+// buffer the size of the rest of the body holds all of them.
+static int parse_json_array(const char *p, const char *end, slice_list_t *list, char **decoded) {
+    char *out = NULL; // Next free byte of *decoded
+    p++; // Skip the opening '['
+    while (p < end && is_space(*p)) p++;
+    if (p < end && *p == ']') {
+        p++;
+    } else {
+        for (;;) {
+            if (p >= end || *p != '"') {
+                return PARSE_INVALID; // Expected a string
+            }
+            const char *start = ++p;
+            int has_escape = 0;
+            while (p < end && *p != '"') {
+                if (*p == '\\') {
+                    has_escape = 1;
+                    p++; // Skip the escaped character
+                }
+                p++;
+            }
+            if (p >= end) {
+                return PARSE_INVALID; // Unterminated string
+            }
+            const char *slice = start;
+            size_t slice_len = (size_t)(p - start);
+            if (has_escape) {
+                if (*decoded == NULL) {
+                    out = *decoded = request_alloc((size_t)(end - start));
+                    if (out == NULL) {
+                        return PARSE_NO_MEMORY;
+                    }
+                }
+                long n = decode_json_string(start, p, out);
+                if (n < 0) {
+                    return PARSE_INVALID; // Malformed escape
+                }
+                slice = out;
+                slice_len = (size_t)n;
+                out += n;
+            }
+            if (slice_list_add(list, slice, slice_len) != 0) {
+                return PARSE_NO_MEMORY;
+            }
+            p++; // Skip the closing quote
+
+            while (p < end && is_space(*p)) p++;
+            if (p < end && *p == ',') {
+                p++;
+                while (p < end && is_space(*p)) p++;
+                continue;
+            }
+            if (p < end && *p == ']') {
+                p++;
+                break;
+            }
+            return PARSE_INVALID; // Expected ',' or ']'
+        }
+    }
+    while (p < end && is_space(*p)) p++;
+    return p == end ? PARSE_OK : PARSE_INVALID; // Nothing may follow the array
+}
+
+// Parses a newline-delimited list of domains in place.
+// Surrounding spaces, tabs and '\r' are trimmed; blank lines are skipped.
+static int parse_lines(const char *p, const char *end, slice_list_t *list) {
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (eol == NULL) {
+            eol = end;
+        }
+        const char *start = p;
+        const char *stop = eol;
+        while (start < stop && is_space(*start)) start++;
+        while (stop > start && is_space(*(stop - 1))) stop--;
+        if (stop > start && slice_list_add(list, start, (size_t)(stop - start)) != 0) {
+            return PARSE_NO_MEMORY;
+        }
+        p = eol + 1;
+    }
+    return PARSE_OK;
+}
+
+// An internationalized domain of a bulk request and its A-label form.
+typedef struct {
+    size_t index;
+    const char *ascii; // Copy in the request arena
+    size_t len;
+} idn_entry_t;
+
+// Growable list of converted domains.
+typedef struct {
+    idn_entry_t *items;
+    size_t count;
+    size_t cap;
+} idn_list_t;
+
+// Validates a short batch through the calling thread's verdict cache, the
+// way validate_domains() would without it. Returns the number of valid domains.
+static size_t validate_cached(const slice_list_t *list, uint64_t *bitmap, batch_reject_t *rejects) {
+    size_t valid = 0;
+    memset(bitmap, 0, BATCH_BITMAP_WORDS(list->count) * sizeof(*bitmap));
+    for (size_t i = 0; i < list->count; i++) {
+        size_t offset;
+        tld_reason_t reason = vcache_check(s_cache, list->items[i].p, list->items[i].len, &offset);
+        rejects[i].reason = (uint16_t)reason;
+        rejects[i].offset = (uint16_t)offset;
+        if (reason == TLD_OK) {
+            bitmap[i / 64] |= (uint64_t)1 << (i % 64);
+            valid++;
+        }
+    }
+    return valid;
+}
+
+// Returns 1 if the ASCII check may have rejected d only for being in
+// U-label form: at a non-ASCII byte, or for a length that a domain with
+// non-ASCII bytes may lose in A-label form.
+static int may_be_idn(const domain_slice_t *d, const batch_reject_t *reject) {
+    if (reject->reason == TLD_ERR_INVALID_CHAR) {
+        return reject->offset < d->len && (unsigned char)d->p[reject->offset] >= 0x80;
+    }
+    if (reject->reason == TLD_ERR_TOO_LONG) {
+        for (size_t i = 0; i < d->len; i++) {
+            if ((unsigned char)d->p[i] >= 0x80) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Re-checks in A-label form the domains that were rejected at a non-ASCII
+// byte or, containing one, for their length (see may_be_idn()), updating
+// bitmap and rejects. Every domain that
+// was converted is added to idn, whether it turned out valid or not, as the
+// offsets of its rejects entry refer to the A-label.
+// Returns the number of domains that became valid, or -1 if memory is exhausted.
+static long recheck_idn(const slice_list_t *list, uint64_t *bitmap, batch_reject_t *rejects, idn_list_t *idn) {
+    long now_valid = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (!may_be_idn(&list->items[i], &rejects[i])) {
+            continue;
+        }
+        char buf[TLD_ASCII_BUF_SIZE];
+        const char *ascii;
+        size_t ascii_len, offset;
+        tld_reason_t reason = tld_check_domain_idna(list->items[i].p, list->items[i].len, buf, &ascii, &ascii_len, &offset);
+        rejects[i].reason = (uint16_t)reason;
+        rejects[i].offset = (uint16_t)offset;
+        if (reason == TLD_OK) {
+            bitmap[i / 64] |= (uint64_t)1 << (i % 64);
+            now_valid++;
+        }
+        if (ascii != buf) {
+            continue; // Not converted
+        }
+        if (idn->count == idn->cap) {
+            size_t new_cap = idn->cap ? idn->cap * 2 : 16;
+            idn_entry_t *items = request_realloc(idn->items, new_cap * sizeof(*items));
+            if (items == NULL) {
+                return -1;
+            }
+            idn->items = items;
+            idn->cap = new_cap;
+        }
+        char *copy = request_alloc(ascii_len);
+        if (copy == NULL) {
+            return -1;
+        }
+        memcpy(copy, ascii, ascii_len);
+        idn->items[idn->count].index = i;
+        idn->items[idn->count].ascii = copy;
+        idn->items[idn->count].len = ascii_len;
+        idn->count++;
+    }
+    return now_valid;
+}
+
+// Appends the decimal digits of n at buf + len. Returns the new length.
+static size_t put_size(char *buf, size_t len, size_t n) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    while (count > 0) {
+        buf[len++] = digits[--count];
+    }
+    return len;
+}
+
+// Appends a literal string at buf + len. Returns the new length.
+static size_t put_str(char *buf, size_t len, const char *s) {
+    size_t n = strlen(s);
+    memcpy(buf + len, s, n);
+    return len + n;
+}
+
+// Renders {"total":N,"valid":K,"invalid":M,"results":[true,false,...],
+// "rejects":[{"index":I,"reason":"..","offset":O},...]}, with one rejects
+// entry per invalid domain, and counts the rejects by reason into by_reason
+// (TLD_REASON_COUNT entries, zeroed). When idn is not NULL,
+// "ascii":[{"index":I,"domain":".."},...] lists the converted domains.
+// Returns a string from the request arena, or NULL if memory is exhausted.
+static char *render_results(const uint64_t *bitmap, const batch_reject_t *rejects, size_t count, size_t valid,
+                            const idn_list_t *idn, size_t *by_reason) {
+    // Every verdict takes at most 6 bytes ("false,").
+    size_t size = BULK_PREFIX_MAX + 6 * count + BULK_REJECT_MAX * (count - valid) + 32;
+    for (size_t i = 0; idn != NULL && i < idn->count; i++) {
+        size += BULK_IDN_ENTRY_MAX + idn->items[i].len;
+    }
+    char *buf = request_alloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+    size_t len = (size_t)snprintf(buf, BULK_PREFIX_MAX, "{\"total\":%zu,\"valid\":%zu,\"invalid\":%zu,\"results\":[",
+                                  count, valid, count - valid);
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            buf[len++] = ',';
+        }
+        if (BATCH_BITMAP_TEST(bitmap, i)) {
+            memcpy(buf + len, "true", 4);
+            len += 4;
+        } else {
+            memcpy(buf + len, "false", 5);
+            len += 5;
+        }
+    }
+
+    len = put_str(buf, len, "],\"rejects\":[");
+    for (size_t i = 0; i < count; i++) {
+        if (BATCH_BITMAP_TEST(bitmap, i)) {
+            continue;
+        }
+        tld_reason_t reason = (tld_reason_t)rejects[i].reason;
+        by_reason[reason]++;
+        if (buf[len - 1] == '}') {
+            buf[len++] = ',';
+        }
+        len = put_str(buf, len, "{\"index\":");
+        len = put_size(buf, len, i);
+        len = put_str(buf, len, ",\"reason\":\"");
+        len = put_str(buf, len, tld_reason_name(reason));
+        len = put_str(buf, len, "\",\"offset\":");
+        len = put_size(buf, len, rejects[i].offset);
+        buf[len++] = '}';
+    }
+    buf[len++] = ']';
+
+    if (idn != NULL) {
+        // A-labels only hold letters, digits, '-' and '.', so need no escaping.
+        len = put_str(buf, len, ",\"ascii\":[");
+        for (size_t i = 0; i < idn->count; i++) {
+            if (i > 0) {
+                buf[len++] = ',';
+            }
+            len = put_str(buf, len, "{\"index\":");
+            len = put_size(buf, len, idn->items[i].index);
+            len = put_str(buf, len, ",\"domain\":\"");
+            memcpy(buf + len, idn->items[i].ascii, idn->items[i].len);
+            len += idn->items[i].len;
+            len = put_str(buf, len, "\"}");
+        }
+        buf[len++] = ']';
+    }
+    memcpy(buf + len, "}", 2); // Includes the terminating NUL
+    return buf;
+}
+
+// Outcome of a bulk request.
+typedef enum {
+    BULK_OK,
+    BULK_EMPTY,          // No domains in the body
+    BULK_INVALID,        // Malformed body
+    BULK_NO_LIST_MEMORY, // Out of memory while parsing
+    BULK_NO_MEMORY       // Out of memory while validating or rendering
+} bulk_status_t;
+
+typedef struct {
+    bulk_status_t status;
+    char *json; // Response body (BULK_OK), from request_alloc()
+    size_t count;
+    size_t valid;
+    size_t by_reason[TLD_REASON_COUNT];
+} bulk_result_t;
+
+// Parses, validates and renders a bulk request body into *out. Uses only
+// request_alloc(), and nothing that is tied to the event loop thread, so it
+// can run on any thread. Everything except out->json is released again.
+static void run_bulk(const char *body, size_t body_len, int idn_mode, bulk_result_t *out) {
+    memset(out, 0, sizeof(*out));
+    const char *p = body;
+    const char *end = body + body_len;
+
+    while (p < end && is_space(*p)) p++;
+    if (p == end) {
+        out->status = BULK_EMPTY;
+        return;
+    }
+
+    slice_list_t list = {0};
+    list.cap = body_len / BULK_BYTES_PER_DOMAIN_GUESS + 1;
+    list.items = request_alloc(list.cap * sizeof(*list.items));
+    if (list.items == NULL) {
+        out->status = BULK_NO_LIST_MEMORY;
+        return;
+    }
+
+    char *decoded = NULL;
+    int rc = (*p == '[') ? parse_json_array(p, end, &list, &decoded) : parse_lines(p, end, &list);
+    if (rc == PARSE_INVALID) {
+        request_free(decoded);
+        request_free(list.items);
+        out->status = BULK_INVALID;
+        return;
+    }
+
+    uint64_t *bitmap = NULL;
+    batch_reject_t *rejects = NULL;
+    if (rc == PARSE_OK) {
+        // One spare entry so an empty batch still gets non-NULL buffers.
+        bitmap = request_alloc(BATCH_BITMAP_WORDS(list.count) * sizeof(*bitmap) + sizeof(*bitmap));
+        rejects = request_alloc((list.count + 1) * sizeof(*rejects));
+    }
+    idn_list_t idn = {0};
+    if (bitmap != NULL && rejects != NULL) {
+        // Offloaded bodies run on task queue threads, which have no cache.
+        size_t valid = s_cache != NULL && list.count <= BULK_CACHE_MAX_DOMAINS
+                           ? validate_cached(&list, bitmap, rejects)
+                           : validate_domains_parallel(s_pool, list.items, list.count, bitmap, rejects);
+        // Only domains with non-ASCII bytes are converted, so ASCII batches
+        // (rejects included) cost the same in both modes.
+        long idn_valid = idn_mode ? recheck_idn(&list, bitmap, rejects, &idn) : 0;
+        if (idn_valid >= 0) {
+            valid += (size_t)idn_valid;
+            out->count = list.count;
+            out->valid = valid;
+            out->json = render_results(bitmap, rejects, list.count, valid, idn_mode ? &idn : NULL, out->by_reason);
+        }
+    }
+    out->status = out->json != NULL ? BULK_OK : BULK_NO_MEMORY;
+
+    for (size_t i = idn.count; i > 0; i--) {
+        request_free((void *)idn.items[i - 1].ascii);
+    }
+    request_free(idn.items);
+    request_free(rejects);
+    request_free(bitmap);
+    request_free(decoded);
+    request_free(list.items);
+}
+
+// Sends the response for a bulk result and counts its domains (on the event
+// loop thread, whose metrics they go to).
+static void send_bulk_result(struct mg_connection *c, const bulk_result_t *result) {
+    switch (result->status) {
+    case BULK_OK:
+        metrics_count_domains(result->count, result->valid);
+        for (int r = TLD_OK + 1; r < TLD_REASON_COUNT; r++) {
+            if (result->by_reason[r] != 0) {
+                metrics_count_rejects((tld_reason_t)r, result->by_reason[r]);
+            }
+        }
+        send_json_response(c, 200, result->json);
+        break;
+    case BULK_EMPTY:
+        send_static_response(c, RESP_EMPTY_DOMAIN_LIST);
+        break;
+    case BULK_INVALID:
+        send_static_response(c, RESP_INVALID_DOMAIN_LIST);
+        break;
+    case BULK_NO_LIST_MEMORY:
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the domain list.");
+        break;
+    case BULK_NO_MEMORY:
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for validation results.");
+        break;
+    }
+}
+
+// A bulk request handed to the task queue.
+typedef struct {
+    evloop_t *loop;       // Loop that owns the connection
+    evloop_work_t *done;  // Posts the job back; allocated up front so that cannot fail
+    unsigned long conn_id;
+    int idn_mode;
+    bulk_result_t result; // Filled in on the task queue thread
+    size_t body_len;
+    char body[];          // Copy of the request body
+} bulk_job_t;
+
+// Runs on the loop thread once the job is done: writes the deferred response,
+// unless the client has gone meanwhile.
+static void finish_bulk_job(void *arg) {
+    bulk_job_t *job = arg;
+    struct mg_connection *c = conn_find(job->loop->mgr, job->conn_id);
+    conn_t *conn = c != NULL ? conn_get(c) : NULL;
+    if (conn != NULL && conn->deferred) {
+        conn_resume_response(c);
+        send_bulk_result(c, &job->result);
+        router_record_deferred(c);
+        conn_end_request(c);
+    }
+    evloop_release(job->loop);
+    free(job->result.json); // No arena on task queue threads: request_alloc() used malloc
+    free(job);
+}
+
+// Runs on a task queue thread.
+static void run_bulk_job(void *arg) {
+    bulk_job_t *job = arg;
+    run_bulk(job->body, job->body_len, job->idn_mode, &job->result);
+    job->done->fn = finish_bulk_job;
+    job->done->arg = job;
+    evloop_post_work(job->loop, job->done); // Nothing may touch the job after this
+}
+
+// Hands the request to the task queue and defers its response.
+// Returns 0 on success, or -1 if it has to be handled inline.
+static int offload_bulk(struct mg_connection *c, struct mg_http_message *hm, int idn_mode) {
+    evloop_t *loop = evloop_current();
+    if (loop == NULL) {
+        return -1;
+    }
+    bulk_job_t *job = malloc(sizeof(*job) + hm->body.len);
+    evloop_work_t *done = malloc(sizeof(*done));
+    if (job == NULL || done == NULL || conn_defer_response(c, hm) != 0) {
+        free(done);
+        free(job);
+        return -1;
+    }
+    job->loop = loop;
+    job->done = done;
+    job->conn_id = c->id;
+    job->idn_mode = idn_mode;
+    job->body_len = hm->body.len;
+    memcpy(job->body, hm->body.p, hm->body.len);
+    evloop_hold(loop);
+    if (task_queue_submit(s_offload, run_bulk_job, job) != 0) {
+        evloop_release(loop);
+        conn_cancel_deferral(c);
+        free(done);
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+void domain_handlers_set_pool(worker_pool_t *pool) {
+    s_pool = pool;
+}
+
+void domain_handlers_set_offload(task_queue_t *queue) {
+    s_offload = queue;
+}
+
+void domain_handlers_set_cache(vcache_t *cache) {
+    s_cache = cache;
+    if (cache == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s_caches_lock);
+    if (s_num_caches < MAX_CACHES) {
+        s_all_caches[s_num_caches++] = cache;
+    }
+    pthread_mutex_unlock(&s_caches_lock);
+}
+
+void domain_handlers_get_cache_stats(vcache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&s_caches_lock);
+    for (size_t i = 0; i < s_num_caches; i++) {
+        vcache_stats_t one;
+        vcache_get_stats(s_all_caches[i], &one);
+        stats->hits += one.hits;
+        stats->misses += one.misses;
+        stats->bypasses += one.bypasses;
+        stats->evictions += one.evictions;
+        stats->capacity += one.capacity;
+        stats->bytes += one.bytes;
+    }
+    pthread_mutex_unlock(&s_caches_lock);
+}
+
+// Validates a domain held in a Mongoose string slice.
+int is_valid_domain_mg(struct mg_str domain) {
+    return is_valid_domain_simd(domain.p, domain.len);
+}
+
+// Handles POST requests to "/api/v1/domains/validate".
+// Responds with {"total":N,"valid":K,"invalid":M,"results":[true,false,...],
+// "rejects":[...]}, where results[i] is the verdict for the i-th domain of the
+// request and rejects lists why each invalid one failed (see libtld.h for the
+// reasons and their offsets). JSON escapes are decoded before validation, so
+// "b\u00fccher.de" is checked as "bücher.de"; a malformed escape is a 400.
+// With ?idn=1, domains with UTF-8 labels are accepted too (see
+// tld_check_domain_idna()), and "ascii" lists the A-label form of each of
+// them; their offsets refer to that form unless the reason is "invalid_idn"
+// or a hyphen rule, which point into the domain as sent.
+void handle_validate_domains(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) params; // Unused
+    struct mg_str idn_str = mg_http_var(hm->query, mg_str("idn"));
+    int idn_mode = idn_str.len == 1 && idn_str.p[0] == '1';
+
+    if (hm->body.len >= BULK_OFFLOAD_MIN_BYTES && s_offload != NULL && offload_bulk(c, hm, idn_mode) == 0) {
+        return; // Answered once the task queue is done with it
+    }
+    bulk_result_t result;
+    run_bulk(hm->body.p, hm->body.len, idn_mode, &result);
+    send_bulk_result(c, &result);
+    request_free(result.json);
+}
+
+// Handles GET requests to "/api/v1/domains/{domain}".
+// Responds with {"domain":..,"valid":..,"public_suffix":..,"registrable_domain":..};
+// the last two are null when the domain is invalid or is itself a public suffix.
+void handle_get_domain(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) hm; // The domain comes from the path parameter
+    struct mg_str domain_str = router_get_param(params, "domain");
+    const char *domain = domain_str.p;
+    size_t len = domain_str.len;
+    if (len == 0) {
+        send_static_response(c, RESP_MISSING_DOMAIN);
+        return;
+    }
+    if (len > TLD_MAX_DOMAIN_LEN) {
+        send_static_response(c, RESP_DOMAIN_TOO_LONG);
+        return;
+    }
+
+    domain_info_t info;
+    vcache_lookup(s_cache, domain, len, &info);
+    metrics_count_domains(1, info.valid ? 1 : 0);
+
+    // cJSON needs null-terminated strings; the domain is at most 253 bytes.
+    char domain_buf[TLD_MAX_DOMAIN_LEN + 1];
+    memcpy(domain_buf, domain, len);
+    domain_buf[len] = '\0';
+
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for domain JSON object.");
+        return;
+    }
+    cJSON_AddStringToObject(obj, "domain", domain_buf);
+    cJSON_AddBoolToObject(obj, "valid", info.valid);
+    if (info.valid) {
+        cJSON_AddStringToObject(obj, "public_suffix", domain_buf + len - info.suffix_len);
+    } else {
+        cJSON_AddNullToObject(obj, "public_suffix");
+    }
+    if (info.has_registrable) {
+        cJSON_AddStringToObject(obj, "registrable_domain", domain_buf + info.registrable_offset);
+    } else {
+        cJSON_AddNullToObject(obj, "registrable_domain");
+    }
+
+    char *json_str = cJSON_PrintUnformatted(obj);
+    if (json_str) {
+        send_json_response(c, 200, json_str);
+        cJSON_free(json_str);
+    } else {
+        send_error_response(c, 500, "Internal Server Error", "Failed to stringify domain JSON.");
+    }
+    cJSON_Delete(obj);
+}
+
+// Handles GET requests to "/api/v1/stats/cache".
+void handle_get_cache_stats(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) hm; // Unused
+    (void) params; // Unused
+
+    // Sum the counters of every event loop's cache.
+    vcache_stats_t stats;
+    domain_handlers_get_cache_stats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+
+    char json_str[256];
+    snprintf(json_str, sizeof(json_str),
+             "{\"hits\":%llu,\"misses\":%llu,\"bypasses\":%llu,\"evictions\":%llu,"
+             "\"hit_rate\":%.4f,\"capacity\":%zu,\"bytes\":%zu}",
+             (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+             (unsigned long long)stats.bypasses, (unsigned long long)stats.evictions,
+             lookups ? (double)stats.hits / (double)lookups : 0.0, stats.capacity, stats.bytes);
+    send_json_response(c, 200, json_str);
+}
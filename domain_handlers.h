@@ -0,0 +1,46 @@
+// domain_handlers.h
+// Header for the domain validation API handlers.
+// Declares the functions that expose libtld over HTTP.
+
+#ifndef DOMAIN_HANDLERS_H
+#define DOMAIN_HANDLERS_H
+
+#include "mongoose.h" // Required for struct mg_connection and mg_http_message
+#include "router.h"   // For route_params_t
+#include "batch.h"    // For worker_pool_t, task_queue_t
+#include "vcache.h"   // For vcache_t
+
+// Sets the worker pool used to validate large batches (NULL: validate inline).
+// The pool must outlive every request that may use it.
+void domain_handlers_set_pool(worker_pool_t *pool);
+
+// Sets the task queue that large batches are handed to, so they do not hold
+// up their event loop (NULL: validate inline). The queue must outlive every
+// event loop.
+void domain_handlers_set_offload(task_queue_t *queue);
+
+// Sets the verdict cache used by single-domain lookups on the calling thread
+// (NULL: no caching) and includes it in the cache stats. Each event loop
+// thread calls this once with its own cache.
+void domain_handlers_set_cache(vcache_t *cache);
+
+// Sums the counters of every registered verdict cache. Callable from any thread.
+void domain_handlers_get_cache_stats(vcache_stats_t *stats);
+
+// Validates a domain held in a Mongoose string slice (e.g., a header value,
+// query parameter or part of the body) without copying it.
+// Returns 1 if valid, 0 if invalid.
+int is_valid_domain_mg(struct mg_str domain);
+
+// Handles POST requests to "/api/v1/domains/validate" (to validate a batch of domains).
+// The body is either a JSON array of strings or a newline-delimited list of domains.
+void handle_validate_domains(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+// Handles GET requests to "/api/v1/domains/{domain}" (to validate one domain and
+// return its public suffix and registrable domain).
+void handle_get_domain(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+// Handles GET requests to "/api/v1/stats/cache" (to report verdict cache counters).
+void handle_get_cache_stats(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+#endif // DOMAIN_HANDLERS_H
@@ -0,0 +1,229 @@
+// domain_validate.c
+// Command-line validator for huge newline-delimited domain lists.
+// Usage: domain_validate [-b] [-c] [-j threads] file...
+//
+// Each file is mmapped read-only and processed in blocks of lines: the lines
+// of a block are collected as slices of the mapping, validated in one batch
+// on the worker pool (see batch.c), and the consumed pages are then released.
+// Heap use is bounded by the block size no matter how big the input is.
+//
+// By default the invalid lines are written to stdout. With -b the raw verdict
+// bitmap is written instead: one bit per line (bit i of little-endian 64-bit
+// word i / 64 is set if line i is valid), padded to a whole word per file.
+
+#define _DEFAULT_SOURCE // For madvise
+
+#include "batch.h"     // For domain_slice_t, validate_domains_parallel, worker pool
+#include <errno.h>     // For errno
+#include <fcntl.h>     // For open
+#include <stdio.h>     // For fprintf
+#include <stdlib.h>    // For malloc, free, strtol
+#include <string.h>    // For memchr, memcpy, strcmp, strerror
+#include <sys/mman.h>  // For mmap, madvise, munmap
+#include <sys/stat.h>  // For fstat
+#include <unistd.h>    // For write, close, getopt, sysconf
+
+// Lines per block. A multiple of 64 so the bitmaps of blocks concatenate.
+#define BLOCK_LINES (1u << 20)
+
+// Size of the stdout buffer.
+#define OUT_BUF_SIZE (1u << 20)
+
+typedef struct {
+    int bitmap_mode;     // -b: write the verdict bitmap instead of invalid lines
+    int print_counts;    // -c: print per-file totals to stderr
+    worker_pool_t *pool;
+    domain_slice_t *slices;
+    uint64_t *bitmap;
+    char *out;
+    size_t out_len;
+} validator_t;
+
+// Writes all of buf to stdout. Returns 0 on success, -1 on error.
+static int write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int flush_out(validator_t *v) {
+    int rc = write_all(v->out, v->out_len);
+    v->out_len = 0;
+    return rc;
+}
+
+// Appends bytes to the stdout buffer, flushing it when full.
+static int emit(validator_t *v, const char *p, size_t len) {
+    if (v->out_len + len > OUT_BUF_SIZE) {
+        if (flush_out(v) != 0) {
+            return -1;
+        }
+        if (len > OUT_BUF_SIZE) {
+            return write_all(p, len);
+        }
+    }
+    memcpy(v->out + v->out_len, p, len);
+    v->out_len += len;
+    return 0;
+}
+
+// Validates the collected lines of one block and writes its output.
+static int finish_block(validator_t *v, size_t count, size_t *valid_total) {
+    *valid_total += validate_domains_parallel(v->pool, v->slices, count, v->bitmap, NULL);
+    if (v->bitmap_mode) {
+        return emit(v, (const char *)v->bitmap, BATCH_BITMAP_WORDS(count) * sizeof(uint64_t));
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!BATCH_BITMAP_TEST(v->bitmap, i) && v->slices[i].len > 0) {
+            if (emit(v, v->slices[i].p, v->slices[i].len) != 0 || emit(v, "\n", 1) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Validates one file. Returns 0 on success, -1 on error (already reported).
+static int validate_file(validator_t *v, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "domain_validate: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "domain_validate: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "domain_validate: %s: mmap: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t released = 0; // Bytes of the mapping already handed back to the kernel
+    size_t lines = 0, valid = 0, count = 0;
+    const char *p = data, *end = data + size;
+    int rc = 0;
+
+    while (p < end && rc == 0) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        const char *next = eol ? eol + 1 : end;
+        if (eol == NULL) {
+            eol = end;
+        }
+        if (eol > p && *(eol - 1) == '\r') {
+            eol--; // Accept CRLF line endings
+        }
+        v->slices[count].p = p;
+        v->slices[count].len = (size_t)(eol - p);
+        count++;
+        p = next;
+
+        if (count == BLOCK_LINES || p == end) {
+            rc = finish_block(v, count, &valid);
+            lines += count;
+            count = 0;
+            // Output is written, so the pages before p are no longer referenced.
+            size_t done = (size_t)(p - data) / page * page;
+            if (done > released) {
+                madvise((void *)(data + released), done - released, MADV_DONTNEED);
+                released = done;
+            }
+        }
+    }
+    if (rc != 0) {
+        fprintf(stderr, "domain_validate: write error: %s\n", strerror(errno));
+    } else if (v->print_counts) {
+        fprintf(stderr, "%s: %zu lines, %zu valid, %zu invalid\n", path, lines, valid, lines - valid);
+    }
+    munmap((void *)data, size);
+    return rc;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: domain_validate [-b] [-c] [-j threads] file...\n"
+            "  -b          write the verdict bitmap (1 bit per line) instead of invalid lines\n"
+            "  -c          print per-file line counts to stderr\n"
+            "  -j threads  number of validation threads (default: one per CPU)\n");
+}
+
+int main(int argc, char **argv) {
+    validator_t v = {0};
+    long threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "bcj:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            v.bitmap_mode = 1;
+            break;
+        case 'c':
+            v.print_counts = 1;
+            break;
+        case 'j': {
+            char *endptr;
+            threads = strtol(optarg, &endptr, 10);
+            if (*optarg == '\0' || *endptr != '\0' || threads < 1) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        default:
+            usage();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind == argc) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // The calling thread also validates, so -j N means N - 1 pool threads.
+    if (threads != 1) {
+        v.pool = worker_pool_create(threads > 1 ? (size_t)threads - 1 : 0);
+    }
+    v.slices = malloc(BLOCK_LINES * sizeof(*v.slices));
+    v.bitmap = malloc(BATCH_BITMAP_WORDS(BLOCK_LINES) * sizeof(*v.bitmap));
+    v.out = malloc(OUT_BUF_SIZE);
+    if (v.slices == NULL || v.bitmap == NULL || v.out == NULL) {
+        fprintf(stderr, "domain_validate: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        if (validate_file(&v, argv[i]) != 0) {
+            status = EXIT_FAILURE;
+        }
+    }
+    if (flush_out(&v) != 0) {
+        fprintf(stderr, "domain_validate: write error: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+
+    worker_pool_destroy(v.pool);
+    free(v.slices);
+    free(v.bitmap);
+    free(v.out);
+    return status;
+}
@@ -0,0 +1,264 @@
+// evloop.c
+// Implements event loop scheduling.
+//
+// The wakeup is a self-pipe made of a pair of loopback UDP sockets: Mongoose
+// can only watch sockets, so the receiving end is a Mongoose UDP connection,
+// and a one-byte datagram sent to it makes mg_mgr_poll() return. Sending is
+// a single non-blocking send(), which is async-signal-safe; a full socket
+// buffer means a wakeup is already pending, so failures are ignored.
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "evloop.h"     // Header for event loop declarations
+#include "mongoose.h"   // Mongoose types and functions
+#include "log.h"        // For log_message
+#include <fcntl.h>      // For fcntl
+#include <netinet/in.h> // For struct sockaddr_in
+#include <stdatomic.h>  // For the wakeup registry
+#include <stdlib.h>     // For malloc, free
+#include <sys/socket.h> // For socket, connect, send, getsockname
+#include <time.h>       // For clock_gettime
+#include <unistd.h>     // For close
+
+// Loops that evloop_wake_all() reaches.
+#define EVLOOP_REGISTRY_SIZE 256
+
+// Sending ends of the initialized loops' wakeups, plus one (0: free slot).
+// Lock-free atomics, so a signal handler can read them. A registered fd
+// stays open after its loop is freed, until evloop_close_wakeups(): a signal
+// handler may have loaded it just before, and must not send on the number
+// once it is reused, e.g. by an accepted client socket.
+static atomic_int s_registry[EVLOOP_REGISTRY_SIZE];
+
+static _Thread_local unsigned long s_activity; // See evloop_note_activity()
+static _Thread_local evloop_t *s_current;
+
+evloop_t *evloop_current(void) {
+    return s_current;
+}
+
+uint64_t evloop_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+void evloop_note_activity(void) {
+    s_activity++;
+}
+
+static void run_posted_work(evloop_t *loop);
+
+// Handler of the wakeup's receiving end. The datagrams only end the poll;
+// their contents are dropped.
+static void wake_handler(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
+    (void) ev_data;
+    if (ev == MG_EV_READ) {
+        c->recv.len = 0;
+    } else if (ev == MG_EV_CLOSE) {
+        evloop_t *loop = (evloop_t *) fn_data;
+        loop->wake_conn = NULL;
+    }
+}
+
+// Creates the wakeup socket pair. Returns 0 on success, or -1.
+static int open_wakeup(evloop_t *loop) {
+    loop->wake_conn = mg_listen(loop->mgr, "udp://127.0.0.1:0", wake_handler, loop);
+    if (loop->wake_conn == NULL) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (getsockname((int) (size_t) loop->wake_conn->fd, (struct sockaddr *) &addr, &addr_len) != 0 ||
+        connect(fd, (struct sockaddr *) &addr, addr_len) != 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    loop->wake_fd = fd;
+    return 0;
+}
+
+int evloop_init(evloop_t *loop, struct mg_mgr *mgr, unsigned busy_poll_us) {
+    loop->mgr = mgr;
+    loop->wake_conn = NULL;
+    loop->wake_fd = -1;
+    loop->registry_slot = -1;
+    loop->num_timers = 0;
+    loop->busy_poll_us = busy_poll_us;
+    loop->last_activity_us = evloop_now_us();
+    loop->seen_activity = s_activity;
+    loop->work = NULL;
+    loop->work_tail = &loop->work;
+    loop->holds = 0;
+    pthread_mutex_init(&loop->work_lock, NULL);
+    pthread_cond_init(&loop->work_cv, NULL);
+    s_current = loop;
+    if (open_wakeup(loop) != 0) {
+        log_message(LOG_ERROR, "msg=\"cannot create the event loop wakeup\"");
+        evloop_free(loop);
+        return -1;
+    }
+    for (int i = 0; i < EVLOOP_REGISTRY_SIZE; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&s_registry[i], &expected, loop->wake_fd + 1)) {
+            loop->registry_slot = i;
+            break;
+        }
+    }
+    return 0;
+}
+
+void evloop_free(evloop_t *loop) {
+    // Under the lock, as evloop_post_work() uses the fd from other threads.
+    // A registered fd is left open for evloop_close_wakeups(); sends to it
+    // are harmless once the receiving end is gone.
+    pthread_mutex_lock(&loop->work_lock);
+    if (loop->wake_fd >= 0 && loop->registry_slot < 0) {
+        close(loop->wake_fd);
+    }
+    loop->wake_fd = -1;
+    loop->registry_slot = -1;
+    pthread_mutex_unlock(&loop->work_lock);
+    if (loop->wake_conn != NULL) {
+        loop->wake_conn->fn_data = NULL; // The loop is gone by the time it closes
+        loop->wake_conn->fn = NULL;
+        loop->wake_conn->is_closing = 1;
+        loop->wake_conn = NULL;
+    }
+    // Posted work owns resources, such as its arg; held work still has to
+    // arrive before the loop may go.
+    run_posted_work(loop);
+    while (loop->holds > 0) {
+        pthread_mutex_lock(&loop->work_lock);
+        while (loop->work == NULL) {
+            pthread_cond_wait(&loop->work_cv, &loop->work_lock);
+        }
+        pthread_mutex_unlock(&loop->work_lock);
+        run_posted_work(loop);
+    }
+    pthread_cond_destroy(&loop->work_cv);
+    pthread_mutex_destroy(&loop->work_lock);
+    if (s_current == loop) {
+        s_current = NULL;
+    }
+}
+
+void evloop_close_wakeups(void) {
+    for (int i = 0; i < EVLOOP_REGISTRY_SIZE; i++) {
+        int fd = atomic_exchange(&s_registry[i], 0) - 1;
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+int evloop_add_timer(evloop_t *loop, unsigned period_ms, evloop_fn fn, void *arg) {
+    if (loop->num_timers == EVLOOP_MAX_TIMERS) {
+        return -1;
+    }
+    evloop_timer_t *t = &loop->timers[loop->num_timers++];
+    t->fn = fn;
+    t->arg = arg;
+    t->period_us = (uint64_t) (period_ms ? period_ms : 1) * 1000u;
+    t->due_us = evloop_now_us() + t->period_us;
+    return 0;
+}
+
+void evloop_wake(const evloop_t *loop) {
+    if (loop->wake_fd >= 0) {
+        (void) send(loop->wake_fd, "", 1, MSG_DONTWAIT);
+    }
+}
+
+void evloop_wake_all(void) {
+    for (int i = 0; i < EVLOOP_REGISTRY_SIZE; i++) {
+        int fd = atomic_load(&s_registry[i]) - 1;
+        if (fd >= 0) {
+            (void) send(fd, "", 1, MSG_DONTWAIT);
+        }
+    }
+}
+
+int evloop_post(evloop_t *loop, evloop_fn fn, void *arg) {
+    evloop_work_t *w = malloc(sizeof(*w));
+    if (w == NULL) {
+        return -1;
+    }
+    w->fn = fn;
+    w->arg = arg;
+    evloop_post_work(loop, w);
+    return 0;
+}
+
+void evloop_post_work(evloop_t *loop, evloop_work_t *work) {
+    work->next = NULL;
+    pthread_mutex_lock(&loop->work_lock);
+    *loop->work_tail = work;
+    loop->work_tail = &work->next;
+    pthread_cond_signal(&loop->work_cv);
+    evloop_wake(loop); // The loop may be gone once the lock is released
+    pthread_mutex_unlock(&loop->work_lock);
+}
+
+void evloop_hold(evloop_t *loop) {
+    loop->holds++;
+}
+
+void evloop_release(evloop_t *loop) {
+    loop->holds--;
+}
+
+// Runs the work posted so far, in the order it was posted.
+static void run_posted_work(evloop_t *loop) {
+    pthread_mutex_lock(&loop->work_lock);
+    evloop_work_t *w = loop->work;
+    loop->work = NULL;
+    loop->work_tail = &loop->work;
+    pthread_mutex_unlock(&loop->work_lock);
+    while (w != NULL) {
+        evloop_work_t *next = w->next;
+        w->fn(w->arg);
+        free(w);
+        w = next;
+    }
+}
+
+// Runs the due timers and returns how long the loop may sleep, in ms.
+static int run_timers(evloop_t *loop, uint64_t now) {
+    uint64_t wait_us = (uint64_t) EVLOOP_MAX_WAIT_MS * 1000u;
+    for (int i = 0; i < loop->num_timers; i++) {
+        evloop_timer_t *t = &loop->timers[i];
+        if (t->due_us <= now) {
+            t->fn(t->arg);
+            // Skip runs that were missed rather than running them back to back.
+            t->due_us += t->period_us;
+            if (t->due_us <= now) {
+                t->due_us = now + t->period_us;
+            }
+        }
+        if (t->due_us - now < wait_us) {
+            wait_us = t->due_us - now;
+        }
+    }
+    return (int) ((wait_us + 999) / 1000);
+}
+
+void evloop_poll(evloop_t *loop) {
+    uint64_t now = evloop_now_us();
+    run_posted_work(loop);
+    int timeout_ms = run_timers(loop, now);
+
+    if (s_activity != loop->seen_activity) {
+        loop->seen_activity = s_activity;
+        loop->last_activity_us = now;
+    }
+    if (loop->busy_poll_us != 0 && now - loop->last_activity_us < loop->busy_poll_us) {
+        timeout_ms = 0; // Spin: more requests are likely to follow shortly
+    }
+    mg_mgr_poll(loop->mgr, timeout_ms);
+}
@@ -0,0 +1,122 @@
+// evloop.h
+// Scheduling around one Mongoose event manager: periodic timers, a wakeup
+// that any thread (or a signal handler) can trigger, work posted from other
+// threads, and polling whose timeout follows from the next timer instead of
+// being fixed.
+//
+// Usage, on the thread that owns mgr:
+//   evloop_t loop;
+//   evloop_init(&loop, &mgr, busy_poll_us);
+//   evloop_add_timer(&loop, 250, sweep, &mgr);
+//   while (running) evloop_poll(&loop);
+//   evloop_free(&loop);
+//
+// evloop_poll() sleeps in mg_mgr_poll() until the next timer is due (at most
+// EVLOOP_MAX_WAIT_MS), unless woken earlier by network activity or by
+// evloop_wake(). With a busy-poll budget it keeps polling without sleeping
+// for that long after the last network activity, trading a core for lower
+// latency on bursts.
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include "mongoose.h" // For struct mg_mgr
+#include <pthread.h>  // For the posted work lock
+#include <stdint.h>   // For uint64_t
+
+// Longest sleep of one iteration, also when no timer is due sooner.
+#define EVLOOP_MAX_WAIT_MS 1000
+
+// Most timers per loop.
+#define EVLOOP_MAX_TIMERS 8
+
+typedef void (*evloop_fn)(void *arg);
+
+typedef struct {
+    evloop_fn fn;
+    void *arg;
+    uint64_t period_us;
+    uint64_t due_us; // Next run, on the evloop_now_us() clock
+} evloop_timer_t;
+
+// Work posted by another thread.
+typedef struct evloop_work {
+    evloop_fn fn;
+    void *arg;
+    struct evloop_work *next;
+} evloop_work_t;
+
+typedef struct {
+    struct mg_mgr *mgr;
+    struct mg_connection *wake_conn; // Receiving end of the wakeup socket pair
+    int wake_fd;                     // Sending end, or -1
+    int registry_slot;               // Entry in the list woken by evloop_wake_all()
+    evloop_timer_t timers[EVLOOP_MAX_TIMERS];
+    int num_timers;
+    uint64_t busy_poll_us;           // 0: always sleep when idle
+    uint64_t last_activity_us;       // Last iteration that saw network activity
+    unsigned long seen_activity;     // Value of the activity count at that point
+    pthread_mutex_t work_lock;       // Protects work and work_tail
+    pthread_cond_t work_cv;          // Signaled when work is posted
+    evloop_work_t *work;
+    evloop_work_t **work_tail;
+    unsigned holds;                  // Work elsewhere that will post back (see evloop_hold)
+} evloop_t;
+
+// Sets up the loop around mgr, including its wakeup socket pair, and makes
+// it the calling thread's current loop.
+// Returns 0 on success, or -1 if the wakeup cannot be created.
+int evloop_init(evloop_t *loop, struct mg_mgr *mgr, unsigned busy_poll_us);
+
+// Tears the loop down, running work that is still queued, and first waiting
+// for the work of every evloop_hold() to be posted back. Call before
+// mg_mgr_free(), once the loop's connections no longer need the loop.
+void evloop_free(evloop_t *loop);
+
+// Runs fn(arg) on the loop thread every period_ms milliseconds, first after
+// one period. Returns 0 on success, or -1 if the loop has no free timer slot.
+int evloop_add_timer(evloop_t *loop, unsigned period_ms, evloop_fn fn, void *arg);
+
+// Runs due timers and posted work, then polls mgr for events, sleeping until
+// the next timer at most.
+void evloop_poll(evloop_t *loop);
+
+// Makes the loop's current or next poll return at once. Safe to call from
+// any thread and from signal handlers.
+void evloop_wake(const evloop_t *loop);
+
+// Wakes every initialized loop. Safe to call from signal handlers.
+void evloop_wake_all(void);
+
+// Closes the wakeups of the loops freed so far, which evloop_free() leaves
+// open for evloop_wake_all(). Call once no signal handler that wakes loops
+// can run any more.
+void evloop_close_wakeups(void);
+
+// Queues fn(arg) to run on the loop thread during its next iteration, and
+// wakes the loop. Safe to call from any thread (not from signal handlers).
+// Returns 0 on success, or -1 if memory is exhausted.
+int evloop_post(evloop_t *loop, evloop_fn fn, void *arg);
+
+// Same as evloop_post(), with the work item allocated by the caller (with
+// malloc, freed once it has run), so that posting cannot fail. The result of
+// work handed to another thread is posted this way.
+void evloop_post_work(evloop_t *loop, evloop_work_t *work);
+
+// Keeps the loop from being torn down until a matching evloop_release():
+// called on the loop thread when work is handed to another thread that will
+// post its result back, and released by the posted work.
+void evloop_hold(evloop_t *loop);
+void evloop_release(evloop_t *loop);
+
+// Returns the calling thread's loop, or NULL on threads without one.
+evloop_t *evloop_current(void);
+
+// Records network activity on the calling loop thread, which keeps a
+// busy-polling loop spinning. Cheap; call from the event handler.
+void evloop_note_activity(void);
+
+// Monotonic time in microseconds.
+uint64_t evloop_now_us(void);
+
+#endif // EVLOOP_H
@@ -2,375 +2,712 @@
 // Implements the specific logic for handling various API requests.
 // This file contains the "business logic" of the API.
 
+#define _POSIX_C_SOURCE 200809L // For pthread rwlocks and clock_gettime
+
 #include "handlers.h"    // Header for handler function declarations
 #include "mongoose.h"    // Mongoose types and functions
-#include "cJSON.h"       // For JSON parsing and generation
-#include "utils.h"       // For send_json_response, send_error_response
-#include <stdio.h>       // For fprintf
-#include <stdlib.h>      // For malloc, free, strtol (safer than atoi)
-#include <string.h>      // For strlen, strcmp, strcpy, memcpy, strncmp
-
-// --- In-memory "Database" Simulation ---
-// WARNING: This is an in-memory store and is NOT persistent.
-// Data will be lost when the server restarts.
-// For a production-ready application, this MUST be replaced
-// with an actual database (e.g., PostgreSQL, MySQL, SQLite, MongoDB).
-
-#define MAX_ITEMS 100 // Maximum number of items our in-memory array can hold
+#include "json_reader.h" // For reading item request bodies
+#include "utils.h"       // For send_error_response, send_static_response
+#include "store.h"       // For item_t and the item store
+#include "json_writer.h" // For writing responses straight into the send buffer
+#include "conn.h"        // For streaming the item listing
+#include "log.h"         // For log_message
+#include "persist.h"     // For recovering and logging the store
+#include "arena.h"       // For request-scoped batch operations
+#include "trace.h"       // For the parse, store and serialize spans
+#include <pthread.h>     // For the listing cache lock
+#include <stdint.h>      // For uint32_t, uint64_t
+#include <stdio.h>       // For fprintf, snprintf
+#include <stdlib.h>      // For calloc, malloc, free
+#include <string.h>      // For memcmp, memset, strlen
+#include <time.h>        // For clock_gettime
+
+// Typical size of one rendered item, used to presize listing responses.
+#define ITEM_JSON_SIZE_GUESS 48
+
+// Default and maximum page size of paginated listings.
+#define ITEMS_DEFAULT_LIMIT 100
+#define ITEMS_MAX_LIMIT 1000
+
+// Items per chunk of a streamed listing.
+#define ITEMS_PER_CHUNK 256
+
+// Largest store whose full listing is kept pre-rendered (see send_cached_listing).
+#define LISTING_CACHE_MAX_ITEMS 10000
+
+// Size of an entity tag, quotes and terminator included.
+#define ETAG_SIZE 32
+
+// Most operations in one batch request (see RESP_BATCH_TOO_LARGE).
+#define ITEMS_BATCH_MAX_OPS 10000
+
+// Fewest bytes an operation takes up in a batch body ("{}" and a comma), so
+// the body length divided by it bounds the number of operations.
+#define BATCH_MIN_OP_BYTES 3
+
+// --- Item "Database" ---
+// The records themselves live in store.c (dense array plus hash index by id).
+// With --data-dir, every change is also logged (persist.c) and the store is
+// recovered on restart; without it, data is lost when the server stops.
+
+// The store is shared by every event loop thread (see --workers in main.c).
+// Reads take no lock; a write locks only the shard of the item's id.
+
+// --- Conditional GETs ---
+// Item responses carry the item's version as their ETag, listings the store
+// version, so a client that sends the tag back in If-None-Match gets a 304
+// without anything being rendered. Versions can repeat after a restart that
+// lost the last log commit, so tags also name the process they come from.
+
+static uint32_t s_etag_epoch; // Distinguishes this process's tags
 
-// Structure to represent an item in our "database".
 typedef struct {
-    int id;
-    char name[64]; // Fixed-size buffer for item name
-    int value;
-} item_t;
+    char tag[ETAG_SIZE];         // Quoted, as sent
+    char header[ETAG_SIZE + 8];  // "ETag: ...\r\n"
+} etag_t;
 
-static item_t items[MAX_ITEMS]; // Array to store items
-static int next_item_id = 1;    // Counter for assigning unique IDs
-static int item_count = 0;      // Current number of items in the array
+static void make_etag(etag_t *e, uint64_t version) {
+    snprintf(e->tag, sizeof(e->tag), "\"%08x-%llx\"", s_etag_epoch, (unsigned long long) version);
+    snprintf(e->header, sizeof(e->header), "ETag: %s\r\n", e->tag);
+}
 
-// Static helper function to initialize some dummy data into the in-memory store.
-// This ensures that there's some data available when the server starts.
-static void init_dummy_data() {
-    // Only initialize if the "database" is empty to avoid re-adding on every call.
-    if (item_count == 0) {
-        // Add "First Item"
-        if (item_count < MAX_ITEMS) {
-            items[item_count].id = next_item_id++;
-            strcpy(items[item_count].name, "First Item");
-            items[item_count].value = 100;
-            item_count++;
+// Returns whether the request's If-None-Match header is "*" or lists the tag.
+// Tags are compared weakly (a W/ prefix is ignored), as If-None-Match requires.
+static int etag_matches(struct mg_http_message *hm, const etag_t *e) {
+    struct mg_str *inm = mg_http_get_header(hm, "If-None-Match");
+    if (inm == NULL) {
+        return 0;
+    }
+    size_t tag_len = strlen(e->tag);
+    const char *p = inm->p;
+    const char *end = inm->p + inm->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *start = p;
+        while (p < end && *p != ',') p++;
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+        if (stop - start == 1 && *start == '*') {
+            return 1;
         }
-
-        // Add "Second Item"
-        if (item_count < MAX_ITEMS) {
-            items[item_count].id = next_item_id++;
-            strcpy(items[item_count].name, "Second Item");
-            items[item_count].value = 200;
-            item_count++;
+        if (stop - start > 2 && start[0] == 'W' && start[1] == '/') {
+            start += 2;
+        }
+        if ((size_t) (stop - start) == tag_len && memcmp(start, e->tag, tag_len) == 0) {
+            return 1;
         }
-
-        fprintf(stdout, "Dummy data initialized with %d items.\n", item_count);
     }
+    return 0;
+}
+
+static void send_not_modified(struct mg_connection *c, const etag_t *e) {
+    mg_printf(c, "HTTP/1.1 304 Not Modified\r\n%sAccess-Control-Allow-Origin: *\r\n\r\n", e->header);
 }
 
-// Static helper function to find an item in the in-memory array by its ID.
-// Returns a pointer to the item if found, otherwise returns NULL.
-static item_t *find_item_by_id(int id) {
-    for (int i = 0; i < item_count; ++i) {
-        if (items[i].id == id) {
-            return &items[i]; // Item found
+// --- Listing cache ---
+// Dashboards poll the full listing far more often than the store changes, so
+// for stores of up to LISTING_CACHE_MAX_ITEMS items the complete response is
+// kept, rendered once per store version and then copied out as is.
+
+static pthread_rwlock_t s_listing_lock = PTHREAD_RWLOCK_INITIALIZER; // Protects the fields below
+static struct mg_iobuf s_listing; // Status line, headers and body; empty if none yet
+static uint64_t s_listing_version; // Store version it was rendered at
+
+// Static helper function to initialize some dummy data into the store.
+// This ensures that there's some data available when the server starts.
+static void init_dummy_data(void) {
+    // Only initialize a store that never held an item, so a recovered store
+    // whose items were all deleted is not reseeded.
+    if (store_max_id() == 0) {
+        if (store_insert("First Item", 100, NULL) != 0 || store_insert("Second Item", 200, NULL) != 0) {
+            fprintf(stderr, "Warning: Failed to allocate memory for dummy data.\n");
         }
+        fprintf(stdout, "Dummy data initialized with %zu items.\n", store_count());
     }
-    return NULL; // Item not found
 }
 
-// Static helper function to extract the integer ID from the URI.
-// Expected format: /api/v1/items/{id}
-// It safely parses the ID, converting it from string to integer.
-// Returns the ID on success, or -1 if the ID is not found or is invalid.
-static int get_item_id_from_uri(const struct mg_http_message *hm) {
-    const char *prefix = "/api/v1/items/";
-    size_t prefix_len = strlen(prefix);
-
-    // Check if the URI starts with the expected prefix and is long enough for an ID.
-    // mg_vcmp safely compares mg_str (non-null-terminated) with C strings.
-    if (hm->uri.len > prefix_len && mg_vcmp(&hm->uri, prefix) == 0) {
-        // The ID part starts immediately after the prefix.
-        // We need to extract this part and convert it to an integer.
-        // Mongoose mg_str are not null-terminated, so we copy the ID part to a temp buffer.
-        char id_str_buf[32]; // Sufficient buffer for typical integer IDs (e.g., up to 2 billion)
-        size_t id_len = hm->uri.len - prefix_len;
-
-        // Prevent buffer overflow if the ID string is unexpectedly long.
-        if (id_len >= sizeof(id_str_buf)) {
-            fprintf(stderr, "Error: Item ID string in URI is too long.\n");
-            return -1;
-        }
+// Static helper function to extract the integer ID from the {id} path parameter.
+// The router has already located the ID segment, so it is parsed in place.
+// Returns the ID on success, or -1 if the ID is missing or is invalid.
+static int get_item_id(const route_params_t *params) {
+    struct mg_str id_str = router_get_param(params, "id");
+    int id;
+    if (parse_int_str(id_str, &id) != 0) {
+        // Logged at debug level: clients (and scanners) send bad IDs routinely.
+        log_message(LOG_DEBUG, "msg=\"invalid item ID in URI\" id=\"%.*s\"", id_str.len > 32 ? 32 : (int)id_str.len, id_str.p ? id_str.p : "");
+        return -1; // Not a valid integer ID
+    }
+    return id;
+}
 
-        // Copy the ID part from the URI (which is not null-terminated)
-        // into our null-terminated buffer.
-        memcpy(id_str_buf, hm->uri.p + prefix_len, id_len);
-        id_str_buf[id_len] = '\0'; // Null-terminate the string for strtol
-
-        // Use strtol for safer string-to-long conversion with error checking.
-        char *endptr;
-        long id_long = strtol(id_str_buf, &endptr, 10); // Base 10 conversion
-
-        // Check for conversion errors:
-        // 1. If no digits were found (endptr points to the start of the string).
-        // 2. If there are extra characters after the number (endptr is not at the end of the string).
-        // 3. Check for overflow/underflow if the ID can exceed `int` range (though `long` is usually larger).
-        if (endptr == id_str_buf || *endptr != '\0' || id_long < INT_MIN || id_long > INT_MAX) {
-            fprintf(stderr, "Error: Invalid integer ID format in URI: '%s'\n", id_str_buf);
-            return -1; // Not a valid integer ID
-        }
+// Writes one item as {"id":..,"name":..,"value":..}.
+static void write_item(json_writer_t *w, const item_t *item) {
+    jw_object_open(w);
+    jw_key(w, "id");
+    jw_int(w, item->id);
+    jw_key(w, "name");
+    jw_string(w, item->name);
+    jw_key(w, "value");
+    jw_int(w, item->value);
+    jw_object_close(w);
+}
 
-        return (int)id_long; // Cast to int (assuming ID fits within int range)
+// Sends a single item as the response body, tagged with its version.
+static void send_item_response(struct mg_connection *c, int status_code, const item_t *item) {
+    TRACE_BEGIN(serialize);
+    etag_t etag;
+    make_etag(&etag, item->version);
+    json_writer_t w;
+    jw_begin_with_headers(&w, c, status_code, etag.header);
+    write_item(&w, item);
+    int rc = jw_finish(&w);
+    TRACE_END(serialize, "serialize");
+    if (rc != 0) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for item JSON response.");
     }
-    fprintf(stderr, "Error: URI does not match expected ID format or is too short.\n");
-    return -1; // URI does not match expected format for an ID
+}
+
+// Initializes the item store. Must be called once at startup, before any
+// event loop thread starts.
+int handlers_init(const char *data_dir) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    s_etag_epoch = (uint32_t) now.tv_sec ^ (uint32_t) now.tv_nsec;
+    if (data_dir != NULL && persist_open(data_dir) != 0) {
+        return -1;
+    }
+    init_dummy_data();
+    return 0;
+}
+
+void handlers_shutdown(void) {
+    persist_close();
+    mg_iobuf_free(&s_listing);
 }
 
 // --- Handler Implementations ---
+// Item handlers work on copies: store_get() copies an item out, and the
+// write functions copy out the result, so nothing points into the store
+// while a response is rendered.
 
 // Handles GET requests to the root path "/".
-void handle_root(struct mg_connection *c, struct mg_http_message *hm) {
+void handle_root(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
     (void) hm; // Cast to void to suppress unused parameter warning.
+    (void) params;
     // Send a simple JSON response.
-    send_json_response(c, 200, "{ \"message\": \"Welcome to the C API Backend! Navigate to /api/v1/items for data.\" }");
+    send_static_response(c, RESP_ROOT);
 }
 
-// Handles GET requests to "/api/v1/items" (to get all items).
-void handle_get_all_items(struct mg_connection *c, struct mg_http_message *hm) {
-    (void) hm; // Unused
-    init_dummy_data(); // Ensure dummy data exists before retrieving.
+// Writes the items with ids in (after_id, max_id] in ascending id order,
+// stopping after limit items. Only stored ids are visited (see
+// store_iter_next()), so the cost follows limit, not the gaps deletes left.
+// Returns the id of the last item written, or max_id once none are left.
+static int write_items_after(json_writer_t *w, int after_id, int max_id, size_t limit) {
+    store_iter_t it;
+    store_iter_init(&it, after_id);
+    int id = after_id;
+    size_t written = 0;
+    item_t item;
+    while (written < limit) {
+        id = store_iter_next(&it);
+        if (id == 0 || id > max_id) {
+            return max_id;
+        }
+        if (store_get(id, &item) == 0) {
+            write_item(w, &item);
+            written++;
+        }
+    }
+    return id;
+}
 
-    cJSON *root = cJSON_CreateObject(); // Create the root JSON object
-    if (!root) {
-        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for JSON root object.");
-        return;
+// Responds with one page: {"items":[...],"next_cursor":N}, where next_cursor
+// is null on the last page. The page holds the items after the cursor id.
+static void send_items_page(struct mg_connection *c, int cursor, size_t limit, const etag_t *etag) {
+    TRACE_BEGIN(serialize);
+    json_writer_t w;
+    jw_begin_with_headers(&w, c, 200, etag->header);
+    jw_reserve(&w, limit * ITEM_JSON_SIZE_GUESS + 64);
+    jw_object_open(&w);
+    jw_key(&w, "items");
+    jw_array_open(&w);
+    int max_id = store_max_id();
+    int last_id = write_items_after(&w, cursor, max_id, limit);
+    jw_array_close(&w);
+    jw_key(&w, "next_cursor");
+    if (last_id < max_id) {
+        jw_int(&w, last_id);
+    } else {
+        jw_null(&w);
     }
+    jw_object_close(&w);
+    int rc = jw_finish(&w);
+    TRACE_END(serialize, "serialize");
+    if (rc != 0) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for JSON response for items.");
+    }
+}
 
-    cJSON *items_array = cJSON_CreateArray(); // Create a JSON array for items
-    if (!items_array) {
-        cJSON_Delete(root); // Clean up root object if array creation fails
-        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for JSON items array.");
-        return;
+// Progress of a streamed listing.
+typedef struct {
+    int after_id;  // Last id examined so far
+    int max_id;    // Highest id when the listing started; later items are not included
+    int started;   // The opening {"items":[ has been written
+    int has_items; // At least one item has been written
+} item_stream_t;
+
+// Writes the next chunk of a streamed listing (see conn_stream_fn).
+// Items changed during the transfer show up as they are when their chunk
+// is written.
+static int stream_items(struct mg_connection *c, void *state) {
+    item_stream_t *st = (item_stream_t *) state;
+    json_writer_t w;
+    jw_chunk_begin(&w, c);
+    if (!st->started) {
+        jw_object_open(&w);
+        jw_key(&w, "items");
+        jw_array_open(&w);
+        st->started = 1;
+    } else {
+        w.need_comma = st->has_items; // Continue the array of the previous chunk
+    }
+    if (st->after_id < st->max_id) {
+        st->after_id = write_items_after(&w, st->after_id, st->max_id, ITEMS_PER_CHUNK);
+        st->has_items = w.need_comma;
+    }
+    int done = st->after_id >= st->max_id;
+    if (done) {
+        jw_array_close(&w);
+        jw_object_close(&w);
+    }
+    if (jw_chunk_end(&w) != 0) {
+        return -1;
     }
+    if (done) {
+        return jw_chunked_finish(c) == 0 ? 1 : -1;
+    }
+    return 0;
+}
 
-    cJSON_AddItemToObject(root, "items", items_array); // Add the array to the root object
+// Renders the full listing response into *out. It includes every change up
+// to the version in etag (see store_version()).
+// Returns 0 on success, or -1 if memory is exhausted.
+static int render_listing(const etag_t *etag, struct mg_iobuf *out) {
+    // Render into the send buffer of a scratch connection and keep the buffer.
+    struct mg_connection scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    json_writer_t w;
+    jw_begin_with_headers(&w, &scratch, 200, etag->header);
+    jw_reserve(&w, store_count() * ITEM_JSON_SIZE_GUESS + 64);
+    jw_object_open(&w);
+    jw_key(&w, "items");
+    jw_array_open(&w);
+    write_items_after(&w, 0, store_max_id(), SIZE_MAX);
+    jw_array_close(&w);
+    jw_object_close(&w);
+    if (jw_finish(&w) != 0) {
+        mg_iobuf_free(&scratch.send);
+        return -1;
+    }
+    *out = scratch.send;
+    return 0;
+}
 
-    // Iterate through our in-memory items and add them to the JSON array.
-    for (int i = 0; i < item_count; ++i) {
-        cJSON *item_obj = cJSON_CreateObject(); // Create a JSON object for each item
-        if (item_obj) {
-            cJSON_AddNumberToObject(item_obj, "id", items[i].id);
-            cJSON_AddStringToObject(item_obj, "name", items[i].name);
-            cJSON_AddNumberToObject(item_obj, "value", items[i].value);
-            cJSON_AddItemToArray(items_array, item_obj); // Add item object to the array
-        } else {
-            fprintf(stderr, "Warning: Failed to create JSON object for item ID %d. Skipping this item.\n", items[i].id);
-            // Even if an item fails, we try to send what we have, but log the error.
+// Sends the full listing at the given store version from the cache,
+// rendering it first if the store has changed since the cached copy.
+// Returns 0 once the response is queued, or -1 if it could not be rendered.
+static int send_cached_listing(struct mg_connection *c, const etag_t *etag, uint64_t version) {
+    int hit = 0;
+    pthread_rwlock_rdlock(&s_listing_lock);
+    if (s_listing.len > 0 && s_listing_version == version) {
+        hit = 1;
+        if (!mg_send(c, s_listing.buf, s_listing.len)) {
+            log_message(LOG_ERROR, "msg=\"failed to queue a response\" status=200");
         }
     }
+    pthread_rwlock_unlock(&s_listing_lock);
+    if (hit) {
+        return 0;
+    }
 
-    char *json_str = cJSON_PrintUnformatted(root); // Convert cJSON object to a compact JSON string
-    if (json_str) {
-        send_json_response(c, 200, json_str); // Send the JSON response with 200 OK
-        free(json_str); // IMPORTANT: Free the string allocated by cJSON_PrintUnformatted
-    } else {
-        send_error_response(c, 500, "Internal Server Error", "Failed to stringify JSON response for all items.");
+    struct mg_iobuf fresh;
+    TRACE_BEGIN(serialize);
+    int rc = render_listing(etag, &fresh);
+    TRACE_END(serialize, "serialize");
+    if (rc != 0) {
+        return -1;
+    }
+    if (!mg_send(c, fresh.buf, fresh.len)) {
+        log_message(LOG_ERROR, "msg=\"failed to queue a response\" status=200");
     }
-    cJSON_Delete(root); // IMPORTANT: Always free the cJSON object to prevent memory leaks
+    pthread_rwlock_wrlock(&s_listing_lock);
+    if (s_listing.len == 0 || s_listing_version < version) {
+        struct mg_iobuf stale = s_listing;
+        s_listing = fresh;
+        s_listing_version = version;
+        fresh = stale; // Freed below
+    }
+    pthread_rwlock_unlock(&s_listing_lock);
+    mg_iobuf_free(&fresh);
+    return 0;
 }
 
-// Handles GET requests to "/api/v1/items/{id}" (to get a single item by ID).
-void handle_get_item_by_id(struct mg_connection *c, struct mg_http_message *hm) {
-    init_dummy_data(); // Ensure dummy data exists.
+// Handles GET requests to "/api/v1/items" (to get all items).
+// With ?cursor=ID and/or ?limit=N, responds with one page of at most N items
+// (default ITEMS_DEFAULT_LIMIT) with ids greater than ID (default 0).
+// Without them, streams every item as {"items":[...]} using chunked transfer
+// encoding, ITEMS_PER_CHUNK items at a time as the send buffer drains.
+// Either way only a bounded part of the listing is buffered at any time,
+// except that the full listing of a small store comes from a cache.
+// Both carry the store version as their ETag and honor If-None-Match.
+void handle_get_all_items(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) params; // Unused
+    uint64_t version = store_version();
+    etag_t etag;
+    make_etag(&etag, version);
+    if (etag_matches(hm, &etag)) {
+        send_not_modified(c, &etag);
+        return;
+    }
 
-    // Extract item ID from the URI.
-    int item_id = get_item_id_from_uri(hm);
-    if (item_id == -1) {
-        send_error_response(c, 400, "Bad Request", "Invalid or missing item ID in URI. Expected format: /api/v1/items/{id}");
+    struct mg_str cursor_str = mg_http_var(hm->query, mg_str("cursor"));
+    struct mg_str limit_str = mg_http_var(hm->query, mg_str("limit"));
+
+    if (cursor_str.p != NULL || limit_str.p != NULL) {
+        int cursor = 0;
+        int limit = ITEMS_DEFAULT_LIMIT;
+        if (cursor_str.p != NULL && (parse_int_str(cursor_str, &cursor) != 0 || cursor < 0)) {
+            send_error_response(c, 400, "Bad Request", "Invalid 'cursor' query parameter. Expected a non-negative item ID.");
+            return;
+        }
+        if (limit_str.p != NULL && (parse_int_str(limit_str, &limit) != 0 || limit < 1 || limit > ITEMS_MAX_LIMIT)) {
+            send_error_response(c, 400, "Bad Request", "Invalid 'limit' query parameter. Expected a number between 1 and 1000.");
+            return;
+        }
+        send_items_page(c, cursor, (size_t) limit, &etag);
         return;
     }
 
-    // Find the item in our in-memory store.
-    item_t *item = find_item_by_id(item_id);
-    if (item == NULL) {
-        send_error_response(c, 404, "Not Found", "Item with specified ID not found.");
+    // A failed rendering falls back to streaming, which needs less memory.
+    if (store_count() <= LISTING_CACHE_MAX_ITEMS && send_cached_listing(c, &etag, version) == 0) {
         return;
     }
 
-    cJSON *item_obj = cJSON_CreateObject(); // Create JSON object for the found item
-    if (!item_obj) {
-        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for item JSON object.");
+    item_stream_t *st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the item listing.");
         return;
     }
-    // Populate JSON object with item data.
-    cJSON_AddNumberToObject(item_obj, "id", item->id);
-    cJSON_AddStringToObject(item_obj, "name", item->name);
-    cJSON_AddNumberToObject(item_obj, "value", item->value);
+    st->max_id = store_max_id();
 
-    char *json_str = cJSON_PrintUnformatted(item_obj);
-    if (json_str) {
-        send_json_response(c, 200, json_str); // Send JSON response
-        free(json_str); // Free allocated string
-    } else {
-        send_error_response(c, 500, "Internal Server Error", "Failed to stringify item JSON.");
+    json_writer_t w;
+    if (jw_begin_chunked_with_headers(&w, c, 200, etag.header) != 0) {
+        free(st);
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the item listing.");
+        return;
     }
-    cJSON_Delete(item_obj); // Free cJSON object
+    conn_start_stream(c, stream_items, st);
 }
 
-// Handles POST requests to "/api/v1/items" (to create a new item).
-void handle_create_item(struct mg_connection *c, struct mg_http_message *hm) {
-    init_dummy_data(); // Ensure dummy data is initialized if first create.
+// Handles GET requests to "/api/v1/items/{id}" (to get a single item by ID).
+void handle_get_item_by_id(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    // Extract item ID from the URI.
+    int item_id = get_item_id(params);
+    if (item_id == -1) {
+        send_static_response(c, RESP_INVALID_ITEM_ID);
+        return;
+    }
 
-    // Check if we have space for a new item.
-    if (item_count >= MAX_ITEMS) {
-        send_error_response(c, 507, "Insufficient Storage", "Cannot create more items, in-memory storage limit reached.");
+    // Find the item in our in-memory store.
+    item_t item;
+    TRACE_BEGIN(lookup);
+    int found = store_get(item_id, &item) == 0;
+    TRACE_END(lookup, "store");
+    if (!found) {
+        send_static_response(c, RESP_ITEM_NOT_FOUND);
         return;
     }
 
-    // Parse the request body as JSON.
-    // Use ParseWithLength for safety, as hm->body.p might not be null-terminated.
-    cJSON *json_body = cJSON_ParseWithLength(hm->body.p, hm->body.len);
-    if (!json_body) {
-        send_error_response(c, 400, "Bad Request", "Invalid JSON format in request body.");
+    etag_t etag;
+    make_etag(&etag, item.version);
+    if (etag_matches(hm, &etag)) {
+        send_not_modified(c, &etag);
         return;
     }
+    send_item_response(c, 200, &item);
+}
 
-    // Get "name" and "value" fields from the parsed JSON.
-    cJSON *name_obj = cJSON_GetObjectItemCaseSensitive(json_body, "name");
-    cJSON *value_obj = cJSON_GetObjectItemCaseSensitive(json_body, "value");
+// Handles POST requests to "/api/v1/items" (to create a new item).
+void handle_create_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) params; // Unused
+    item_fields_t fields;
+    TRACE_BEGIN(parse);
+    int parsed = json_read_item_fields(hm->body.p, hm->body.len, &fields) == 0;
+    TRACE_END(parse, "parse");
+    if (!parsed) {
+        send_static_response(c, RESP_INVALID_JSON_BODY);
+        return;
+    }
 
     // Validate if fields exist and are of the correct type.
-    if (!cJSON_IsString(name_obj) || (name_obj->valuestring == NULL) ||
-        !cJSON_IsNumber(value_obj)) {
-        cJSON_Delete(json_body); // Free parsed JSON
-        send_error_response(c, 400, "Bad Request", "Missing or invalid 'name' (string) or 'value' (number) in JSON body.");
+    if (!fields.has_name || !fields.has_value) {
+        send_static_response(c, RESP_INVALID_ITEM_FIELDS);
         return;
     }
 
     // Basic validation for name length to prevent buffer overflow.
-    if (strlen(name_obj->valuestring) >= sizeof(items[0].name)) {
-        cJSON_Delete(json_body);
-        send_error_response(c, 400, "Bad Request", "Item name provided is too long (max 63 characters).");
+    if (fields.name_len >= ITEM_NAME_SIZE) {
+        send_static_response(c, RESP_ITEM_NAME_TOO_LONG);
         return;
     }
 
-    // Create a new item structure.
-    item_t new_item;
-    new_item.id = next_item_id++; // Assign a new unique ID.
-    strcpy(new_item.name, name_obj->valuestring); // Copy name (safe due to length check above).
-    new_item.value = (int)cJSON_GetNumberValue(value_obj); // Get integer value.
-
-    // Add the new item to our in-memory array.
-    items[item_count] = new_item;
-    item_count++;
-
-    // Prepare the JSON response for the created item.
-    cJSON *response_obj = cJSON_CreateObject();
-    if (response_obj) {
-        cJSON_AddNumberToObject(response_obj, "id", new_item.id);
-        cJSON_AddStringToObject(response_obj, "name", new_item.name);
-        cJSON_AddNumberToObject(response_obj, "value", new_item.value);
-
-        char *json_str = cJSON_PrintUnformatted(response_obj);
-        if (json_str) {
-            send_json_response(c, 201, json_str); // 201 Created status code.
-            free(json_str);
-        } else {
-            send_error_response(c, 500, "Internal Server Error", "Failed to stringify response JSON for created item.");
-        }
-        cJSON_Delete(response_obj);
-    } else {
-        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for response JSON object.");
+    // Add the new item to the store, which assigns a new unique ID.
+    // The name fits (see the length check above).
+    item_t stored;
+    TRACE_BEGIN(insert);
+    int inserted = store_insert(fields.name, fields.value, &stored) == 0;
+    TRACE_END(insert, "store");
+    if (!inserted) {
+        send_static_response(c, RESP_STORAGE_FULL);
+        return;
     }
-    cJSON_Delete(json_body); // IMPORTANT: Always free parsed JSON.
+
+    // Respond with the created item.
+    send_item_response(c, 201, &stored); // 201 Created status code.
 }
 
 // Handles PUT requests to "/api/v1/items/{id}" (to update an existing item).
-void handle_update_item(struct mg_connection *c, struct mg_http_message *hm) {
-    init_dummy_data(); // Ensure dummy data exists.
-
+void handle_update_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
     // Extract item ID from URI.
-    int item_id = get_item_id_from_uri(hm);
+    int item_id = get_item_id(params);
     if (item_id == -1) {
-        send_error_response(c, 400, "Bad Request", "Invalid or missing item ID in URI. Expected format: /api/v1/items/{id}");
+        send_static_response(c, RESP_INVALID_ITEM_ID);
         return;
     }
 
     // Find the item to be updated.
-    item_t *item = find_item_by_id(item_id);
-    if (item == NULL) {
-        send_error_response(c, 404, "Not Found", "Item with specified ID not found for update.");
+    item_t item;
+    TRACE_BEGIN(lookup);
+    int found = store_get(item_id, &item) == 0;
+    TRACE_END(lookup, "store");
+    if (!found) {
+        send_static_response(c, RESP_ITEM_NOT_FOUND_FOR_UPDATE);
         return;
     }
 
-    // Parse the request body as JSON.
-    cJSON *json_body = cJSON_ParseWithLength(hm->body.p, hm->body.len);
-    if (!json_body) {
-        send_error_response(c, 400, "Bad Request", "Invalid JSON format in request body for update.");
+    item_fields_t fields;
+    TRACE_BEGIN(parse);
+    int parsed = json_read_item_fields(hm->body.p, hm->body.len, &fields) == 0;
+    TRACE_END(parse, "parse");
+    if (!parsed) {
+        send_static_response(c, RESP_INVALID_JSON_BODY_FOR_UPDATE);
         return;
     }
 
-    // Get "name" and "value" fields (they are optional for update).
-    cJSON *name_obj = cJSON_GetObjectItemCaseSensitive(json_body, "name");
-    cJSON *value_obj = cJSON_GetObjectItemCaseSensitive(json_body, "value");
-
+    // "name" and "value" are optional for update.
     // Update item name if provided and valid.
-    if (name_obj && cJSON_IsString(name_obj) && name_obj->valuestring != NULL) {
-        if (strlen(name_obj->valuestring) >= sizeof(item->name)) {
-            cJSON_Delete(json_body);
-            send_error_response(c, 400, "Bad Request", "Updated item name too long (max 63 characters).");
-            return;
-        }
-        strcpy(item->name, name_obj->valuestring);
+    if (fields.has_name && fields.name_len >= sizeof(item.name)) {
+        send_static_response(c, RESP_UPDATED_NAME_TOO_LONG);
+        return;
     }
 
-    // Update item value if provided and valid.
-    if (value_obj && cJSON_IsNumber(value_obj)) {
-        item->value = (int)cJSON_GetNumberValue(value_obj);
+    // The item may have been deleted since it was looked up.
+    TRACE_BEGIN(update);
+    int updated =
+        store_update(item_id, fields.has_name ? fields.name : NULL, fields.has_value ? &fields.value : NULL, &item) == 0;
+    TRACE_END(update, "store");
+    if (!updated) {
+        send_static_response(c, RESP_ITEM_NOT_FOUND_FOR_UPDATE);
+        return;
     }
 
-    cJSON_Delete(json_body); // Free parsed JSON.
-
     // Respond with the updated item's data.
-    cJSON *response_obj = cJSON_CreateObject();
-    if (response_obj) {
-        cJSON_AddNumberToObject(response_obj, "id", item->id);
-        cJSON_AddStringToObject(response_obj, "name", item->name);
-        cJSON_AddNumberToObject(response_obj, "value", item->value);
-
-        char *json_str = cJSON_PrintUnformatted(response_obj);
-        if (json_str) {
-            send_json_response(c, 200, json_str); // 200 OK status code.
-            free(json_str);
-        } else {
-            send_error_response(c, 500, "Internal Server Error", "Failed to stringify response JSON for updated item.");
-        }
-        cJSON_Delete(response_obj);
-    } else {
-        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for response JSON object.");
-    }
+    send_item_response(c, 200, &item); // 200 OK status code.
 }
 
 // Handles DELETE requests to "/api/v1/items/{id}" (to delete an item).
-void handle_delete_item(struct mg_connection *c, struct mg_http_message *hm) {
-    init_dummy_data(); // Ensure dummy data exists.
-
+void handle_delete_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) hm; // Unused, the ID comes from params
     // Extract item ID from URI.
-    int item_id = get_item_id_from_uri(hm);
+    int item_id = get_item_id(params);
     if (item_id == -1) {
-        send_error_response(c, 400, "Bad Request", "Invalid or missing item ID in URI. Expected format: /api/v1/items/{id}");
+        send_static_response(c, RESP_INVALID_ITEM_ID);
         return;
     }
 
-    int found_index = -1;
-    // Find the index of the item to be deleted.
-    for (int i = 0; i < item_count; ++i) {
-        if (items[i].id == item_id) {
-            found_index = i;
-            break;
-        }
+    // Remove the item. The store moves its shard's last record into the
+    // freed slot, so deletion is O(1) and does not shift the array.
+    TRACE_BEGIN(removal);
+    int deleted = store_delete(item_id) == 0;
+    TRACE_END(removal, "store");
+    if (!deleted) {
+        send_static_response(c, RESP_ITEM_NOT_FOUND_FOR_DELETE);
+        return;
     }
 
-    if (found_index == -1) {
-        send_error_response(c, 404, "Not Found", "Item with specified ID not found for deletion.");
+    // Send a success message.
+    send_static_response(c, RESP_ITEM_DELETED);
+}
+
+// Outcome of one operation of a batch.
+typedef struct {
+    int status;              // HTTP status the operation would have had on its own
+    static_response_t error; // Why it failed, if status is not 2xx
+    int has_item;            // item holds the item it created, read or updated
+    item_t item;
+} batch_result_t;
+
+// Results of a batch, streamed once every operation has been applied.
+typedef struct {
+    size_t count;
+    size_t next;              // First result not written yet
+    batch_result_t results[];
+} batch_stream_t;
+
+static void set_batch_error(batch_result_t *r, static_response_t error) {
+    r->status = static_response_status(error);
+    r->error = error;
+    r->has_item = 0;
+}
+
+// Applies one operation with the checks of the corresponding single-item
+// handler.
+static void run_batch_op(const item_op_t *op, batch_result_t *r) {
+    const item_fields_t *f = &op->fields;
+    if (op->kind == ITEM_OP_INVALID || (op->kind != ITEM_OP_CREATE && !op->has_id)) {
+        set_batch_error(r, RESP_INVALID_BATCH_OP);
         return;
     }
+    r->status = 200;
+    r->has_item = 1;
+    switch (op->kind) {
+    case ITEM_OP_CREATE:
+        if (!f->has_name || !f->has_value) {
+            set_batch_error(r, RESP_INVALID_ITEM_FIELDS);
+        } else if (f->name_len >= ITEM_NAME_SIZE) {
+            set_batch_error(r, RESP_ITEM_NAME_TOO_LONG);
+        } else if (store_insert(f->name, f->value, &r->item) != 0) {
+            set_batch_error(r, RESP_STORAGE_FULL);
+        } else {
+            r->status = 201;
+        }
+        break;
+    case ITEM_OP_GET:
+        if (store_get(op->id, &r->item) != 0) {
+            set_batch_error(r, RESP_ITEM_NOT_FOUND);
+        }
+        break;
+    case ITEM_OP_UPDATE:
+        if (f->has_name && f->name_len >= ITEM_NAME_SIZE) {
+            set_batch_error(r, RESP_UPDATED_NAME_TOO_LONG);
+        } else if (store_update(op->id, f->has_name ? f->name : NULL, f->has_value ? &f->value : NULL, &r->item) != 0) {
+            set_batch_error(r, RESP_ITEM_NOT_FOUND_FOR_UPDATE);
+        }
+        break;
+    case ITEM_OP_DELETE:
+        r->has_item = 0;
+        if (store_delete(op->id) != 0) {
+            set_batch_error(r, RESP_ITEM_NOT_FOUND_FOR_DELETE);
+        }
+        break;
+    default:
+        set_batch_error(r, RESP_INVALID_BATCH_OP);
+        break;
+    }
+}
 
-    // "Delete" the item by shifting subsequent items back in the array.
-    // This is a simple O(N) deletion for a small array. For large arrays/production,
-    // a linked list or more sophisticated data structure or a database is needed.
-    for (int i = found_index; i < item_count - 1; ++i) {
-        items[i] = items[i + 1];
+// Writes one result as {"status":..,"item":{..}} or {"status":..,"error":..};
+// a successful delete is just {"status":200}.
+static void write_batch_result(json_writer_t *w, const batch_result_t *r) {
+    jw_object_open(w);
+    jw_key(w, "status");
+    jw_int(w, r->status);
+    if (r->has_item) {
+        jw_key(w, "item");
+        write_item(w, &r->item);
+    } else if (r->status >= 400) {
+        jw_key(w, "error");
+        jw_string(w, static_response_message(r->error));
     }
-    item_count--; // Decrease the total item count.
+    jw_object_close(w);
+}
 
-    // Send a success message.
-    send_json_response(c, 200, "{ \"message\": \"Item deleted successfully.\" }");
+// Writes the next chunk of batch results (see conn_stream_fn).
+static int stream_batch_results(struct mg_connection *c, void *state) {
+    batch_stream_t *st = (batch_stream_t *) state;
+    json_writer_t w;
+    jw_chunk_begin(&w, c);
+    if (st->next == 0) {
+        jw_object_open(&w);
+        jw_key(&w, "results");
+        jw_array_open(&w);
+    } else {
+        w.need_comma = 1; // Continue the array of the previous chunk
+    }
+    size_t stop = st->count - st->next > ITEMS_PER_CHUNK ? st->next + ITEMS_PER_CHUNK : st->count;
+    for (; st->next < stop; st->next++) {
+        write_batch_result(&w, &st->results[st->next]);
+    }
+    int done = st->next == st->count;
+    if (done) {
+        jw_array_close(&w);
+        jw_object_close(&w);
+    }
+    if (jw_chunk_end(&w) != 0) {
+        return -1;
+    }
+    if (done) {
+        return jw_chunked_finish(c) == 0 ? 1 : -1;
+    }
+    return 0;
 }
 
+// Handles POST requests to "/api/v1/items:batch" (to apply many operations
+// in one request). The body is an array of operations such as
+// {"op":"create","name":..,"value":..}, {"op":"get","id":..},
+// {"op":"update","id":..,"name":..,"value":..} and {"op":"delete","id":..},
+// applied in order. Responds with {"results":[...]}, one result per operation
+// carrying the status it would have had as a single request (see
+// write_batch_result()), streamed ITEMS_PER_CHUNK results at a time.
+// Operations are independent: a failed one does not stop the rest.
+void handle_batch_items(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) params; // Unused
+    size_t cap = hm->body.len / BATCH_MIN_OP_BYTES + 1;
+    if (cap > ITEMS_BATCH_MAX_OPS) {
+        cap = ITEMS_BATCH_MAX_OPS;
+    }
+    item_op_t *ops = request_alloc(cap * sizeof(*ops));
+    if (ops == NULL) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the batch.");
+        return;
+    }
+    size_t count;
+    TRACE_BEGIN(parse);
+    int rc = json_read_item_ops(hm->body.p, hm->body.len, ops, cap, &count);
+    TRACE_END(parse, "parse");
+    if (rc != 0) {
+        request_free(ops);
+        send_static_response(c, rc == -2 ? RESP_BATCH_TOO_LARGE : RESP_INVALID_BATCH_BODY);
+        return;
+    }
+
+    // Everything that can fail is done before the first operation is applied,
+    // so a batch is either applied and answered, or rejected as a whole.
+    batch_stream_t *st = malloc(sizeof(*st) + count * sizeof(st->results[0]));
+    json_writer_t w;
+    if (st == NULL || jw_begin_chunked(&w, c, 200) != 0) {
+        free(st);
+        request_free(ops);
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the batch.");
+        return;
+    }
+    st->count = count;
+    st->next = 0;
+    TRACE_BEGIN(apply);
+    for (size_t i = 0; i < count; i++) {
+        run_batch_op(&ops[i], &st->results[i]);
+    }
+    TRACE_END(apply, "store");
+    request_free(ops);
+    conn_start_stream(c, stream_batch_results, st);
+}
@@ -6,27 +6,44 @@
 #define HANDLERS_H
 
 #include "mongoose.h" // Required for struct mg_connection and mg_http_message
+#include "router.h"   // For route_params_t
+
+// Initializes the item store. With a data_dir (may be NULL), the store is
+// recovered from it and every change is logged there (see persist.h).
+// Must be called once at startup, before any event loop thread starts.
+// Returns 0 on success, or -1 if the data directory cannot be used.
+int handlers_init(const char *data_dir);
+
+// Flushes the store to the data directory, if there is one. Call after the
+// event loops have stopped.
+void handlers_shutdown(void);
 
 // Declare handler functions for various API endpoints.
-// Each function takes a Mongoose connection and an HTTP message as arguments.
+// Each function takes a Mongoose connection, an HTTP message and the path
+// parameters captured by the router as arguments.
 
 // Handles GET requests to the root path "/"
-void handle_root(struct mg_connection *c, struct mg_http_message *hm);
+void handle_root(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
-// Handles GET requests to "/api/v1/items" (to retrieve all items)
-void handle_get_all_items(struct mg_connection *c, struct mg_http_message *hm);
+// Handles GET requests to "/api/v1/items" (to retrieve all items, one page at
+// a time with ?cursor=&limit=, or streamed with chunked transfer encoding)
+void handle_get_all_items(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 // Handles GET requests to "/api/v1/items/{id}" (to retrieve a single item by ID)
-void handle_get_item_by_id(struct mg_connection *c, struct mg_http_message *hm);
+void handle_get_item_by_id(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 // Handles POST requests to "/api/v1/items" (to create a new item)
-void handle_create_item(struct mg_connection *c, struct mg_http_message *hm);
+void handle_create_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 // Handles PUT requests to "/api/v1/items/{id}" (to update an existing item by ID)
-void handle_update_item(struct mg_connection *c, struct mg_http_message *hm);
+void handle_update_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 // Handles DELETE requests to "/api/v1/items/{id}" (to delete an item by ID)
-void handle_delete_item(struct mg_connection *c, struct mg_http_message *hm);
+void handle_delete_item(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+// Handles POST requests to "/api/v1/items:batch" (to create, get, update and
+// delete many items in one request, with one result per operation)
+void handle_batch_items(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 #endif // HANDLERS_H
 
@@ -0,0 +1,355 @@
+// json_reader.c
+// Implements the item body reader.
+//
+// The fast path is a pull scanner for the body shapes clients actually send:
+// one object (or, for batches, an array of objects) whose members have plain
+// strings (no escapes), integers, true, false or null as values. Whenever it meets anything else it gives up, and
+// the body is parsed with cJSON, so the accepted language and the results
+// stay exactly those of cJSON.
+
+#include "json_reader.h" // Header for reader declarations
+#include "cJSON.h"       // Fallback parser
+#include <limits.h>      // For INT_MAX, INT_MIN
+#include <string.h>      // For memcmp, memcpy, strlen
+
+// Results of the fast path.
+#define SCAN_OK 0
+#define SCAN_FALLBACK 1 // Not handled; use cJSON
+#define SCAN_TOO_MANY 2 // More operations than the caller has room for
+
+typedef struct {
+    const char *p;
+    const char *end;
+} scanner_t;
+
+static void skip_space(scanner_t *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) {
+        s->p++;
+    }
+}
+
+// Scans a string without escapes, starting at the opening quote.
+// Sets *str and *len to its contents. Returns 0, or -1 if unsupported.
+static int scan_string(scanner_t *s, const char **str, size_t *len) {
+    const char *start = ++s->p; // Skip the opening quote
+    while (s->p < s->end && *s->p != '"') {
+        unsigned char ch = (unsigned char) *s->p;
+        if (ch == '\\' || ch < 0x20) {
+            return -1; // Escapes and control characters are left to cJSON
+        }
+        s->p++;
+    }
+    if (s->p == s->end) {
+        return -1;
+    }
+    *str = start;
+    *len = (size_t) (s->p - start);
+    s->p++; // Skip the closing quote
+    return 0;
+}
+
+// Scans an integer that fits in int. Returns 0, or -1 if unsupported
+// (leading zeros, fractions, exponents, out of range).
+static int scan_int(scanner_t *s, int *out) {
+    int negative = 0;
+    if (*s->p == '-') {
+        negative = 1;
+        s->p++;
+    }
+    const char *digits = s->p;
+    long value = 0;
+    while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+        value = value * 10 + (*s->p - '0');
+        if (value > (long) INT_MAX + 1) {
+            return -1;
+        }
+        s->p++;
+    }
+    size_t n = (size_t) (s->p - digits);
+    if (n == 0 || (n > 1 && digits[0] == '0')) {
+        return -1;
+    }
+    if (s->p < s->end && (*s->p == '.' || *s->p == 'e' || *s->p == 'E')) {
+        return -1;
+    }
+    if (negative) {
+        value = -value;
+    }
+    if (value > INT_MAX || value < INT_MIN) {
+        return -1;
+    }
+    *out = (int) value;
+    return 0;
+}
+
+// Matches a literal such as "true" at the current position.
+static int scan_literal(scanner_t *s, const char *lit) {
+    size_t n = strlen(lit);
+    if ((size_t) (s->end - s->p) < n || memcmp(s->p, lit, n) != 0) {
+        return -1;
+    }
+    s->p += n;
+    return 0;
+}
+
+// Records the name, which is a string of len bytes.
+static void set_name(item_fields_t *out, const char *name, size_t len) {
+    out->has_name = 1;
+    out->name_len = len;
+    if (len < ITEM_NAME_SIZE) {
+        memcpy(out->name, name, len);
+        out->name[len] = '\0';
+    }
+}
+
+// Maps the "op" member of a batch operation to its kind.
+static item_op_kind_t op_kind(const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        item_op_kind_t kind;
+    } kinds[] = {
+        {"create", ITEM_OP_CREATE},
+        {"get", ITEM_OP_GET},
+        {"update", ITEM_OP_UPDATE},
+        {"delete", ITEM_OP_DELETE},
+    };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        if (strlen(kinds[i].name) == len && memcmp(kinds[i].name, name, len) == 0) {
+            return kinds[i].kind;
+        }
+    }
+    return ITEM_OP_INVALID;
+}
+
+// Scans one object, starting at its opening brace, into out. With op (may
+// be NULL), the "op" and "id" members of a batch operation are read too.
+static int scan_object(scanner_t *s, item_fields_t *out, item_op_t *op) {
+    int name_seen = 0;
+    int value_seen = 0;
+    int op_seen = 0;
+    int id_seen = 0;
+
+    if (s->p == s->end || *s->p != '{') {
+        return SCAN_FALLBACK;
+    }
+    s->p++;
+    skip_space(s);
+    if (s->p < s->end && *s->p == '}') {
+        s->p++;
+        return SCAN_OK;
+    }
+    for (;;) {
+        const char *key;
+        size_t key_len;
+        if (s->p == s->end || *s->p != '"' || scan_string(s, &key, &key_len) != 0) {
+            return SCAN_FALLBACK;
+        }
+        skip_space(s);
+        if (s->p == s->end || *s->p != ':') {
+            return SCAN_FALLBACK;
+        }
+        s->p++;
+        skip_space(s);
+        if (s->p == s->end) {
+            return SCAN_FALLBACK;
+        }
+
+        int is_name = !name_seen && key_len == 4 && memcmp(key, "name", 4) == 0;
+        int is_value = !value_seen && key_len == 5 && memcmp(key, "value", 5) == 0;
+        int is_op = op != NULL && !op_seen && key_len == 2 && memcmp(key, "op", 2) == 0;
+        int is_id = op != NULL && !id_seen && key_len == 2 && memcmp(key, "id", 2) == 0;
+        name_seen |= is_name;
+        value_seen |= is_value;
+        op_seen |= is_op;
+        id_seen |= is_id;
+
+        char ch = *s->p;
+        if (ch == '"') {
+            const char *str;
+            size_t str_len;
+            if (scan_string(s, &str, &str_len) != 0) {
+                return SCAN_FALLBACK;
+            }
+            if (is_name) {
+                set_name(out, str, str_len);
+            } else if (is_op) {
+                op->kind = op_kind(str, str_len);
+            }
+        } else if (ch == '-' || (ch >= '0' && ch <= '9')) {
+            int number;
+            if (scan_int(s, &number) != 0) {
+                return SCAN_FALLBACK;
+            }
+            if (is_value) {
+                out->has_value = 1;
+                out->value = number;
+            } else if (is_id) {
+                op->has_id = 1;
+                op->id = number;
+            }
+        } else if (scan_literal(s, "true") != 0 && scan_literal(s, "false") != 0 &&
+                   scan_literal(s, "null") != 0) {
+            return SCAN_FALLBACK; // Nested objects and arrays, or malformed
+        }
+
+        skip_space(s);
+        if (s->p < s->end && *s->p == ',') {
+            s->p++;
+            skip_space(s);
+            continue;
+        }
+        if (s->p < s->end && *s->p == '}') {
+            s->p++;
+            return SCAN_OK;
+        }
+        return SCAN_FALLBACK;
+    }
+}
+
+static int scan_item_fields(const char *body, size_t len, item_fields_t *out) {
+    scanner_t s = {body, body + len};
+    skip_space(&s);
+    if (scan_object(&s, out, NULL) != SCAN_OK) {
+        return SCAN_FALLBACK;
+    }
+    skip_space(&s);
+    return s.p == s.end ? SCAN_OK : SCAN_FALLBACK;
+}
+
+// Scans an array of operation objects. Sets *count, or returns
+// SCAN_TOO_MANY as soon as there are more than cap.
+static int scan_item_ops(const char *body, size_t len, item_op_t *ops, size_t cap, size_t *count) {
+    scanner_t s = {body, body + len};
+    size_t n = 0;
+
+    skip_space(&s);
+    if (s.p == s.end || *s.p != '[') {
+        return SCAN_FALLBACK;
+    }
+    s.p++;
+    skip_space(&s);
+    if (s.p < s.end && *s.p == ']') {
+        s.p++;
+    } else {
+        for (;;) {
+            if (n == cap) {
+                return SCAN_TOO_MANY;
+            }
+            item_op_t *op = &ops[n++];
+            memset(op, 0, sizeof(*op));
+            if (scan_object(&s, &op->fields, op) != SCAN_OK) {
+                return SCAN_FALLBACK;
+            }
+            skip_space(&s);
+            if (s.p < s.end && *s.p == ',') {
+                s.p++;
+                skip_space(&s);
+                continue;
+            }
+            if (s.p < s.end && *s.p == ']') {
+                s.p++;
+                break;
+            }
+            return SCAN_FALLBACK;
+        }
+    }
+    skip_space(&s);
+    if (s.p != s.end) {
+        return SCAN_FALLBACK;
+    }
+    *count = n;
+    return SCAN_OK;
+}
+
+// Reads the fields of a parsed object.
+static void read_fields(const cJSON *object, item_fields_t *out) {
+    cJSON *name_obj = cJSON_GetObjectItemCaseSensitive(object, "name");
+    cJSON *value_obj = cJSON_GetObjectItemCaseSensitive(object, "value");
+    if (cJSON_IsString(name_obj) && name_obj->valuestring != NULL) {
+        set_name(out, name_obj->valuestring, strlen(name_obj->valuestring));
+    }
+    if (cJSON_IsNumber(value_obj)) {
+        out->has_value = 1;
+        out->value = (int) cJSON_GetNumberValue(value_obj);
+    }
+}
+
+// Reads the fields with cJSON.
+static int parse_item_fields(const char *body, size_t len, item_fields_t *out) {
+    // Use ParseWithLength for safety, as the body might not be null-terminated.
+    cJSON *json_body = cJSON_ParseWithLength(body, len);
+    if (!json_body) {
+        return -1;
+    }
+    read_fields(json_body, out);
+    cJSON_Delete(json_body); // IMPORTANT: Always free parsed JSON.
+    return 0;
+}
+
+// Reads a batch operation from a parsed array element. Elements that are not
+// objects, and ids that are not integers in int range, make invalid operations.
+static void read_op(const cJSON *element, item_op_t *op) {
+    memset(op, 0, sizeof(*op));
+    if (!cJSON_IsObject(element)) {
+        return;
+    }
+    cJSON *op_obj = cJSON_GetObjectItemCaseSensitive(element, "op");
+    cJSON *id_obj = cJSON_GetObjectItemCaseSensitive(element, "id");
+    if (cJSON_IsString(op_obj) && op_obj->valuestring != NULL) {
+        op->kind = op_kind(op_obj->valuestring, strlen(op_obj->valuestring));
+    }
+    if (cJSON_IsNumber(id_obj)) {
+        double id = cJSON_GetNumberValue(id_obj);
+        if (id >= INT_MIN && id <= INT_MAX && id == (double) (int) id) {
+            op->has_id = 1;
+            op->id = (int) id;
+        }
+    }
+    read_fields(element, &op->fields);
+}
+
+// Reads the operations with cJSON.
+static int parse_item_ops(const char *body, size_t len, item_op_t *ops, size_t cap, size_t *count) {
+    cJSON *json_body = cJSON_ParseWithLength(body, len);
+    if (!json_body) {
+        return -1;
+    }
+    int rc = 0;
+    size_t n = 0;
+    if (!cJSON_IsArray(json_body)) {
+        rc = -1;
+    } else {
+        const cJSON *element;
+        cJSON_ArrayForEach(element, json_body) {
+            if (n == cap) {
+                rc = -2;
+                break;
+            }
+            read_op(element, &ops[n++]);
+        }
+    }
+    cJSON_Delete(json_body);
+    *count = n;
+    return rc;
+}
+
+int json_read_item_fields(const char *body, size_t len, item_fields_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (scan_item_fields(body, len, out) == SCAN_OK) {
+        return 0;
+    }
+    memset(out, 0, sizeof(*out)); // Discard what the scan found so far
+    return parse_item_fields(body, len, out);
+}
+
+int json_read_item_ops(const char *body, size_t len, item_op_t *ops, size_t cap, size_t *count) {
+    *count = 0;
+    int rc = scan_item_ops(body, len, ops, cap, count);
+    if (rc == SCAN_OK) {
+        return 0;
+    }
+    if (rc == SCAN_TOO_MANY) {
+        return -2;
+    }
+    return parse_item_ops(body, len, ops, cap, count);
+}
@@ -0,0 +1,54 @@
+// json_reader.h
+// Schema-specific JSON reader for item request bodies ({"name":..,"value":..})
+// and batch bodies (an array of such objects with "op" and "id" members).
+// The common case is read with a single pull scan over the body, straight
+// into item_fields_t / item_op_t, without building a DOM or allocating. Bodies the
+// scanner does not handle (escape sequences, fractions, nested values,
+// trailing data, ...) are parsed with cJSON instead, with identical results.
+
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include "store.h"  // For ITEM_NAME_SIZE
+#include <stddef.h> // For size_t
+
+// Fields of an item body. Members other than "name" and "value" are ignored;
+// if a member occurs more than once, the first occurrence counts.
+typedef struct {
+    int has_name;    // "name" is present and is a string
+    size_t name_len; // Length of name; >= ITEM_NAME_SIZE means too long
+    char name[ITEM_NAME_SIZE]; // Null-terminated; only filled in if it fits
+    int has_value;   // "value" is present and is a number
+    int value;       // Converted to int as by (int)double
+} item_fields_t;
+
+// Reads the fields of an item body of len bytes (not null-terminated).
+// Returns 0 on success, or -1 if the body is not valid JSON.
+int json_read_item_fields(const char *body, size_t len, item_fields_t *out);
+
+// Kinds of batch operations, from the "op" member.
+typedef enum {
+    ITEM_OP_INVALID, // "op" is missing, not a string, or unknown
+    ITEM_OP_CREATE,  // "create"
+    ITEM_OP_GET,     // "get"
+    ITEM_OP_UPDATE,  // "update"
+    ITEM_OP_DELETE,  // "delete"
+} item_op_kind_t;
+
+// One operation of a batch body, e.g. {"op":"update","id":7,"value":3}.
+typedef struct {
+    item_op_kind_t kind;
+    int has_id;           // "id" is present and is an integer in int range
+    int id;
+    item_fields_t fields; // "name" and "value", as in an item body
+} item_op_t;
+
+// Reads a batch body of len bytes: a JSON array of operation objects. Array
+// elements that are not objects are read as ITEM_OP_INVALID operations.
+// Sets *count to the number of operations read into ops (room for cap).
+// Returns 0 on success, -1 if the body is not valid JSON or not an array, or
+// -2 if it holds more than cap operations (possibly before the rest of the
+// body has been checked).
+int json_read_item_ops(const char *body, size_t len, item_op_t *ops, size_t cap, size_t *count);
+
+#endif // JSON_READER_H
@@ -0,0 +1,295 @@
+// json_writer.c
+// Implements the streaming JSON writer.
+//
+// The response is appended to c->send in place. Content-Length is not known
+// until the body is complete, so jw_begin() writes a blank, fixed-width
+// Content-Length value and jw_finish() fills it in; the unused part of
+// the field stays as trailing spaces, which HTTP ignores (Mongoose's own
+// mg_http_reply() uses the same technique).
+// Chunk sizes of chunked responses are backfilled the same way, as
+// fixed-width hex numbers (leading zeros are allowed in chunk sizes).
+
+#include "json_writer.h" // Header for writer declarations
+#include "mongoose.h"    // For mg_iobuf_resize
+#include <stdio.h>       // For snprintf
+#include <string.h>      // For memcpy, strlen
+
+// Width of the Content-Length placeholder; enough for any 32-bit length.
+#define LENGTH_FIELD_WIDTH 10
+
+// Width of the chunk size placeholder (hex digits).
+#define CHUNK_SIZE_WIDTH 8
+
+// Returns the reason phrase for the status codes this server sends.
+static const char *status_text(int status_code) {
+    switch (status_code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        case 507: return "Insufficient Storage";
+        default: return "OK";
+    }
+}
+
+// Returns a pointer to n writable bytes at the end of c->send, growing the
+// buffer geometrically, or NULL if memory is exhausted. The caller commits
+// what it wrote by advancing c->send.len.
+static unsigned char *reserve(json_writer_t *w, size_t n) {
+    struct mg_iobuf *io = &w->c->send;
+    if (w->failed) {
+        return NULL;
+    }
+    if (io->size - io->len < n) {
+        size_t new_size = io->size ? io->size * 2 : 1024;
+        if (new_size < io->len + n) {
+            new_size = io->len + n;
+        }
+        if (!mg_iobuf_resize(io, new_size)) {
+            w->failed = 1;
+            return NULL;
+        }
+    }
+    return io->buf + io->len;
+}
+
+// Appends len bytes.
+static void append(json_writer_t *w, const char *data, size_t len) {
+    unsigned char *dst = reserve(w, len);
+    if (dst != NULL) {
+        memcpy(dst, data, len);
+        w->c->send.len += len;
+    }
+}
+
+static void append_char(json_writer_t *w, char ch) {
+    unsigned char *dst = reserve(w, 1);
+    if (dst != NULL) {
+        *dst = (unsigned char)ch;
+        w->c->send.len++;
+    }
+}
+
+// Starts a new value: separates it from the previous one at this level.
+static void value_start(json_writer_t *w) {
+    if (w->need_comma) {
+        append_char(w, ',');
+    }
+    w->need_comma = 1;
+}
+
+void jw_begin(json_writer_t *w, struct mg_connection *c, int status_code) {
+    jw_begin_with_headers(w, c, status_code, "");
+}
+
+void jw_begin_with_headers(json_writer_t *w, struct mg_connection *c, int status_code, const char *headers) {
+    w->c = c;
+    w->response_start = c->send.len;
+    w->need_comma = 0;
+    w->failed = 0;
+    char head[160];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n" JW_RESPONSE_HEADERS, status_code, status_text(status_code));
+    append(w, head, (size_t)n);
+    append(w, headers, strlen(headers));
+    append(w, "Content-Length: ", 16);
+    w->length_pos = c->send.len;
+    append(w, "          \r\n\r\n", LENGTH_FIELD_WIDTH + 4);
+    w->body_start = c->send.len;
+}
+
+int jw_finish(json_writer_t *w) {
+    struct mg_iobuf *io = &w->c->send;
+    if (w->failed) {
+        io->len = w->response_start; // Drop the partial response
+        return -1;
+    }
+    char digits[LENGTH_FIELD_WIDTH + 1];
+    int n = snprintf(digits, sizeof(digits), "%zu", io->len - w->body_start);
+    memcpy(io->buf + w->length_pos, digits, (size_t)n);
+    return 0;
+}
+
+int jw_begin_chunked(json_writer_t *w, struct mg_connection *c, int status_code) {
+    return jw_begin_chunked_with_headers(w, c, status_code, "");
+}
+
+int jw_begin_chunked_with_headers(json_writer_t *w, struct mg_connection *c, int status_code, const char *headers) {
+    w->c = c;
+    w->response_start = c->send.len;
+    w->need_comma = 0;
+    w->failed = 0;
+    char head[160];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n" JW_RESPONSE_HEADERS, status_code, status_text(status_code));
+    append(w, head, (size_t)n);
+    append(w, headers, strlen(headers));
+    append(w, "Transfer-Encoding: chunked\r\n\r\n", 30);
+    if (w->failed) {
+        c->send.len = w->response_start;
+        return -1;
+    }
+    return 0;
+}
+
+void jw_chunk_begin(json_writer_t *w, struct mg_connection *c) {
+    w->c = c;
+    w->response_start = c->send.len;
+    w->need_comma = 0;
+    w->failed = 0;
+    w->length_pos = c->send.len;
+    append(w, "00000000\r\n", CHUNK_SIZE_WIDTH + 2);
+    w->body_start = c->send.len;
+}
+
+int jw_chunk_end(json_writer_t *w) {
+    struct mg_iobuf *io = &w->c->send;
+    if (!w->failed && io->len == w->body_start) {
+        io->len = w->response_start; // Nothing was written
+        return 0;
+    }
+    append(w, "\r\n", 2);
+    if (w->failed) {
+        io->len = w->response_start; // Drop the partial chunk
+        return -1;
+    }
+    char digits[CHUNK_SIZE_WIDTH + 1];
+    snprintf(digits, sizeof(digits), "%08zx", io->len - 2 - w->body_start);
+    memcpy(io->buf + w->length_pos, digits, CHUNK_SIZE_WIDTH);
+    return 0;
+}
+
+int jw_chunked_finish(struct mg_connection *c) {
+    json_writer_t w;
+    w.c = c;
+    w.failed = 0;
+    append(&w, "0\r\n\r\n", 5);
+    return w.failed ? -1 : 0;
+}
+
+void jw_reserve(json_writer_t *w, size_t n) {
+    reserve(w, n);
+}
+
+void jw_object_open(json_writer_t *w) {
+    value_start(w);
+    append_char(w, '{');
+    w->need_comma = 0;
+}
+
+void jw_object_close(json_writer_t *w) {
+    append_char(w, '}');
+    w->need_comma = 1;
+}
+
+void jw_array_open(json_writer_t *w) {
+    value_start(w);
+    append_char(w, '[');
+    w->need_comma = 0;
+}
+
+void jw_array_close(json_writer_t *w) {
+    append_char(w, ']');
+    w->need_comma = 1;
+}
+
+void jw_key(json_writer_t *w, const char *key) {
+    size_t len = strlen(key);
+    unsigned char *dst = reserve(w, len + 4);
+    if (dst == NULL) {
+        return;
+    }
+    size_t pos = 0;
+    if (w->need_comma) {
+        dst[pos++] = ',';
+    }
+    dst[pos++] = '"';
+    memcpy(dst + pos, key, len);
+    pos += len;
+    dst[pos++] = '"';
+    dst[pos++] = ':';
+    w->c->send.len += pos;
+    w->need_comma = 0; // The value that follows belongs to this key
+}
+
+void jw_string(json_writer_t *w, const char *s) {
+    jw_string_n(w, s, strlen(s));
+}
+
+void jw_string_n(json_writer_t *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    value_start(w);
+    // Worst case every byte becomes a 6-byte \u00XX escape.
+    unsigned char *dst = reserve(w, len * 6 + 2);
+    if (dst == NULL) {
+        return;
+    }
+    size_t pos = 0;
+    dst[pos++] = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            dst[pos++] = ch; // UTF-8 is passed through unchanged
+            continue;
+        }
+        dst[pos++] = '\\';
+        switch (ch) {
+            case '"': dst[pos++] = '"'; break;
+            case '\\': dst[pos++] = '\\'; break;
+            case '\b': dst[pos++] = 'b'; break;
+            case '\f': dst[pos++] = 'f'; break;
+            case '\n': dst[pos++] = 'n'; break;
+            case '\r': dst[pos++] = 'r'; break;
+            case '\t': dst[pos++] = 't'; break;
+            default:
+                dst[pos++] = 'u';
+                dst[pos++] = '0';
+                dst[pos++] = '0';
+                dst[pos++] = (unsigned char)hex[ch >> 4];
+                dst[pos++] = (unsigned char)hex[ch & 0xF];
+                break;
+        }
+    }
+    dst[pos++] = '"';
+    w->c->send.len += pos;
+}
+
+void jw_int(json_writer_t *w, long long value) {
+    value_start(w);
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    // Work on the magnitude as unsigned so LLONG_MIN does not overflow.
+    unsigned long long mag = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        *--p = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    append(w, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+void jw_bool(json_writer_t *w, int value) {
+    value_start(w);
+    if (value) {
+        append(w, "true", 4);
+    } else {
+        append(w, "false", 5);
+    }
+}
+
+void jw_null(json_writer_t *w) {
+    value_start(w);
+    append(w, "null", 4);
+}
+
+void jw_raw(json_writer_t *w, const char *json, size_t len) {
+    value_start(w);
+    append(w, json, len);
+}
@@ -0,0 +1,88 @@
+// json_writer.h
+// Streaming JSON writer that renders an HTTP response straight into a
+// connection's send buffer (c->send), with no intermediate tree or string.
+//
+// Usage:
+//   json_writer_t w;
+//   jw_begin(&w, c, 200);
+//   jw_object_open(&w);
+//   jw_key(&w, "id"); jw_int(&w, 42);
+//   jw_object_close(&w);
+//   if (jw_finish(&w) != 0) { ... nothing was sent, report the error ... }
+//
+// Commas between members and elements are inserted automatically.
+//
+// A body of unknown size can be streamed with chunked transfer encoding:
+// jw_begin_chunked() writes the headers, every jw_chunk_begin()/jw_chunk_end()
+// pair wraps one chunk, and jw_chunked_finish() terminates the body.
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "mongoose.h" // For struct mg_connection
+#include <stddef.h>   // For size_t
+
+// Headers sent with every JSON response.
+#define JW_RESPONSE_HEADERS "Content-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\n"
+
+typedef struct {
+    struct mg_connection *c;
+    size_t response_start; // Offset of the status line in c->send
+    size_t length_pos;     // Offset of the Content-Length placeholder
+    size_t body_start;     // Offset of the first body byte
+    int need_comma;        // A value was written at the current nesting level; may be
+                           // set after jw_chunk_begin() to continue a sequence
+                           // started in an earlier chunk
+    int failed;            // An allocation failed; jw_finish() discards the response
+} json_writer_t;
+
+// Writes the status line and headers, leaving room for Content-Length.
+void jw_begin(json_writer_t *w, struct mg_connection *c, int status_code);
+
+// Same, with additional headers: complete "Name: value\r\n" lines.
+void jw_begin_with_headers(json_writer_t *w, struct mg_connection *c, int status_code, const char *headers);
+
+// Fills in Content-Length. Returns 0 on success. If memory ran out while
+// writing, the partial response is removed from c->send and -1 is returned.
+int jw_finish(json_writer_t *w);
+
+// Writes the status line and headers of a chunked response.
+// Returns 0 on success, or -1 (with nothing written) if memory is exhausted.
+int jw_begin_chunked(json_writer_t *w, struct mg_connection *c, int status_code);
+int jw_begin_chunked_with_headers(json_writer_t *w, struct mg_connection *c, int status_code, const char *headers);
+
+// Starts a chunk of a chunked response, leaving room for its size.
+void jw_chunk_begin(json_writer_t *w, struct mg_connection *c);
+
+// Fills in the chunk size. An empty chunk is removed, as a zero-sized chunk
+// would end the body. Returns 0 on success, or -1 (with the partial chunk
+// removed) if memory ran out; the response cannot be completed after that.
+int jw_chunk_end(json_writer_t *w);
+
+// Writes the terminating zero-sized chunk. Returns 0 on success, -1 if memory is exhausted.
+int jw_chunked_finish(struct mg_connection *c);
+
+// Makes room for at least n more bytes, to avoid repeated growth of c->send
+// when the size of the response can be estimated.
+void jw_reserve(json_writer_t *w, size_t n);
+
+void jw_object_open(json_writer_t *w);
+void jw_object_close(json_writer_t *w);
+void jw_array_open(json_writer_t *w);
+void jw_array_close(json_writer_t *w);
+
+// Writes a member name. key is a null-terminated string that needs no escaping.
+void jw_key(json_writer_t *w, const char *key);
+
+// Writes an escaped string value (null-terminated, or of len bytes).
+void jw_string(json_writer_t *w, const char *s);
+void jw_string_n(json_writer_t *w, const char *s, size_t len);
+
+void jw_int(json_writer_t *w, long long value);
+void jw_bool(json_writer_t *w, int value);
+void jw_null(json_writer_t *w);
+
+// Writes len bytes of already-encoded JSON as one value.
+void jw_raw(json_writer_t *w, const char *json, size_t len);
+
+#endif // JSON_WRITER_H
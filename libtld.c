@@ -1,92 +1,165 @@
+#include "libtld.h"
+#include "psl.h" // For psl_is_tld
 #include <stddef.h>
-#include <string.h> // For strlen
+#include <stdint.h> // For uint8_t
+
+// Character classes of the domain validator; every byte value has exactly one.
+#define CC_LETTER  0x01 // a-z, A-Z
+#define CC_DIGIT   0x02 // 0-9
+#define CC_HYPHEN  0x04 // '-'
+#define CC_DOT     0x08 // '.'
+#define CC_INVALID 0x10 // Anything else
+
+// Bytes that need more than the label length check.
+#define CC_SPECIAL (CC_HYPHEN | CC_DOT | CC_INVALID)
+
+// Class of one byte value, as a constant expression.
+#define CC_OF(b) (((b) >= 'a' && (b) <= 'z') || ((b) >= 'A' && (b) <= 'Z') ? CC_LETTER \
+                  : (b) >= '0' && (b) <= '9'                              ? CC_DIGIT  \
+                  : (b) == '-'                                            ? CC_HYPHEN \
+                  : (b) == '.'                                            ? CC_DOT    \
+                                                                          : CC_INVALID)
+#define CC_ROW(b) CC_OF(b), CC_OF(b + 1), CC_OF(b + 2), CC_OF(b + 3), CC_OF(b + 4), CC_OF(b + 5), \
+                  CC_OF(b + 6), CC_OF(b + 7), CC_OF(b + 8), CC_OF(b + 9), CC_OF(b + 10), CC_OF(b + 11), \
+                  CC_OF(b + 12), CC_OF(b + 13), CC_OF(b + 14), CC_OF(b + 15)
+
+// Class of every byte value, generated by the compiler from CC_OF().
+static const uint8_t s_char_class[256] = {
+    CC_ROW(0x00), CC_ROW(0x10), CC_ROW(0x20), CC_ROW(0x30), CC_ROW(0x40), CC_ROW(0x50), CC_ROW(0x60), CC_ROW(0x70),
+    CC_ROW(0x80), CC_ROW(0x90), CC_ROW(0xa0), CC_ROW(0xb0), CC_ROW(0xc0), CC_ROW(0xd0), CC_ROW(0xe0), CC_ROW(0xf0),
+};
+
+// Records the offset that goes with a reason and returns the reason.
+static tld_reason_t reject(tld_reason_t reason, size_t at, size_t *offset) {
+    if (offset != NULL) {
+        *offset = at;
+    }
+    return reason;
+}
 
 /**
  * Validates a domain name according to RFC 1034/1035 with additional constraints:
  * - Total length: 1-253 characters (excluding trailing dot, if any)
  * - Labels: 1-63 characters, separated by dots
  * - Label characters: a-z, A-Z, 0-9, hyphen (not at start/end)
- * - TLD (last label): At least 2 characters, only letters
- * * @param domain Null-terminated domain string to validate
- * @return 1 if valid, 0 if invalid
+ * - TLD (last label): A top-level domain listed in the Public Suffix List
+ *   (IDN TLDs in A-label form, e.g. "xn--p1ai")
+ * The first rule broken is reported along with the offset it was found at.
+ * * @param domain Domain bytes to validate (need not be NUL-terminated)
+ * @param len Number of bytes in domain
+ * @param offset Receives the offset of the failure (may be NULL)
+ * @return TLD_OK if valid, otherwise the reason for rejecting it
  */
-int is_valid_domain(const char *domain) {
-    if (domain == NULL || *domain == '\0') {
-        return 0; // Null or empty domain is invalid
+tld_reason_t tld_check_domain_n(const char *domain, size_t len, size_t *offset) {
+    if (domain == NULL || len == 0) {
+        return reject(TLD_ERR_EMPTY, 0, offset); // Null or empty domain is invalid
     }
-
-    size_t total_length = 0;
-    size_t current_label_length = 0;
-    const char *p = domain;
-    const char *last_label_start = domain; // To mark the beginning of the last label
-
-    // Check for leading dot
-    if (*p == '.') {
-        return 0; 
+    if (len > TLD_MAX_DOMAIN_LEN) {
+        // Total length exceeds limit, no need to look at the bytes
+        return reject(TLD_ERR_TOO_LONG, TLD_MAX_DOMAIN_LEN, offset);
     }
 
-    while (*p != '\0') {
-        total_length++;
-        if (total_length > 253) {
-            return 0; // Total length exceeds limit
-        }
-
-        if (*p == '.') {
-            if (current_label_length == 0) {
-                return 0; // Empty label (consecutive dots or leading dot - though leading dot checked above)
+    // One pass over the bytes with one table lookup each. Letters and
+    // digits only extend the label; the other classes are rare and take the
+    // branch. prev is the class of the previous byte, and the start of the
+    // domain counts as following a dot.
+    size_t label_start = 0; // Offset of the current label
+    unsigned prev = CC_DOT;
+    for (size_t i = 0; i < len; i++) {
+        unsigned cls = s_char_class[(unsigned char)domain[i]];
+        if (cls & CC_SPECIAL) {
+            if (cls & CC_DOT) {
+                if (prev & CC_DOT) {
+                    return reject(TLD_ERR_EMPTY_LABEL, i, offset); // Leading or doubled dot
+                }
+                if (prev & CC_HYPHEN) {
+                    return reject(TLD_ERR_HYPHEN_AT_LABEL_END, i - 1, offset);
+                }
+                label_start = i + 1;
+                prev = cls;
+                continue;
             }
-            // Check for hyphen at the end of the previous label
-            if (*(p - 1) == '-') {
-                return 0; 
+            if ((cls & CC_HYPHEN) && (prev & CC_DOT)) {
+                return reject(TLD_ERR_HYPHEN_AT_LABEL_START, i, offset);
             }
-            last_label_start = p + 1; // Mark the start of the next label
-            current_label_length = 0; // Reset for new label
-        } else {
-            if (current_label_length == 0 && *p == '-') {
-                return 0; // Hyphen at label start
-            }
-            
-            // Character check
-            char c = *p;
-            int valid_char = (c >= 'a' && c <= 'z') ||
-                             (c >= 'A' && c <= 'Z') ||
-                             (c >= '0' && c <= '9') ||
-                             (c == '-');
-            if (!valid_char) {
-                return 0; // Invalid character
-            }
-
-            current_label_length++;
-            if (current_label_length > 63) {
-                return 0; // Label length exceeds limit
+            if (cls & CC_INVALID) {
+                return reject(TLD_ERR_INVALID_CHAR, i, offset);
             }
         }
-        p++;
+        if (i - label_start >= TLD_MAX_LABEL_LEN) {
+            return reject(TLD_ERR_LABEL_TOO_LONG, i, offset);
+        }
+        prev = cls;
     }
 
     // After the loop, check the last label
-    if (current_label_length == 0) {
-        return 0; // Domain ends with a dot or is just a dot
+    if (prev & CC_DOT) {
+        return reject(TLD_ERR_EMPTY_LABEL, len, offset); // Domain ends with a dot
     }
 
     // Check for hyphen at the end of the last label
-    if (*(p - 1) == '-') {
-        return 0; 
+    if (prev & CC_HYPHEN) {
+        return reject(TLD_ERR_HYPHEN_AT_LABEL_END, len - 1, offset);
     }
 
     // TLD validation (last label)
-    // Based on the constraints in the comment: at least 2 characters, only letters
-    if (current_label_length < 2) {
-        return 0; // TLD too short
+    // All TLDs in the Public Suffix List have at least 2 characters.
+    size_t tld_len = len - label_start;
+    if (tld_len < 2) {
+        return reject(TLD_ERR_TLD_TOO_SHORT, label_start, offset);
     }
 
-    // Ensure all characters in the TLD are letters
-    for (const char *ptr = last_label_start; ptr < p; ptr++) {
-        char c = *ptr;
-        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
-            return 0; // Non-letter in TLD
-        }
+    // The TLD must be known to the compiled Public Suffix List. This is the
+    // only rule for it: A-label TLDs ("xn--p1ai") hold digits and hyphens.
+    if (!psl_is_tld(domain + label_start, tld_len)) {
+        return reject(TLD_ERR_UNKNOWN_TLD, label_start, offset);
     }
 
-    return 1; // All checks passed, domain is valid
+    return reject(TLD_OK, 0, offset); // All checks passed, domain is valid
+}
+
+/**
+ * Validates a domain name given as a pointer and a length.
+ * Same rules as tld_check_domain_n(), without the reason.
+ * * @param domain Domain bytes to validate (need not be NUL-terminated)
+ * @param len Number of bytes in domain
+ * @return 1 if valid, 0 if invalid
+ */
+int is_valid_domain_n(const char *domain, size_t len) {
+    return tld_check_domain_n(domain, len, NULL) == TLD_OK;
+}
+
+/**
+ * Validates a NUL-terminated domain name. Same rules as is_valid_domain_n().
+ * Scanning for the terminator stops after TLD_MAX_DOMAIN_LEN + 1 bytes, so
+ * overlong inputs are rejected without reading them to the end.
+ * * @param domain Null-terminated domain string to validate
+ * @return 1 if valid, 0 if invalid
+ */
+int is_valid_domain(const char *domain) {
+    if (domain == NULL) {
+        return 0; // Null domain is invalid
+    }
+    size_t len = 0;
+    while (len <= TLD_MAX_DOMAIN_LEN && domain[len] != '\0') {
+        len++;
+    }
+    return is_valid_domain_n(domain, len);
+}
+
+const char *tld_reason_name(tld_reason_t reason) {
+    static const char *const names[TLD_REASON_COUNT] = {
+        [TLD_OK] = "ok",
+        [TLD_ERR_EMPTY] = "empty",
+        [TLD_ERR_TOO_LONG] = "too_long",
+        [TLD_ERR_EMPTY_LABEL] = "empty_label",
+        [TLD_ERR_LABEL_TOO_LONG] = "label_too_long",
+        [TLD_ERR_INVALID_CHAR] = "invalid_char",
+        [TLD_ERR_HYPHEN_AT_LABEL_START] = "hyphen_at_label_start",
+        [TLD_ERR_HYPHEN_AT_LABEL_END] = "hyphen_at_label_end",
+        [TLD_ERR_TLD_TOO_SHORT] = "tld_too_short",
+        [TLD_ERR_UNKNOWN_TLD] = "unknown_tld",
+        [TLD_ERR_INVALID_IDN] = "invalid_idn",
+    };
+    return (unsigned) reason < TLD_REASON_COUNT ? names[reason] : "unknown";
 }
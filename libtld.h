@@ -0,0 +1,91 @@
+// libtld.h
+// Header for the domain name validation library.
+// Declares the validators used by the API handlers and offline tools.
+
+#ifndef LIBTLD_H
+#define LIBTLD_H
+
+#include <stddef.h> // For size_t
+
+// Maximum length of a domain name (excluding the terminating NUL).
+#define TLD_MAX_DOMAIN_LEN 253
+// Maximum length of a single label.
+#define TLD_MAX_LABEL_LEN 63
+
+// Why a domain was rejected, as reported by the tld_check_domain_*() functions.
+// Each reason is reported with the byte offset it refers to.
+typedef enum {
+    TLD_OK = 0,                    // Valid
+    TLD_ERR_EMPTY,                 // NULL or empty input (offset 0)
+    TLD_ERR_TOO_LONG,              // Longer than TLD_MAX_DOMAIN_LEN (offset TLD_MAX_DOMAIN_LEN)
+    TLD_ERR_EMPTY_LABEL,           // Leading, doubled or trailing dot (offset where the label should start)
+    TLD_ERR_LABEL_TOO_LONG,        // Label longer than TLD_MAX_LABEL_LEN (offset of its first excess byte)
+    TLD_ERR_INVALID_CHAR,          // Byte other than a-z, A-Z, 0-9, '-' or '.' (offset of the byte)
+    TLD_ERR_HYPHEN_AT_LABEL_START, // Label starts with '-' (offset of the hyphen)
+    TLD_ERR_HYPHEN_AT_LABEL_END,   // Label ends with '-' (offset of the hyphen)
+    TLD_ERR_TLD_TOO_SHORT,         // Last label shorter than 2 bytes (offset of the last label)
+    TLD_ERR_UNKNOWN_TLD,           // Last label not in the Public Suffix List (offset of the last label)
+    TLD_ERR_INVALID_IDN,           // Bad UTF-8 or a disallowed code point (offset of its first byte)
+    TLD_REASON_COUNT
+} tld_reason_t;
+
+// Validates a NUL-terminated domain name.
+// Returns 1 if valid, 0 if invalid. See libtld.c for the exact rules.
+// At most TLD_MAX_DOMAIN_LEN + 1 bytes are read.
+int is_valid_domain(const char *domain);
+
+// Validates a domain name given as a pointer and a length.
+// The buffer does not need to be NUL-terminated, so this can be used directly
+// on slices of a larger buffer (e.g., an HTTP request body).
+// Lengths above TLD_MAX_DOMAIN_LEN are rejected without reading the buffer.
+// Returns 1 if valid, 0 if invalid.
+int is_valid_domain_n(const char *domain, size_t len);
+
+// Same checks as is_valid_domain_n(), in the same single pass, but returns why
+// the domain was rejected (TLD_OK if it was not). When a domain breaks several
+// rules, the reason is the first one met scanning from left to right.
+// offset: Receives the offset that goes with the reason (0 for TLD_OK). May be NULL.
+tld_reason_t tld_check_domain_n(const char *domain, size_t len, size_t *offset);
+
+// Returns a short snake_case name for a reason (e.g. "invalid_char").
+const char *tld_reason_name(tld_reason_t reason);
+
+// Vectorized equivalent of is_valid_domain_n() (see libtld_simd.c).
+// The kernel (AVX2, SSE4.2, SSE2 or NEON) is chosen once at startup from the
+// features of the running CPU. Verdicts are identical to the scalar version.
+int is_valid_domain_simd(const char *domain, size_t len);
+
+// Vectorized equivalent of tld_check_domain_n(). The reason and offset are
+// derived from the same masks as the verdict, so they cost nothing extra for
+// valid domains. Results are identical to the scalar version.
+tld_reason_t tld_check_domain_simd(const char *domain, size_t len, size_t *offset);
+
+// Longest input accepted by the IDNA functions: enough for a domain whose
+// A-label form fits in TLD_MAX_DOMAIN_LEN to be written with 4-byte UTF-8.
+#define TLD_MAX_IDN_INPUT_LEN (4 * TLD_MAX_DOMAIN_LEN)
+// Size of the output buffer of the IDNA functions (the A-label form and a NUL).
+#define TLD_ASCII_BUF_SIZE (TLD_MAX_DOMAIN_LEN + 1)
+
+// Converts a UTF-8 domain to its ASCII form (see libtld_idna.c): maps it with
+// a subset of UTS-46 and punycode-encodes every non-ASCII label as an A-label
+// ("xn--..."). ASCII labels are lowercased. The domain rules are not checked.
+// out: Receives the NUL-terminated result (TLD_ASCII_BUF_SIZE bytes).
+// Returns TLD_OK and sets *out_len. Otherwise returns TLD_ERR_INVALID_IDN or
+// a hyphen rule broken by a non-ASCII label, with an offset into the input,
+// or TLD_ERR_TOO_LONG if the result does not fit.
+tld_reason_t tld_to_ascii(const char *domain, size_t len, char *out, size_t *out_len, size_t *offset);
+
+// Same as tld_check_domain_simd(), but also accepts internationalized domains.
+// Domains that are valid as they are, or that fail before their first
+// non-ASCII byte, are decided by the vectorized check alone and never copied.
+// The rest are converted with tld_to_ascii() and checked in A-label form.
+// out: Scratch buffer of TLD_ASCII_BUF_SIZE bytes for the converted form.
+// ascii, ascii_len: Receive the form that was checked and that the offset
+//                   refers to: domain itself, or out if it was converted.
+tld_reason_t tld_check_domain_idna(const char *domain, size_t len, char *out, const char **ascii, size_t *ascii_len,
+                                   size_t *offset);
+
+// Returns the name of the kernel selected by is_valid_domain_simd() (e.g. "avx2").
+const char *tld_simd_kernel_name(void);
+
+#endif // LIBTLD_H
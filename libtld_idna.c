@@ -0,0 +1,328 @@
+// libtld_idna.c
+// Internationalized domain names: converts UTF-8 domains to their ASCII
+// (A-label) form so that the regular rules and the Public Suffix List, which
+// holds IDN TLDs as A-labels, can be applied to them.
+//
+// The mapping is the part of UTS-46 (nontransitional processing, STD3 rules)
+// that covers the bulk of real-world names: case folding for ASCII, Latin-1,
+// Latin Extended-A, Greek and Cyrillic, fullwidth ASCII, and the ideographic
+// full stops as label separators. ASCII other than letters, digits, '-' and
+// '.', C1 controls and the Latin-1 symbols are disallowed. Other code points
+// are encoded as they are; the input is expected to be in NFC already.
+//
+// ASCII input never pays for any of this: the SIMD kernels flag bytes with
+// the high bit set as invalid characters in the same pass as the other rules,
+// so only domains rejected at such a byte are converted.
+
+#include "libtld.h"
+#include <stdint.h> // For uint32_t
+#include <string.h> // For memcpy
+
+// Returned by map_code_point() for disallowed code points.
+#define IDNA_DISALLOWED 0xFFFFFFFFu
+
+// Punycode parameters (RFC 3492).
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 128
+
+// Decodes the UTF-8 sequence at s[*i], advancing *i past it. Overlong forms,
+// surrogates and values above U+10FFFF are rejected.
+// Returns 0 on success, -1 if the sequence is invalid or truncated.
+static int decode_utf8(const unsigned char *s, size_t len, size_t *i, uint32_t *cp) {
+    unsigned char c = s[*i];
+    size_t extra;
+    uint32_t value, min;
+    if (c < 0x80) {
+        *cp = c;
+        (*i)++;
+        return 0;
+    } else if ((c & 0xE0) == 0xC0) {
+        extra = 1; value = c & 0x1F; min = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        extra = 2; value = c & 0x0F; min = 0x800;
+    } else if ((c & 0xF8) == 0xF0) {
+        extra = 3; value = c & 0x07; min = 0x10000;
+    } else {
+        return -1; // Continuation byte or invalid lead byte
+    }
+    if (len - *i <= extra) {
+        return -1; // Truncated sequence
+    }
+    for (size_t j = 1; j <= extra; j++) {
+        unsigned char cc = s[*i + j];
+        if ((cc & 0xC0) != 0x80) {
+            return -1;
+        }
+        value = (value << 6) | (cc & 0x3F);
+    }
+    if (value < min || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+        return -1;
+    }
+    *cp = value;
+    *i += extra + 1;
+    return 0;
+}
+
+// Maps one code point as UTS-46 would (see the subset above). Label
+// separators map to '.'. Returns IDNA_DISALLOWED for disallowed code points.
+static uint32_t map_code_point(uint32_t cp) {
+    if (cp >= 0xFF01 && cp <= 0xFF5E) {
+        cp -= 0xFEE0; // Fullwidth ASCII
+    }
+    if (cp < 0x80) {
+        if (cp >= 'A' && cp <= 'Z') {
+            return cp + ('a' - 'A');
+        }
+        int ldh = (cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9') || cp == '-' || cp == '.';
+        return ldh ? cp : IDNA_DISALLOWED;
+    }
+    if (cp == 0x3002 || cp == 0xFF0E || cp == 0xFF61) {
+        return '.'; // Ideographic and halfwidth full stops
+    }
+    if (cp < 0xC0 || cp == 0xD7 || cp == 0xF7) {
+        return IDNA_DISALLOWED; // C1 controls and Latin-1 symbols
+    }
+    if (cp <= 0xDE) {
+        return cp + 0x20; // Latin-1 capitals
+    }
+    if (cp <= 0xFF) {
+        return cp; // Latin-1 small letters (U+00DF is kept, as in nontransitional processing)
+    }
+    if (cp <= 0x17F) {
+        // Latin Extended-A: capital and small letters alternate, with the
+        // parity flipping at U+0139 and U+014A. These four map to more than
+        // one code point and are not supported.
+        if (cp == 0x130 || cp == 0x13F || cp == 0x140 || cp == 0x149) {
+            return IDNA_DISALLOWED;
+        }
+        if (cp == 0x178) {
+            return 0xFF; // Y with diaeresis
+        }
+        if (cp == 0x17F) {
+            return 's'; // Long s
+        }
+        int capital_is_odd = (cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E);
+        if (cp == 0x131 || cp == 0x138) {
+            return cp; // Dotless i and kra have no capital in the pairing
+        }
+        return ((cp & 1) == (uint32_t)capital_is_odd) ? cp + 1 : cp;
+    }
+    if (cp >= 0x386 && cp <= 0x3AB) {
+        // Greek capitals.
+        if (cp == 0x386) return 0x3AC;
+        if (cp >= 0x388 && cp <= 0x38A) return cp + 0x25;
+        if (cp == 0x38C) return 0x3CC;
+        if (cp == 0x38E || cp == 0x38F) return cp + 0x3F;
+        if (cp == 0x390) return cp; // Small letter
+        if (cp >= 0x391 && cp != 0x3A2) return cp + 0x20;
+        return IDNA_DISALLOWED; // U+0387 (a symbol) and the unassigned U+038B, U+038D, U+03A2
+    }
+    if (cp >= 0x400 && cp <= 0x40F) {
+        return cp + 0x50; // Cyrillic capitals with diacritics
+    }
+    if (cp >= 0x410 && cp <= 0x42F) {
+        return cp + 0x20; // Basic Cyrillic capitals
+    }
+    if ((cp & 0xFFFE) == 0xFFFE) {
+        return IDNA_DISALLOWED; // Noncharacters
+    }
+    return cp;
+}
+
+static char puny_digit(uint32_t d) {
+    return (char)(d < 26 ? 'a' + d : '0' + (d - 26));
+}
+
+static uint32_t puny_adapt(uint32_t delta, uint32_t num_points, int first) {
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / num_points;
+    uint32_t k = 0;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+// Appends the A-label of n mapped code points to out at *o. out has room for
+// TLD_MAX_DOMAIN_LEN bytes. Returns 0 on success, -1 if it does not fit.
+static int encode_label(const uint32_t *cps, size_t n, char *out, size_t *o) {
+    size_t pos = *o;
+    size_t basic = 0;
+    int has_non_ascii = 0;
+    for (size_t i = 0; i < n; i++) {
+        has_non_ascii |= cps[i] >= 0x80;
+    }
+    if (has_non_ascii) {
+        if (pos + 4 > TLD_MAX_DOMAIN_LEN) return -1;
+        memcpy(out + pos, "xn--", 4);
+        pos += 4;
+    }
+    // Basic code points are copied first.
+    for (size_t i = 0; i < n; i++) {
+        if (cps[i] < 0x80) {
+            if (pos == TLD_MAX_DOMAIN_LEN) return -1;
+            out[pos++] = (char)cps[i];
+            basic++;
+        }
+    }
+    if (has_non_ascii) {
+        if (basic > 0) {
+            if (pos == TLD_MAX_DOMAIN_LEN) return -1;
+            out[pos++] = '-';
+        }
+        // Labels are at most TLD_MAX_IDN_INPUT_LEN code points, so delta stays
+        // far below 2^32 (at most 0x10FFFF times the label length).
+        uint32_t cur = PUNY_INITIAL_N, delta = 0, bias = PUNY_INITIAL_BIAS;
+        size_t handled = basic;
+        while (handled < n) {
+            uint32_t m = 0xFFFFFFFFu;
+            for (size_t i = 0; i < n; i++) {
+                if (cps[i] >= cur && cps[i] < m) m = cps[i];
+            }
+            delta += (m - cur) * (uint32_t)(handled + 1);
+            cur = m;
+            for (size_t i = 0; i < n; i++) {
+                if (cps[i] < cur) delta++;
+                if (cps[i] == cur) {
+                    uint32_t q = delta;
+                    for (uint32_t k = PUNY_BASE;; k += PUNY_BASE) {
+                        uint32_t t = k <= bias ? PUNY_TMIN : (k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias);
+                        if (q < t) break;
+                        if (pos == TLD_MAX_DOMAIN_LEN) return -1;
+                        out[pos++] = puny_digit(t + (q - t) % (PUNY_BASE - t));
+                        q = (q - t) / (PUNY_BASE - t);
+                    }
+                    if (pos == TLD_MAX_DOMAIN_LEN) return -1;
+                    out[pos++] = puny_digit(q);
+                    bias = puny_adapt(delta, (uint32_t)(handled + 1), handled == basic);
+                    delta = 0;
+                    handled++;
+                }
+            }
+            delta++;
+            cur++;
+        }
+    }
+    *o = pos;
+    return 0;
+}
+
+tld_reason_t tld_to_ascii(const char *domain, size_t len, char *out, size_t *out_len, size_t *offset) {
+    size_t unused;
+    if (offset == NULL) {
+        offset = &unused;
+    }
+    *offset = 0;
+    if (domain == NULL || len == 0) {
+        return TLD_ERR_EMPTY;
+    }
+    if (len > TLD_MAX_IDN_INPUT_LEN) {
+        *offset = TLD_MAX_IDN_INPUT_LEN;
+        return TLD_ERR_TOO_LONG;
+    }
+
+    const unsigned char *s = (const unsigned char *)domain;
+    uint32_t cps[TLD_MAX_IDN_INPUT_LEN]; // Mapped code points of the current label
+    size_t n = 0;
+    size_t label_start = 0; // Input offsets of the current label and of its last code point
+    size_t last_start = 0;
+    int non_ascii = 0;
+    size_t o = 0;
+    size_t i = 0;
+    for (;;) {
+        uint32_t cp = '.'; // The end of the input closes the last label
+        size_t start = i;
+        if (i < len) {
+            if (decode_utf8(s, len, &i, &cp) != 0 || (cp = map_code_point(cp)) == IDNA_DISALLOWED) {
+                *offset = start;
+                return TLD_ERR_INVALID_IDN;
+            }
+        }
+        if (cp != '.') {
+            if (n == 0) {
+                label_start = start;
+            }
+            last_start = start;
+            non_ascii |= cp >= 0x80;
+            cps[n++] = cp;
+            continue;
+        }
+        // The hyphen rules apply to the Unicode form: "xn--" would hide a
+        // leading hyphen, and the encoded digits a trailing one. ASCII labels
+        // are checked after the conversion along with everything else.
+        if (non_ascii && cps[0] == '-') {
+            *offset = label_start;
+            return TLD_ERR_HYPHEN_AT_LABEL_START;
+        }
+        if (non_ascii && cps[n - 1] == '-') {
+            *offset = last_start;
+            return TLD_ERR_HYPHEN_AT_LABEL_END;
+        }
+        non_ascii = 0;
+        if (encode_label(cps, n, out, &o) != 0) {
+            *offset = TLD_MAX_DOMAIN_LEN;
+            return TLD_ERR_TOO_LONG;
+        }
+        n = 0;
+        if (i == len) {
+            break;
+        }
+        if (o == TLD_MAX_DOMAIN_LEN) {
+            *offset = TLD_MAX_DOMAIN_LEN;
+            return TLD_ERR_TOO_LONG;
+        }
+        out[o++] = '.';
+    }
+    out[o] = '\0';
+    *out_len = o;
+    return TLD_OK;
+}
+
+// Returns 1 if the verdict of the ASCII check could change once the domain is
+// converted: it failed at a byte with the high bit set, or was too long as it
+// is but may be short enough in A-label form.
+static int needs_conversion(const char *domain, size_t len, tld_reason_t reason, size_t offset) {
+    if (reason == TLD_ERR_INVALID_CHAR) {
+        return (unsigned char)domain[offset] >= 0x80;
+    }
+    if (reason == TLD_ERR_TOO_LONG && len <= TLD_MAX_IDN_INPUT_LEN) {
+        for (size_t i = 0; i < len; i++) {
+            if ((unsigned char)domain[i] >= 0x80) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+tld_reason_t tld_check_domain_idna(const char *domain, size_t len, char *out, const char **ascii, size_t *ascii_len,
+                                   size_t *offset) {
+    size_t unused;
+    if (offset == NULL) {
+        offset = &unused;
+    }
+    *ascii = domain;
+    *ascii_len = len;
+
+    // Everything before the first non-ASCII byte has passed the rules already,
+    // so any earlier failure stands as it is.
+    tld_reason_t reason = tld_check_domain_simd(domain, len, offset);
+    if (reason == TLD_OK || !needs_conversion(domain, len, reason, *offset)) {
+        return reason;
+    }
+
+    size_t out_len;
+    reason = tld_to_ascii(domain, len, out, &out_len, offset);
+    if (reason != TLD_OK) {
+        return reason;
+    }
+    *ascii = out;
+    *ascii_len = out_len;
+    return tld_check_domain_simd(out, out_len, offset);
+}
@@ -0,0 +1,315 @@
+// libtld_simd.c
+// Vectorized domain validation kernels with runtime CPU dispatch.
+// Each kernel classifies 16 or 32 bytes at a time into bitmasks
+// (valid character, dot, hyphen); the label rules are then checked on those
+// masks with bit operations instead of a per-byte loop. The TLD is looked up
+// in the compiled Public Suffix List, as in the scalar version.
+// Verdicts, rejection reasons and offsets are identical to
+// tld_check_domain_n() in libtld.c.
+
+#include "libtld.h"
+#include "psl.h"    // For psl_is_tld
+#include <stdint.h> // For uint64_t, uint32_t
+#include <string.h> // For memcpy
+
+#if defined(__x86_64__)
+#include <immintrin.h> // SSE2/SSE4.2/AVX2 intrinsics
+#define TLD_SIMD_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>  // NEON intrinsics
+#define TLD_SIMD_NEON 1
+#endif
+
+// The masks cover the maximum domain length, rounded up to whole 64-bit words.
+#define MASK_WORDS 4
+
+// Per-byte classification of a domain, one bit per byte position.
+typedef struct {
+    uint64_t valid[MASK_WORDS];  // a-z, A-Z, 0-9, '-' or '.'
+    uint64_t dot[MASK_WORDS];    // '.'
+    uint64_t hyphen[MASK_WORDS]; // '-'
+} class_masks_t;
+
+// Kernels return the reason and store its offset (offset is never NULL).
+typedef tld_reason_t (*domain_kernel_fn)(const char *domain, size_t len, size_t *offset);
+
+// Stores a 16- or 32-bit block mask at bit position pos (a multiple of the block size).
+static inline void put_bits(uint64_t *words, size_t pos, uint64_t bits) {
+    words[pos / 64] |= bits << (pos % 64);
+}
+
+static inline int test_bit(const uint64_t *words, size_t pos) {
+    return (int)((words[pos / 64] >> (pos % 64)) & 1);
+}
+
+// Applies the label rules to the classified masks. len is in [1, 253].
+// Reports the same reason and offset as tld_check_domain_n(), i.e. the first
+// rule the scalar loop would stop on. Each per-byte rule gets a mask of the
+// positions where it fails, and the lowest set bit over all of them is where
+// the loop would have stopped, unless a label grew too long before that.
+// offset must not be NULL.
+static tld_reason_t reason_from_masks(const class_masks_t *m, const char *domain, size_t len, size_t *offset) {
+    uint64_t in_range[MASK_WORDS];
+    for (size_t i = 0; i < MASK_WORDS; i++) {
+        size_t lo = i * 64;
+        if (len >= lo + 64) {
+            in_range[i] = ~(uint64_t)0;
+        } else if (len > lo) {
+            in_range[i] = ((uint64_t)1 << (len - lo)) - 1;
+        } else {
+            in_range[i] = 0;
+        }
+    }
+
+    // First position failing a per-byte rule (len if none does). A position
+    // can fail at most one of them.
+    size_t first = len;
+    tld_reason_t reason = TLD_OK;
+    for (size_t i = 0; i < MASK_WORDS; i++) {
+        // The shifts carry across words; position 0 counts as following a dot.
+        uint64_t dot_before = (m->dot[i] << 1) | (i > 0 ? m->dot[i - 1] >> 63 : 1);
+        uint64_t hyphen_before = (m->hyphen[i] << 1) | (i > 0 ? m->hyphen[i - 1] >> 63 : 0);
+        uint64_t invalid = ~m->valid[i] & in_range[i];
+        uint64_t hyphen_start = m->hyphen[i] & dot_before;
+        uint64_t empty_label = m->dot[i] & dot_before;   // Leading or doubled dot
+        uint64_t hyphen_end = m->dot[i] & hyphen_before; // Found at the dot that follows it
+        uint64_t any = invalid | hyphen_start | empty_label | hyphen_end;
+        if (any != 0) {
+            uint64_t bit = any & (~any + 1); // Lowest set bit
+            first = i * 64 + (size_t)__builtin_ctzll(any);
+            reason = (bit & invalid) ? TLD_ERR_INVALID_CHAR
+                   : (bit & hyphen_start) ? TLD_ERR_HYPHEN_AT_LABEL_START
+                   : (bit & empty_label) ? TLD_ERR_EMPTY_LABEL
+                   : TLD_ERR_HYPHEN_AT_LABEL_END;
+            break;
+        }
+    }
+
+    // Label lengths are the gaps between consecutive dots before that
+    // position. None is empty, as empty labels were found above.
+    long prev_dot = -1;
+    for (size_t i = 0; i < MASK_WORDS && i * 64 < first; i++) {
+        uint64_t dots = m->dot[i];
+        if (first < i * 64 + 64) {
+            dots &= ((uint64_t)1 << (first - i * 64)) - 1;
+        }
+        while (dots != 0) {
+            long pos = (long)(i * 64) + __builtin_ctzll(dots);
+            if (pos - prev_dot - 1 > TLD_MAX_LABEL_LEN) {
+                *offset = (size_t)(prev_dot + 1) + TLD_MAX_LABEL_LEN;
+                return TLD_ERR_LABEL_TOO_LONG;
+            }
+            prev_dot = pos;
+            dots &= dots - 1; // Clear the lowest set bit
+        }
+    }
+    size_t label_start = (size_t)(prev_dot + 1);
+    if (first - label_start > TLD_MAX_LABEL_LEN) {
+        *offset = label_start + TLD_MAX_LABEL_LEN; // The scalar loop's count overflows here
+        return TLD_ERR_LABEL_TOO_LONG;
+    }
+    if (reason != TLD_OK) {
+        *offset = reason == TLD_ERR_HYPHEN_AT_LABEL_END ? first - 1 : first;
+        return reason;
+    }
+
+    // The last label is the TLD: 2-63 bytes and known to the suffix list.
+    size_t tld_len = len - label_start;
+    if (tld_len == 0) {
+        *offset = len; // Trailing dot
+        return TLD_ERR_EMPTY_LABEL;
+    }
+    if (test_bit(m->hyphen, len - 1)) {
+        *offset = len - 1;
+        return TLD_ERR_HYPHEN_AT_LABEL_END;
+    }
+    *offset = label_start;
+    if (tld_len < 2) {
+        return TLD_ERR_TLD_TOO_SHORT;
+    }
+    if (!psl_is_tld(domain + label_start, tld_len)) {
+        return TLD_ERR_UNKNOWN_TLD;
+    }
+    *offset = 0;
+    return TLD_OK;
+}
+
+#if defined(TLD_SIMD_X86)
+
+// Computes the dot and hyphen masks of 16 bytes with SSE2 compares.
+static inline void classify_sse2(__m128i v, __m128i *is_dot, __m128i *is_hyphen) {
+    *is_dot = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+    *is_hyphen = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+}
+
+// Loads the 16-byte block at pos, copying the final partial block into tail
+// so that no load reads past the end of the input.
+static inline __m128i load_block16(const char *domain, size_t len, size_t pos, char tail[16]) {
+    if (len - pos >= 16) {
+        return _mm_loadu_si128((const __m128i *)(domain + pos));
+    }
+    memset(tail, 0, 16);
+    memcpy(tail, domain + pos, len - pos);
+    return _mm_loadu_si128((const __m128i *)tail);
+}
+
+static tld_reason_t kernel_sse2(const char *domain, size_t len, size_t *offset) {
+    class_masks_t m = {{0}, {0}, {0}};
+    char tail[16];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        __m128i v = load_block16(domain, len, pos, tail);
+        __m128i is_dot, is_hyphen;
+        classify_sse2(v, &is_dot, &is_hyphen);
+        // Bytes >= 0x80 are negative as signed chars and fall outside every range.
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                          _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                         _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        __m128i is_valid = _mm_or_si128(_mm_or_si128(is_letter, is_digit), _mm_or_si128(is_dot, is_hyphen));
+        put_bits(m.valid, pos, (uint32_t)_mm_movemask_epi8(is_valid));
+        put_bits(m.dot, pos, (uint32_t)_mm_movemask_epi8(is_dot));
+        put_bits(m.hyphen, pos, (uint32_t)_mm_movemask_epi8(is_hyphen));
+    }
+    return reason_from_masks(&m, domain, len, offset);
+}
+
+// Same as kernel_sse2(), but the valid-character mask comes from a single
+// PCMPESTRM range match instead of four compares.
+__attribute__((target("sse4.2")))
+static tld_reason_t kernel_sse42(const char *domain, size_t len, size_t *offset) {
+    // Range pairs: a-z, A-Z, 0-9 and '-'..'.' (exactly 0x2D and 0x2E).
+    const __m128i ranges = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9', '-', '.', 0, 0, 0, 0, 0, 0, 0, 0);
+    class_masks_t m = {{0}, {0}, {0}};
+    char tail[16];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        __m128i v = load_block16(domain, len, pos, tail);
+        __m128i is_dot, is_hyphen;
+        classify_sse2(v, &is_dot, &is_hyphen);
+        __m128i valid = _mm_cmpestrm(ranges, 8, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_BIT_MASK);
+        put_bits(m.valid, pos, (uint32_t)_mm_cvtsi128_si32(valid));
+        put_bits(m.dot, pos, (uint32_t)_mm_movemask_epi8(is_dot));
+        put_bits(m.hyphen, pos, (uint32_t)_mm_movemask_epi8(is_hyphen));
+    }
+    return reason_from_masks(&m, domain, len, offset);
+}
+
+__attribute__((target("avx2")))
+static tld_reason_t kernel_avx2(const char *domain, size_t len, size_t *offset) {
+    class_masks_t m = {{0}, {0}, {0}};
+    char tail[32];
+
+    for (size_t pos = 0; pos < len; pos += 32) {
+        __m256i v;
+        if (len - pos >= 32) {
+            v = _mm256_loadu_si256((const __m256i *)(domain + pos));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, domain + pos, len - pos);
+            v = _mm256_loadu_si256((const __m256i *)tail);
+        }
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                            _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i is_dot = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'));
+        __m256i is_hyphen = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'));
+        __m256i is_valid = _mm256_or_si256(_mm256_or_si256(is_letter, is_digit),
+                                           _mm256_or_si256(is_dot, is_hyphen));
+        put_bits(m.valid, pos, (uint32_t)_mm256_movemask_epi8(is_valid));
+        put_bits(m.dot, pos, (uint32_t)_mm256_movemask_epi8(is_dot));
+        put_bits(m.hyphen, pos, (uint32_t)_mm256_movemask_epi8(is_hyphen));
+    }
+    return reason_from_masks(&m, domain, len, offset);
+}
+
+#elif defined(TLD_SIMD_NEON)
+
+// NEON has no movemask; weight each lane by its bit and add across halves.
+static inline uint32_t movemask_neon(uint8x16_t v) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(v, vld1q_u8(weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+static tld_reason_t kernel_neon(const char *domain, size_t len, size_t *offset) {
+    class_masks_t m = {{0}, {0}, {0}};
+    uint8_t tail[16];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        uint8x16_t v;
+        if (len - pos >= 16) {
+            v = vld1q_u8((const uint8_t *)domain + pos);
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, domain + pos, len - pos);
+            v = vld1q_u8(tail);
+        }
+        // Unsigned range checks via wrapping subtraction: (x - lo) <= (hi - lo).
+        uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+        uint8x16_t is_letter = vcleq_u8(vsubq_u8(lower, vdupq_n_u8('a')), vdupq_n_u8('z' - 'a'));
+        uint8x16_t is_digit = vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8('9' - '0'));
+        uint8x16_t is_dot = vceqq_u8(v, vdupq_n_u8('.'));
+        uint8x16_t is_hyphen = vceqq_u8(v, vdupq_n_u8('-'));
+        uint8x16_t is_valid = vorrq_u8(vorrq_u8(is_letter, is_digit), vorrq_u8(is_dot, is_hyphen));
+        put_bits(m.valid, pos, movemask_neon(is_valid));
+        put_bits(m.dot, pos, movemask_neon(is_dot));
+        put_bits(m.hyphen, pos, movemask_neon(is_hyphen));
+    }
+    return reason_from_masks(&m, domain, len, offset);
+}
+
+#endif
+
+// Kernel selected at startup, see select_kernel().
+static domain_kernel_fn selected_kernel = tld_check_domain_n;
+static const char *selected_kernel_name = "scalar";
+
+// Picks the widest kernel the running CPU supports. Runs once at load time,
+// before main(), so the pointer is never written while other threads read it.
+__attribute__((constructor))
+static void select_kernel(void) {
+#if defined(TLD_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        selected_kernel = kernel_avx2;
+        selected_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        selected_kernel = kernel_sse42;
+        selected_kernel_name = "sse4.2";
+    } else {
+        selected_kernel = kernel_sse2; // SSE2 is part of the x86-64 baseline
+        selected_kernel_name = "sse2";
+    }
+#elif defined(TLD_SIMD_NEON)
+    selected_kernel = kernel_neon; // NEON is mandatory on AArch64
+    selected_kernel_name = "neon";
+#endif
+}
+
+tld_reason_t tld_check_domain_simd(const char *domain, size_t len, size_t *offset) {
+    size_t unused;
+    if (offset == NULL) {
+        offset = &unused;
+    }
+    if (domain == NULL || len == 0) {
+        *offset = 0;
+        return TLD_ERR_EMPTY;
+    }
+    if (len > TLD_MAX_DOMAIN_LEN) {
+        *offset = TLD_MAX_DOMAIN_LEN;
+        return TLD_ERR_TOO_LONG;
+    }
+    return selected_kernel(domain, len, offset);
+}
+
+int is_valid_domain_simd(const char *domain, size_t len) {
+    return tld_check_domain_simd(domain, len, NULL) == TLD_OK;
+}
+
+const char *tld_simd_kernel_name(void) {
+    return selected_kernel_name;
+}
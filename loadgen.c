@@ -0,0 +1,456 @@
+// loadgen.c
+// Closed-loop HTTP/1.1 load generator for the API server.
+// Usage: loadgen [-c connections] [-d seconds] [-w warmup_seconds] [-X method]
+//                [-b body] [-H header] http://host:port/path
+//
+// Every connection runs on its own thread and keeps one request in flight:
+// send, read the whole response (Content-Length or chunked), record the
+// latency, repeat. Connections are kept alive and reopened if the server
+// closes them. Latencies of the warmup period are discarded; the rest are
+// kept in full, so the reported percentiles are exact.
+
+#define _POSIX_C_SOURCE 200809L // For getaddrinfo, clock_gettime, strncasecmp
+
+#include <errno.h>       // For errno
+#include <netdb.h>       // For getaddrinfo
+#include <netinet/in.h>  // For IPPROTO_TCP
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <pthread.h>     // For one thread per connection
+#include <stdint.h>      // For uint64_t
+#include <stdio.h>       // For printf, snprintf
+#include <stdlib.h>      // For malloc, realloc, free, qsort, strtol
+#include <string.h>      // For memcpy, memmove, strlen, strchr, strncmp
+#include <strings.h>     // For strncasecmp
+#include <sys/socket.h>  // For socket, connect, send, recv
+#include <time.h>        // For clock_gettime, nanosleep
+#include <unistd.h>      // For close
+
+#define MAX_CONNECTIONS 1024
+#define RECV_BUF_SIZE (64 * 1024)
+#define MAX_REQUEST_SIZE (1024 * 1024)
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *request; // Full request text, sent as is
+    size_t request_len;
+    uint64_t warmup_end_ns;
+    uint64_t end_ns;
+} config_t;
+
+// Results of one connection's thread.
+typedef struct {
+    pthread_t thread;
+    const config_t *config;
+    uint64_t *latencies_ns; // Samples recorded after the warmup
+    size_t count;
+    size_t cap;
+    uint64_t errors;        // Connection failures and malformed responses
+    uint64_t non_2xx;
+    uint64_t bytes_in;
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_to(const config_t *cfg) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(cfg->host, cfg->port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int send_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Receive buffer of one connection. Headers and chunk size lines must fit in
+// it; bodies are skipped as they arrive.
+typedef struct {
+    char data[RECV_BUF_SIZE];
+    size_t len;
+} recv_buf_t;
+
+// Reads more bytes. Returns 0 on success, -1 on error or EOF.
+static int fill(int fd, recv_buf_t *b) {
+    if (b->len == sizeof(b->data)) {
+        return -1; // Headers or a chunk line do not fit
+    }
+    for (;;) {
+        ssize_t n = recv(fd, b->data + b->len, sizeof(b->data) - b->len, 0);
+        if (n > 0) {
+            b->len += (size_t)n;
+            return 0;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+// Drops the first n bytes of the buffer.
+static void consume(recv_buf_t *b, size_t n) {
+    memmove(b->data, b->data + n, b->len - n);
+    b->len -= n;
+}
+
+// Returns the offset just past the first "\r\n" at or after from, or 0.
+static size_t find_crlf(const recv_buf_t *b, size_t from) {
+    for (size_t i = from; i + 1 < b->len; i++) {
+        if (b->data[i] == '\r' && b->data[i + 1] == '\n') {
+            return i + 2;
+        }
+    }
+    return 0;
+}
+
+// Skips len body bytes, reading as needed.
+static int skip_body(int fd, recv_buf_t *b, size_t len) {
+    while (len > 0) {
+        if (b->len == 0 && fill(fd, b) != 0) {
+            return -1;
+        }
+        size_t n = b->len < len ? b->len : len;
+        consume(b, n);
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads one response. Returns its status code, or -1 on error.
+// *keep_alive is cleared if the server asked to close the connection.
+static int read_response(int fd, recv_buf_t *b, uint64_t *bytes_in, int *keep_alive) {
+    // Headers: everything up to the first empty line.
+    size_t line = 0;
+    size_t end;
+    while ((end = find_crlf(b, line)) != 0 || fill(fd, b) == 0) {
+        if (end == 0) {
+            continue;
+        }
+        if (end - line == 2) {
+            break; // Empty line
+        }
+        line = end;
+    }
+    if (end == 0 || b->len < 12 || strncmp(b->data, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+    int status = atoi(b->data + 9);
+    long long content_length = -1;
+    int chunked = 0;
+    for (size_t p = find_crlf(b, 0); p + 2 < end; p = find_crlf(b, p)) {
+        const char *h = b->data + p;
+        if (strncasecmp(h, "Content-Length:", 15) == 0) {
+            content_length = atoll(h + 15);
+        } else if (strncasecmp(h, "Transfer-Encoding: chunked", 26) == 0) {
+            chunked = 1;
+        } else if (strncasecmp(h, "Connection: close", 17) == 0) {
+            *keep_alive = 0;
+        }
+    }
+    *bytes_in += end;
+    consume(b, end);
+
+    if (chunked) {
+        for (;;) {
+            size_t eol;
+            while ((eol = find_crlf(b, 0)) == 0) {
+                if (fill(fd, b) != 0) {
+                    return -1;
+                }
+            }
+            size_t size = (size_t)strtoul(b->data, NULL, 16);
+            consume(b, eol);
+            if (skip_body(fd, b, size + 2) != 0) { // Data and its CRLF
+                return -1;
+            }
+            *bytes_in += eol + size + 2;
+            if (size == 0) {
+                break; // The last chunk's "CRLF" was the empty trailer line
+            }
+        }
+    } else if (content_length > 0) {
+        if (skip_body(fd, b, (size_t)content_length) != 0) {
+            return -1;
+        }
+        *bytes_in += (uint64_t)content_length;
+    }
+    return status;
+}
+
+static int record(worker_t *w, uint64_t latency_ns) {
+    if (w->count == w->cap) {
+        size_t new_cap = w->cap ? w->cap * 2 : 65536;
+        uint64_t *p = realloc(w->latencies_ns, new_cap * sizeof(*p));
+        if (p == NULL) {
+            return -1;
+        }
+        w->latencies_ns = p;
+        w->cap = new_cap;
+    }
+    w->latencies_ns[w->count++] = latency_ns;
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    const config_t *cfg = w->config;
+    recv_buf_t *b = malloc(sizeof(*b));
+    if (b == NULL) {
+        w->errors++;
+        return NULL;
+    }
+    int fd = -1;
+    while (now_ns() < cfg->end_ns) {
+        if (fd < 0) {
+            fd = connect_to(cfg);
+            b->len = 0;
+            if (fd < 0) {
+                w->errors++;
+                struct timespec pause = {0, 10 * 1000000}; // Do not spin on a dead server
+                nanosleep(&pause, NULL);
+                continue;
+            }
+        }
+        int keep_alive = 1;
+        uint64_t start = now_ns();
+        int status = -1;
+        if (send_all(fd, cfg->request, cfg->request_len) == 0) {
+            status = read_response(fd, b, &w->bytes_in, &keep_alive);
+        }
+        uint64_t done = now_ns();
+        if (status < 0) {
+            w->errors++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (done >= cfg->end_ns) {
+            break;
+        }
+        if (start >= cfg->warmup_end_ns) {
+            if (status < 200 || status > 299) {
+                w->non_2xx++;
+            }
+            if (record(w, done - start) != 0) {
+                w->errors++;
+                break;
+            }
+        }
+        if (!keep_alive) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(b);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples, in microseconds.
+static double percentile_us(const uint64_t *sorted, size_t n, double p) {
+    size_t rank = (size_t)(p / 100.0 * (double)n + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > n) {
+        rank = n;
+    }
+    return (double)sorted[rank - 1] / 1000.0;
+}
+
+// Splits http://host[:port]/path. Returns 0 on success.
+static int parse_url(const char *url, char *host, size_t host_size, char *port, size_t port_size, const char **path) {
+    if (strncmp(url, "http://", 7) != 0) {
+        return -1;
+    }
+    const char *h = url + 7;
+    const char *slash = strchr(h, '/');
+    *path = slash ? slash : "/";
+    size_t hp_len = slash ? (size_t)(slash - h) : strlen(h);
+    const char *colon = memchr(h, ':', hp_len);
+    size_t host_len = colon ? (size_t)(colon - h) : hp_len;
+    size_t port_len = colon ? hp_len - host_len - 1 : 2;
+    if (host_len == 0 || host_len >= host_size || port_len == 0 || port_len >= port_size) {
+        return -1;
+    }
+    memcpy(host, h, host_len);
+    host[host_len] = '\0';
+    if (colon) {
+        memcpy(port, colon + 1, port_len);
+        port[port_len] = '\0';
+    } else {
+        memcpy(port, "80", 3);
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c connections] [-d seconds] [-w warmup_seconds] [-X method] [-b body] [-H header] url\n"
+            "  url is http://host:port/path; -H may be given several times.\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    long connections = 16, duration = 10, warmup = 1;
+    const char *method = "GET", *body = NULL, *url = NULL;
+    const char *headers[16];
+    int num_headers = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            connections = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            duration = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            warmup = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-X") == 0 && i + 1 < argc) {
+            method = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            body = argv[++i];
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc && num_headers < 16) {
+            headers[num_headers++] = argv[++i];
+        } else if (argv[i][0] != '-' && url == NULL) {
+            url = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    char host[256], port[16];
+    const char *path;
+    if (url == NULL || parse_url(url, host, sizeof(host), port, sizeof(port), &path) != 0 || connections < 1 ||
+        connections > MAX_CONNECTIONS || duration < 1 || warmup < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The request is rendered once and sent as is on every iteration.
+    char *request = malloc(MAX_REQUEST_SIZE);
+    if (request == NULL) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    size_t body_len = body ? strlen(body) : 0;
+    int n = snprintf(request, MAX_REQUEST_SIZE, "%s %s HTTP/1.1\r\nHost: %s:%s\r\n", method, path, host, port);
+    for (int i = 0; i < num_headers && n > 0 && n < MAX_REQUEST_SIZE; i++) {
+        n += snprintf(request + n, MAX_REQUEST_SIZE - (size_t)n, "%s\r\n", headers[i]);
+    }
+    if (n > 0 && n < MAX_REQUEST_SIZE && body != NULL) {
+        n += snprintf(request + n, MAX_REQUEST_SIZE - (size_t)n, "Content-Length: %zu\r\n", body_len);
+    }
+    if (n > 0 && n < MAX_REQUEST_SIZE) {
+        n += snprintf(request + n, MAX_REQUEST_SIZE - (size_t)n, "\r\n%s", body ? body : "");
+    }
+    if (n < 0 || n >= MAX_REQUEST_SIZE) {
+        fprintf(stderr, "loadgen: request too large\n");
+        free(request);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = now_ns();
+    config_t cfg = {host, port, request, (size_t)n, start + (uint64_t)warmup * 1000000000u,
+                    start + (uint64_t)(warmup + duration) * 1000000000u};
+    worker_t *workers = calloc((size_t)connections, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        free(request);
+        return EXIT_FAILURE;
+    }
+    long started = 0;
+    for (; started < connections; started++) {
+        workers[started].config = &cfg;
+        if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) {
+            fprintf(stderr, "loadgen: could only start %ld connections\n", started);
+            break;
+        }
+    }
+    for (long i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // Merge and sort every sample for exact percentiles.
+    size_t total = 0;
+    uint64_t errors = 0, non_2xx = 0, bytes_in = 0;
+    for (long i = 0; i < started; i++) {
+        total += workers[i].count;
+        errors += workers[i].errors;
+        non_2xx += workers[i].non_2xx;
+        bytes_in += workers[i].bytes_in;
+    }
+    uint64_t *all = malloc((total ? total : 1) * sizeof(*all));
+    int rc = EXIT_SUCCESS;
+    if (all == NULL) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        rc = EXIT_FAILURE;
+    } else {
+        size_t k = 0;
+        for (long i = 0; i < started; i++) {
+            memcpy(all + k, workers[i].latencies_ns, workers[i].count * sizeof(*all));
+            k += workers[i].count;
+        }
+        qsort(all, total, sizeof(*all), compare_u64);
+
+        printf("%s %s: %ld connections, %ld s (+%ld s warmup)\n", method, url, started, duration, warmup);
+        printf("requests:   %zu (%llu non-2xx, %llu errors)\n", total, (unsigned long long)non_2xx,
+               (unsigned long long)errors);
+        printf("throughput: %.0f req/s, %.2f MB/s received\n", (double)total / (double)duration,
+               (double)bytes_in / (double)(warmup + duration) / 1e6);
+        if (total > 0) {
+            printf("latency:    p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+                   percentile_us(all, total, 50.0), percentile_us(all, total, 99.0), percentile_us(all, total, 99.9),
+                   (double)all[total - 1] / 1000.0);
+        } else {
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    free(all);
+    for (long i = 0; i < started; i++) {
+        free(workers[i].latencies_ns);
+    }
+    free(workers);
+    free(request);
+    return rc;
+}
@@ -0,0 +1,249 @@
+// log.c
+// Implements the asynchronous log.
+//
+// The ring buffer is a bounded multi-producer queue in the style of Dmitry
+// Vyukov's: every slot carries a sequence number that tells producers when
+// it is free and the consumer when it is filled. Producers claim a slot with
+// one compare-and-swap on the enqueue position; the single consumer (the
+// writer thread) needs no atomic read-modify-write at all.
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime, nanosleep, gmtime_r
+
+#include "log.h"       // Header for log declarations
+#include <pthread.h>   // For the writer thread
+#include <stdarg.h>    // For va_list
+#include <stdatomic.h> // For the ring buffer positions and counters
+#include <stdio.h>     // For vsnprintf, fwrite
+#include <string.h>    // For strcmp
+#include <time.h>      // For clock_gettime, nanosleep, gmtime_r, strftime
+
+// Number of ring slots (a power of two) and the size of one entry.
+#define LOG_RING_SLOTS 4096
+#define LOG_LINE_MAX 256
+
+// Longest URI written to the access log.
+#define LOG_URI_MAX 128
+
+// How long the writer sleeps when the ring is empty.
+#define LOG_IDLE_SLEEP_NS (5 * 1000 * 1000)
+
+typedef struct {
+    atomic_size_t seq;   // == position: free; == position + 1: filled
+    uint64_t time_ns;    // Wall clock time of the call
+    log_level_t level;
+    unsigned short len;
+    char text[LOG_LINE_MAX];
+} log_slot_t;
+
+static log_slot_t s_ring[LOG_RING_SLOTS];
+static atomic_size_t s_enqueue_pos;
+static size_t s_dequeue_pos; // Writer thread only
+
+static atomic_int s_level = LOG_INFO;
+static atomic_uint s_sample_rate = 1;
+static atomic_uint_fast64_t s_dropped;
+static atomic_int s_running;   // The writer thread consumes the ring
+static atomic_int s_stopping;
+static pthread_t s_thread;
+
+// Per-thread counter for access log sampling.
+static _Thread_local unsigned s_sample_counter;
+
+static const char *const s_level_names[] = {"debug", "info", "warn", "error"};
+
+void log_set_level(log_level_t level) {
+    atomic_store(&s_level, (int) level);
+}
+
+void log_set_sample_rate(unsigned n) {
+    atomic_store(&s_sample_rate, n ? n : 1);
+}
+
+int log_parse_level(const char *name, log_level_t *level) {
+    for (int i = 0; i <= (int) LOG_ERROR; i++) {
+        if (strcmp(name, s_level_names[i]) == 0) {
+            *level = (log_level_t) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint64_t log_dropped(void) {
+    return atomic_load_explicit(&s_dropped, memory_order_relaxed);
+}
+
+static int enabled(log_level_t level) {
+    return (int) level >= atomic_load_explicit(&s_level, memory_order_relaxed);
+}
+
+static uint64_t wall_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Formats "2026-01-31T12:34:56.789Z level=info " into buf.
+static size_t format_prefix(char *buf, size_t size, uint64_t time_ns, log_level_t level) {
+    time_t secs = (time_t) (time_ns / 1000000000u);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    size_t n = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    n += (size_t) snprintf(buf + n, size - n, ".%03uZ level=%s ", (unsigned) (time_ns / 1000000u % 1000u),
+                           s_level_names[level]);
+    return n;
+}
+
+// Writes one entry synchronously; used while the writer thread is not running.
+static void write_direct(uint64_t time_ns, log_level_t level, const char *text, size_t len) {
+    char prefix[64];
+    size_t n = format_prefix(prefix, sizeof(prefix), time_ns, level);
+    fprintf(stderr, "%.*s%.*s\n", (int) n, prefix, (int) len, text);
+}
+
+// Claims a free slot, or returns NULL (and counts a drop) if the ring is full.
+static log_slot_t *claim_slot(size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&s_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        log_slot_t *slot = &s_ring[pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&s_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if (dif < 0) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return NULL; // Full: the writer has not caught up
+        } else {
+            pos = atomic_load_explicit(&s_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Formats an entry into the ring (or writes it directly without a writer).
+static void log_vqueue(log_level_t level, const char *fmt, va_list ap) {
+    uint64_t now = wall_clock_ns();
+    if (!atomic_load_explicit(&s_running, memory_order_acquire)) {
+        char text[LOG_LINE_MAX];
+        int n = vsnprintf(text, sizeof(text), fmt, ap);
+        if (n >= 0) {
+            write_direct(now, level, text, (size_t) n < sizeof(text) ? (size_t) n : sizeof(text) - 1);
+        }
+        return;
+    }
+    size_t pos;
+    log_slot_t *slot = claim_slot(&pos);
+    if (slot == NULL) {
+        return;
+    }
+    int n = vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    if (n < 0) {
+        n = 0;
+    }
+    slot->len = (unsigned short) ((size_t) n < sizeof(slot->text) ? (size_t) n : sizeof(slot->text) - 1);
+    slot->time_ns = now;
+    slot->level = level;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release); // Publish
+}
+
+static void log_queue(log_level_t level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vqueue(level, fmt, ap);
+    va_end(ap);
+}
+
+void log_message(log_level_t level, const char *fmt, ...) {
+    if (!enabled(level)) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    log_vqueue(level, fmt, ap);
+    va_end(ap);
+}
+
+void log_access(struct mg_str method, struct mg_str uri, int status, size_t bytes_out, uint64_t duration_us) {
+    if (!enabled(LOG_INFO)) {
+        return;
+    }
+    unsigned rate = atomic_load_explicit(&s_sample_rate, memory_order_relaxed);
+    if (rate > 1 && s_sample_counter++ % rate != 0) {
+        return;
+    }
+    // The method and URI are slices of the request buffer, not strings.
+    int uri_len = uri.len > LOG_URI_MAX ? LOG_URI_MAX : (int) uri.len;
+    log_queue(LOG_INFO, "method=%.*s path=%.*s status=%d bytes_out=%zu duration_us=%llu",
+              (int) method.len, method.p, uri_len, uri.p, status, bytes_out, (unsigned long long) duration_us);
+}
+
+// Moves every filled slot into the stdout buffer. Returns the number written.
+static size_t drain_ring(void) {
+    size_t count = 0;
+    for (;;) {
+        log_slot_t *slot = &s_ring[s_dequeue_pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != s_dequeue_pos + 1) {
+            return count; // Empty (or the next slot is still being filled)
+        }
+        char prefix[64];
+        size_t n = format_prefix(prefix, sizeof(prefix), slot->time_ns, slot->level);
+        fwrite(prefix, 1, n, stdout);
+        fwrite(slot->text, 1, slot->len, stdout);
+        fputc('\n', stdout);
+        // Hand the slot back to producers for the next lap.
+        atomic_store_explicit(&slot->seq, s_dequeue_pos + LOG_RING_SLOTS, memory_order_release);
+        s_dequeue_pos++;
+        count++;
+    }
+}
+
+static void *writer_thread(void *arg) {
+    (void) arg;
+    uint64_t reported_drops = 0;
+    for (;;) {
+        int stopping = atomic_load_explicit(&s_stopping, memory_order_acquire);
+        size_t written = drain_ring();
+        uint64_t drops = log_dropped();
+        if (drops != reported_drops) {
+            char prefix[64];
+            fwrite(prefix, 1, format_prefix(prefix, sizeof(prefix), wall_clock_ns(), LOG_WARN), stdout);
+            fprintf(stdout, "msg=\"log entries dropped\" dropped=%llu\n", (unsigned long long) (drops - reported_drops));
+            reported_drops = drops;
+        }
+        if (written == 0) {
+            fflush(stdout);
+            if (stopping) {
+                return NULL; // Everything queued before log_stop() is out
+            }
+            struct timespec idle = {0, LOG_IDLE_SLEEP_NS};
+            nanosleep(&idle, NULL);
+        }
+    }
+}
+
+int log_start(void) {
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) {
+        atomic_init(&s_ring[i].seq, i);
+    }
+    atomic_store(&s_enqueue_pos, 0);
+    s_dequeue_pos = 0;
+    atomic_store(&s_stopping, 0);
+    if (pthread_create(&s_thread, NULL, writer_thread, NULL) != 0) {
+        return -1;
+    }
+    atomic_store_explicit(&s_running, 1, memory_order_release);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_load(&s_running)) {
+        return;
+    }
+    atomic_store_explicit(&s_stopping, 1, memory_order_release);
+    pthread_join(s_thread, NULL);
+    atomic_store(&s_running, 0);
+}
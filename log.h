@@ -0,0 +1,52 @@
+// log.h
+// Asynchronous logging. Log calls format their entry into a slot of a
+// lock-free ring buffer and return; a background thread writes the entries
+// to stdout. A full ring drops entries (and counts them) instead of
+// blocking, so logging never stalls an event loop, even when stdout is a
+// slow pipe.
+
+#ifndef LOG_H
+#define LOG_H
+
+#include "mongoose.h" // For struct mg_str
+#include <stddef.h>   // For size_t
+#include <stdint.h>   // For uint64_t
+
+// Severity levels; entries below the configured level are discarded early.
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO, // Access log entries
+    LOG_WARN,
+    LOG_ERROR,
+} log_level_t;
+
+// Sets the minimum level that is logged (default LOG_INFO).
+void log_set_level(log_level_t level);
+
+// Logs one in every n access log entries (default 1, every request).
+void log_set_sample_rate(unsigned n);
+
+// Parses "debug", "info", "warn" or "error". Returns 0 on success, -1 otherwise.
+int log_parse_level(const char *name, log_level_t *level);
+
+// Starts the writer thread. Until it runs (or if it cannot be started),
+// entries are written directly to stderr. Returns 0 on success, -1 on failure.
+int log_start(void);
+
+// Writes out every queued entry and stops the writer thread.
+void log_stop(void);
+
+// Queues a printf-style message.
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void log_message(log_level_t level, const char *fmt, ...);
+
+// Queues an access log entry (subject to sampling).
+// bytes_out is what the handler queued; duration_us is the handler's run time.
+void log_access(struct mg_str method, struct mg_str uri, int status, size_t bytes_out, uint64_t duration_us);
+
+// Returns the number of entries dropped because the ring buffer was full.
+uint64_t log_dropped(void);
+
+#endif // LOG_H
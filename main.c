@@ -1,83 +1,464 @@
 // main.c
 // Entry point for the Mongoose-based API server.
 // Initializes the server, sets up signal handling, and starts the event loop.
+//
+// By default a single event loop runs on the main thread. With --workers N,
+// N threads each run their own event manager with their own listening socket
+// bound to the same port with SO_REUSEPORT, so the kernel spreads incoming
+// connections across the loops (and cores).
+//
+// Each loop is driven by evloop (see evloop.h): it sleeps until its next
+// timer is due or an event arrives, the signal handler wakes it at once, and
+// with --busy-poll it keeps polling briefly after activity instead of sleeping.
+
+#define _DEFAULT_SOURCE // For pthreads and SO_REUSEPORT
 
 #include "mongoose.h" // Mongoose networking library
 #include "router.h"   // Custom routing logic header
 #include "handlers.h" // Custom request handlers header (used indirectly via router)
+#include "domain_handlers.h" // For domain_handlers_set_pool
+#include "batch.h"    // Worker pool for bulk domain validation
+#include "vcache.h"   // Verdict cache for single-domain lookups
+#include "conn.h"     // Per-connection state and response streaming
+#include "utils.h"    // For static_responses_init
+#include "arena.h"    // Request arena of each event loop
+#include "cJSON.h"    // For cJSON_InitHooks
+#include "log.h"      // Asynchronous access and error log
+#include "metrics.h"  // Per-thread request metrics
+#include "qsbr.h"     // Reclamation for the lock-free item store
+#include "evloop.h"   // Timers, wakeups and adaptive polling of each loop
+#include "trace.h"    // Sampled request tracing
 #include <signal.h>   // For signal handling (SIGINT, SIGTERM)
 #include <stdio.h>    // For fprintf (standard input/output)
-#include <stdlib.h>   // For EXIT_FAILURE, EXIT_SUCCESS
+#include <stdlib.h>   // For EXIT_FAILURE, EXIT_SUCCESS, strtol
+#include <string.h>   // For strcmp
+#include <pthread.h>  // For event loop threads
+#include <stdatomic.h> // For the stop flag shared by event loops
+#include <fcntl.h>    // For fcntl (non-blocking listener)
+#include <unistd.h>   // For close
+#include <netinet/in.h> // For struct sockaddr_in
+#include <sys/socket.h> // For socket, setsockopt, bind, listen
+
+// Address the server listens on.
+#define LISTEN_PORT 8000
+#define LISTEN_URL "http://0.0.0.0:8000"
+
+// Upper bound for --workers.
+#define MAX_WORKERS 256
+
+// How long a shutting-down event loop keeps flushing responses before it
+// closes the remaining connections.
+#define DRAIN_TIMEOUT_MS 5000
+
+// Threads that validate large domain batches off the event loops.
+#define OFFLOAD_THREADS 2
+
+// How often each loop checks its connections' idle timeouts and buffers.
+#define CONN_SWEEP_MS 250
+
+// Upper bound for --busy-poll, in microseconds.
+#define MAX_BUSY_POLL_US 1000000
+
+// Memory budget of the domain verdict cache (per event loop).
+#define VERDICT_CACHE_BYTES (4u * 1024 * 1024)
 
-// Global event manager context for Mongoose.
-// This structure manages all network connections and events.
-static struct mg_mgr mgr;
 // Volatile signal atomic variable to safely handle signals across threads/contexts.
 // Initialized to 0, changed by signal_handler to indicate a signal was caught.
 static volatile sig_atomic_t s_signo;
 
+// Set when an event loop fails to start, so the others shut down too.
+static atomic_int s_stop;
+
+// One event loop: its thread, listener and per-loop state.
+typedef struct {
+    int index;
+    int use_reuseport; // 1 when several loops share the port
+    unsigned busy_poll_us; // Spin this long after activity before sleeping
+    pthread_t thread;
+    vcache_t *cache;
+} event_loop_t;
+
 // Signal handler function.
 // Catches termination signals (e.g., Ctrl+C, system shutdown) to allow
 // for graceful server shutdown.
 static void signal_handler(int signo) {
     s_signo = signo; // Store the signal number
+    evloop_wake_all(); // End every loop's current poll, so shutdown starts at once
+}
+
+// Asks every event loop to stop (after one of them failed to start).
+static void stop_all_loops(void) {
+    atomic_store(&s_stop, 1);
+    evloop_wake_all();
 }
 
 // Mongoose event handler function.
 // This function is called by Mongoose for various events on connected clients.
 static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data) {
-    // Check if the event is an incoming HTTP message.
-    if (ev == MG_EV_HTTP_MSG) {
+    if (ev == MG_EV_ACCEPT || ev == MG_EV_READ) {
+        evloop_note_activity(); // Keeps a busy-polling loop spinning
+    }
+    if (ev == MG_EV_ACCEPT) {
+        // Attach per-connection state to every new client connection.
+        if (conn_open(c) != 0) {
+            log_message(LOG_ERROR, "msg=\"failed to allocate connection state, closing connection\"");
+            c->is_closing = 1;
+        }
+    } else if (ev == MG_EV_READ) {
+        // Called before the HTTP protocol handler parses the new data, so a
+        // request that is growing too large is refused before it is buffered.
+        conn_touch(c);
+        conn_check_receive(c);
+    } else if (ev == MG_EV_HTTP_MSG) {
         // Cast event data to mg_http_message structure, which contains
         // details about the HTTP request (method, URI, headers, body).
         struct mg_http_message *hm = (struct mg_http_message *) ev_data;
-        // Dispatch the HTTP request to our custom router.
-        router_dispatch(c, hm);
+        // A pipelined request may arrive while a response is still being
+        // streamed; that response has to be completed first.
+        conn_finish_stream(c);
+        // Dispatch the HTTP request to our custom router, unless it was
+        // pipelined after the connection's last request.
+        if (conn_begin_request(c, hm) == 0) {
+            router_dispatch(c, hm);
+            conn_end_request(c);
+        }
+        // Everything the request allocated from the loop's arena is released at once.
+        arena_reset(arena_current());
+    } else if (ev == MG_EV_WRITE) {
+        // Refill the send buffer of a streamed response as it drains.
+        conn_touch(c);
+        conn_continue_stream(c);
+    } else if (ev == MG_EV_POLL) {
+        conn_continue_stream(c);
+    } else if (ev == MG_EV_CLOSE) {
+        conn_close(c);
     } else if (ev == MG_EV_ERROR) {
         // Log Mongoose internal errors to standard error.
-        fprintf(stderr, "Mongoose error on connection %p: %s\n", (void *) c->fd, (char *) ev_data);
+        log_message(LOG_ERROR, "msg=\"mongoose error\" conn=%lu error=\"%s\"", c->id, (char *) ev_data);
     }
-    (void) fn_data; // Explicitly cast to void to suppress unused parameter warning.
+    (void) fn_data; // Per-connection state, accessed through conn_get().
 }
 
-int main(void) {
-    // 1. Register signal handlers for graceful shutdown.
-    // SIGINT: Interrupt signal (e.g., Ctrl+C from terminal).
-    // SIGTERM: Termination signal (e.g., from `kill` command or system shutdown).
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+// Creates an HTTP listener on LISTEN_PORT whose socket has SO_REUSEPORT set.
+// Mongoose does not set SO_REUSEPORT on the sockets it creates, so the socket
+// is opened here and swapped into a listener that mg_http_listen() created on
+// an ephemeral loopback port (which installs the HTTP protocol handler).
+static struct mg_connection *listen_reuseport(struct mg_mgr *mgr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    int on = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(LISTEN_PORT);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+        bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct mg_connection *c = mg_http_listen(mgr, "http://127.0.0.1:0", fn, NULL);
+    if (c == NULL) {
+        close(fd);
+        return NULL;
+    }
+    close((int) (size_t) c->fd);
+    c->fd = (void *) (size_t) fd;
+    return c;
+}
+
+// Checks the idle timeouts and buffers of a loop's connections (a timer).
+static void sweep_connections(void *arg) {
+    struct mg_mgr *mgr = (struct mg_mgr *) arg;
+    for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) {
+        conn_poll(c);
+    }
+}
 
-    // 2. Initialize Mongoose event manager.
-    // This sets up the internal structures needed for network operations.
+// Stops accepting, lets every connection flush what it has queued, and waits
+// (up to DRAIN_TIMEOUT_MS) for the connections to close.
+static void drain_connections(struct mg_mgr *mgr, evloop_t *ev) {
+    for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) {
+        if (c->is_listening) {
+            c->is_closing = 1; // Stop accepting new connections
+        } else {
+            conn_drain(c); // Close once the send buffer (and any stream) is flushed
+        }
+    }
+    uint64_t deadline = mg_millis() + DRAIN_TIMEOUT_MS;
+    while (mgr->conns != NULL && mg_millis() < deadline) {
+        evloop_poll(ev); // Also delivers the responses of offloaded requests
+    }
+}
+
+// Runs one event loop until a termination signal is caught.
+static void *run_event_loop(void *arg) {
+    event_loop_t *loop = (event_loop_t *) arg;
+
+    // Each loop owns its event manager, verdict cache, request arena and metrics;
+    // nothing in them is touched by other threads.
+    struct mg_mgr mgr;
     mg_mgr_init(&mgr);
+    domain_handlers_set_cache(loop->cache);
+    arena_t arena;
+    arena_init(&arena);
+    arena_set_current(&arena);
+    if (metrics_register_thread() != 0) {
+        log_message(LOG_WARN, "msg=\"failed to allocate metrics, requests on this event loop are not counted\" loop=%d", loop->index);
+    }
+    if (trace_register_thread() != 0) {
+        log_message(LOG_WARN, "msg=\"failed to allocate the trace ring, requests on this event loop are not traced\" loop=%d", loop->index);
+    }
+    // Store reads are lock-free; the loop has to announce when it holds no
+    // references into the store, so replaced arrays can be freed.
+    if (qsbr_register() != 0) {
+        fprintf(stderr, "Error: Failed to register event loop %d as a store reader.\n", loop->index);
+        stop_all_loops();
+        mg_mgr_free(&mgr);
+        arena_set_current(NULL);
+        arena_free(&arena);
+        return NULL;
+    }
 
-    // 3. Add an HTTP listener.
-    // This creates a listening socket on the specified address and port (0.0.0.0:8000).
-    // `fn` is the callback function that will handle incoming events on this listener.
-    // The last argument (NULL) is user data, which is passed to `fn_data` in the callback.
-    fprintf(stdout, "Starting API server on http://localhost:8000\n");
-    fprintf(stdout, "To exit, press Ctrl+C\n");
-    struct mg_connection *c = mg_http_listen(&mgr, "http://0.0.0.0:8000", fn, NULL);
+    // Timers and wakeups of this loop; sleeps only as long as nothing is due.
+    evloop_t ev;
+    if (evloop_init(&ev, &mgr, loop->busy_poll_us) != 0) {
+        fprintf(stderr, "Error: Failed to set up event loop %d.\n", loop->index);
+        stop_all_loops();
+        qsbr_unregister();
+        mg_mgr_free(&mgr);
+        arena_set_current(NULL);
+        arena_free(&arena);
+        return NULL;
+    }
+    evloop_add_timer(&ev, CONN_SWEEP_MS, sweep_connections, &mgr);
+
+    struct mg_connection *c = loop->use_reuseport ? listen_reuseport(&mgr)
+                                                  : mg_http_listen(&mgr, LISTEN_URL, fn, NULL);
     if (c == NULL) {
-        // If listening fails (e.g., port already in use, permissions issue), print error and exit.
-        fprintf(stderr, "Error: Cannot start listener. Is port 8000 already in use or do you lack permissions?\n");
-        return EXIT_FAILURE;
+        // If listening fails (e.g., port already in use, permissions issue), print error and stop.
+        fprintf(stderr, "Error: Cannot start listener. Is port %d already in use or do you lack permissions?\n", LISTEN_PORT);
+        stop_all_loops();
+        evloop_free(&ev);
+        qsbr_unregister();
+        mg_mgr_free(&mgr);
+        arena_set_current(NULL);
+        arena_free(&arena);
+        return NULL;
     }
 
-    // 4. Main event loop.
     // This loop continuously polls Mongoose for network events.
-    // It runs as long as no termination signal has been caught (s_signo remains 0).
-    while (s_signo == 0) {
-        mg_mgr_poll(&mgr, 500); // Poll for events, waiting up to 500ms if no events.
-                                // A smaller timeout or 0 would make it more CPU-intensive
-                                // but more reactive if a lot of events are expected.
+    // It runs as long as no termination signal has been caught (s_signo remains 0);
+    // the signal handler wakes every loop, so shutdown does not wait for a poll timeout.
+    while (s_signo == 0 && !atomic_load_explicit(&s_stop, memory_order_relaxed)) {
+        evloop_poll(&ev);  // Sleeps until the next timer, an event or a wakeup
+        qsbr_quiescent();  // Between iterations no handler holds store references.
     }
 
-    // 5. Clean up Mongoose resources on exit.
-    // This frees memory and closes open sockets managed by Mongoose.
+    // Clean up Mongoose resources on exit.
+    // This flushes pending responses, then frees memory and closes open sockets.
+    drain_connections(&mgr, &ev);
+    evloop_free(&ev); // Waits for offloaded requests of this loop
     mg_mgr_free(&mgr);
-    fprintf(stdout, "Server gracefully shut down.\n");
+    qsbr_unregister();
+    arena_set_current(NULL);
+    arena_free(&arena);
+    return NULL;
+}
 
-    return EXIT_SUCCESS; // Indicate successful program termination.
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--workers N] [--data-dir DIR] [--idle-timeout MS] [--max-requests N]\n"
+                    "          [--busy-poll US] [--log-level LEVEL] [--log-sample N] [--trace-sample N]\n"
+                    "  --workers N        run N event loops sharing port %d (default: 1)\n"
+                    "  --data-dir DIR     keep items in DIR across restarts (default: in memory only)\n"
+                    "  --idle-timeout MS  close connections idle for MS milliseconds, 0 never (default: %d)\n"
+                    "  --max-requests N   close connections after N requests, 0 never (default: %d)\n"
+                    "  --busy-poll US     keep polling without sleeping for US microseconds after\n"
+                    "                     network activity, 0 off (default: 0)\n"
+                    "  --log-level LEVEL  debug, info, warn or error (default: info; info logs every request)\n"
+                    "  --log-sample N     write one in N access log entries (default: 1)\n"
+                    "  --trace-sample N   trace one in N requests, see /api/v1/admin/trace, 0 off (default: 0)\n",
+            prog, LISTEN_PORT, CONN_DEFAULT_IDLE_TIMEOUT_MS, CONN_DEFAULT_MAX_REQUESTS);
 }
 
+int main(int argc, char *argv[]) {
+    // 1. Parse command-line options.
+    long num_loops = 1;
+    const char *data_dir = NULL;
+    long idle_timeout_ms = CONN_DEFAULT_IDLE_TIMEOUT_MS;
+    long max_requests = CONN_DEFAULT_MAX_REQUESTS;
+    long busy_poll_us = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--workers") == 0 || strcmp(argv[i], "-w") == 0) && i + 1 < argc) {
+            char *endptr;
+            num_loops = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || num_loops < 1 || num_loops > MAX_WORKERS) {
+                fprintf(stderr, "Error: --workers must be between 1 and %d.\n", MAX_WORKERS);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            char *endptr;
+            idle_timeout_ms = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || idle_timeout_ms < 0 || idle_timeout_ms > 86400000) {
+                fprintf(stderr, "Error: --idle-timeout must be between 0 and 86400000.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--max-requests") == 0 && i + 1 < argc) {
+            char *endptr;
+            max_requests = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || max_requests < 0 || max_requests > 100000000) {
+                fprintf(stderr, "Error: --max-requests must be between 0 and 100000000.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            char *endptr;
+            busy_poll_us = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || busy_poll_us < 0 || busy_poll_us > MAX_BUSY_POLL_US) {
+                fprintf(stderr, "Error: --busy-poll must be between 0 and %d.\n", MAX_BUSY_POLL_US);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            log_level_t level;
+            if (log_parse_level(argv[++i], &level) != 0) {
+                fprintf(stderr, "Error: --log-level must be debug, info, warn or error.\n");
+                return EXIT_FAILURE;
+            }
+            log_set_level(level);
+        } else if (strcmp(argv[i], "--log-sample") == 0 && i + 1 < argc) {
+            char *endptr;
+            long rate = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || rate < 1 || rate > 1000000) {
+                fprintf(stderr, "Error: --log-sample must be between 1 and 1000000.\n");
+                return EXIT_FAILURE;
+            }
+            log_set_sample_rate((unsigned) rate);
+        } else if (strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc) {
+            char *endptr;
+            long rate = strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || rate < 0 || rate > 1000000) {
+                fprintf(stderr, "Error: --trace-sample must be between 0 and 1000000.\n");
+                return EXIT_FAILURE;
+            }
+            trace_set_sample((unsigned) rate);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Start the log writer, so event loops never write to stdout themselves.
+    if (log_start() != 0) {
+        fprintf(stderr, "Warning: Failed to start the log writer thread. Logging will be synchronous.\n");
+    }
+
+    // 2. Register signal handlers for graceful shutdown.
+    // SIGINT: Interrupt signal (e.g., Ctrl+C from terminal).
+    // SIGTERM: Termination signal (e.g., from `kill` command or system shutdown).
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // 3. Start the worker pool used to validate large domain batches.
+    // One thread per CPU; the event loop thread takes part in every batch too.
+    // If the pool cannot be created, batches are validated on the event loop thread.
+    worker_pool_t *pool = worker_pool_create(0);
+    if (pool == NULL) {
+        fprintf(stderr, "Warning: Failed to start worker pool. Bulk validation will be single-threaded.\n");
+    }
+    domain_handlers_set_pool(pool);
+    // Large batches are handed to these threads (which use the pool in turn),
+    // so they do not stall the other connections of their event loop.
+    task_queue_t *offload = task_queue_create(OFFLOAD_THREADS);
+    if (offload == NULL) {
+        fprintf(stderr, "Warning: Failed to start offload threads. Large batches will block their event loop.\n");
+    }
+    domain_handlers_set_offload(offload);
+
+    // 4. Initialize shared state before any event loop starts.
+    // Compile the route table. An invalid table is a programming error.
+    // cJSON allocates from the request arena of the calling event loop.
+    cJSON_Hooks hooks = {request_alloc, request_free};
+    cJSON_InitHooks(&hooks);
+    // The item store is recovered from --data-dir before anything can change it.
+    if (handlers_init(data_dir) != 0) {
+        fprintf(stderr, "Error: Failed to recover the item store from %s.\n", data_dir);
+        task_queue_destroy(offload);
+        worker_pool_destroy(pool);
+        log_stop();
+        return EXIT_FAILURE;
+    }
+    if (static_responses_init() != 0) {
+        fprintf(stderr, "Warning: Failed to pre-render static responses. They will be built per request.\n");
+    }
+    conn_set_limits((unsigned) idle_timeout_ms, (unsigned) max_requests);
+    if (router_init() != 0) {
+        handlers_shutdown();
+        task_queue_destroy(offload);
+        worker_pool_destroy(pool);
+        log_stop();
+        return EXIT_FAILURE;
+    }
+
+    event_loop_t loops[MAX_WORKERS];
+    for (long i = 0; i < num_loops; i++) {
+        loops[i].index = (int) i;
+        loops[i].use_reuseport = num_loops > 1;
+        loops[i].busy_poll_us = (unsigned) busy_poll_us;
+        // The verdict cache is optional: without it every lookup is computed.
+        loops[i].cache = vcache_create(VERDICT_CACHE_BYTES);
+        if (loops[i].cache == NULL) {
+            fprintf(stderr, "Warning: Failed to allocate the domain verdict cache. Lookups will not be cached.\n");
+        }
+    }
+
+    // 5. Run the event loops.
+    fprintf(stdout, "Starting API server on http://localhost:%d with %ld event loop(s)\n", LISTEN_PORT, num_loops);
+    fprintf(stdout, "To exit, press Ctrl+C\n");
+    int status = EXIT_SUCCESS;
+    if (num_loops == 1) {
+        run_event_loop(&loops[0]);
+    } else {
+        long started = 0;
+        for (; started < num_loops; started++) {
+            if (pthread_create(&loops[started].thread, NULL, run_event_loop, &loops[started]) != 0) {
+                fprintf(stderr, "Error: Failed to start event loop thread %ld.\n", started);
+                stop_all_loops();
+                break;
+            }
+        }
+        for (long i = 0; i < started; i++) {
+            pthread_join(loops[i].thread, NULL);
+        }
+    }
+    if (atomic_load(&s_stop)) {
+        status = EXIT_FAILURE;
+    }
+
+    // 6. Clean up shared resources once every loop has drained.
+    for (long i = 0; i < num_loops; i++) {
+        vcache_destroy(loops[i].cache);
+    }
+    task_queue_destroy(offload);
+    worker_pool_destroy(pool);
+    handlers_shutdown(); // Final snapshot, before the log writer stops
+    qsbr_drain();
+    metrics_free_all();
+    trace_free_all();
+    log_stop(); // Flush the log
+    if (status == EXIT_SUCCESS) {
+        fprintf(stdout, "Server gracefully shut down.\n");
+    }
+    // Only now may the wakeup fds be closed and their numbers reused.
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    evloop_close_wakeups();
+
+    return status; // Indicate program termination status.
+}
@@ -0,0 +1,41 @@
+// metrics.h
+// Request and validation metrics, exported in the Prometheus text format.
+//
+// Every event loop thread records into its own set of counters, so recording
+// is a few uncontended memory operations. The per-thread counters are only
+// summed when /metrics is scraped.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "mongoose.h" // For struct mg_connection
+#include "router.h"   // For route_params_t
+#include "libtld.h"   // For tld_reason_t
+#include <stddef.h>   // For size_t
+#include <stdint.h>   // For uint64_t
+
+// Upper bound on the number of routes that are tracked individually.
+#define METRICS_MAX_ROUTES 32
+
+// Allocates the calling thread's counters and registers them for scraping.
+// Each event loop thread calls this once at startup; on threads that did not
+// (or on allocation failure, which returns -1), recording does nothing.
+int metrics_register_thread(void);
+
+// Releases every thread's counters. Call once all event loops have stopped.
+void metrics_free_all(void);
+
+// Records one request. route is the route index, or -1 if no route matched;
+// status is the response status code (0 if unknown).
+void metrics_record_request(int route, int status, size_t bytes_in, size_t bytes_out, uint64_t duration_us);
+
+// Records validated domains: checked in total, of which valid passed.
+void metrics_count_domains(size_t checked, size_t valid);
+
+// Records count domains rejected for the given reason (TLD_OK is ignored).
+void metrics_count_rejects(tld_reason_t reason, size_t count);
+
+// Handles GET requests to "/metrics".
+void handle_get_metrics(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+#endif // METRICS_H
@@ -0,0 +1,847 @@
+// persist.c
+// Implements the write-ahead log and snapshots of the item store.
+//
+// Files in the data directory:
+//   wal-<first LSN>.log  Log segments: fixed-size records, each with its log
+//                        sequence number (LSN) and a CRC-32. LSNs run on
+//                        without gaps from one segment to the next.
+//   snapshot.dat         Header, then one region per store shard: the records
+//                        array with room for cap items, then the index (see
+//                        store_image_t). Regions are SNAPSHOT_ALIGN-aligned
+//                        so each shard can unmap its own; the unused part of
+//                        every records array is a file hole.
+//
+// A snapshot copies the store with every shard locked against writers and,
+// at the same moment, asks the log writer to start a new segment after the
+// last LSN it covers.
+// Once the snapshot has been synced and renamed into place, the older
+// segments are deleted. Recovery maps the snapshot and replays the records
+// above its LSN; a torn record at the end of the last segment (a crash
+// mid-write) is cut off, anything else that fails its check is an error.
+//
+// Both files use the host's byte order and struct layout: they are meant to
+// be read back by the same build on the same machine, and the header checks
+// record sizes and a byte order mark so a mismatch is refused, not misread.
+
+#define _POSIX_C_SOURCE 200809L // For openat, fdatasync, fdopendir, sysconf
+
+#include "persist.h"   // Header for persistence declarations
+#include "store.h"     // For the item store and its images
+#include "log.h"       // For log_message
+#include <dirent.h>    // For fdopendir, readdir
+#include <errno.h>     // For errno, ENOENT, EEXIST
+#include <fcntl.h>     // For openat, O_* flags
+#include <inttypes.h>  // For PRIu64
+#include <stddef.h>    // For offsetof
+#include <stdint.h>    // For uint32_t, uint64_t
+#include <stdio.h>     // For snprintf
+#include <stdlib.h>    // For malloc, free, qsort
+#include <string.h>    // For memcpy, memset, strlen, strerror
+#include <sys/mman.h>  // For mmap
+#include <sys/stat.h>  // For mkdir, fstat
+#include <time.h>      // For clock_gettime
+#include <pthread.h>   // For the writer and snapshot threads
+#include <unistd.h>    // For pwrite, pread, fsync, fdatasync, close, sysconf
+
+// Records per log buffer. Appenders fill one buffer while the writer syncs
+// the other; they only wait if a whole buffer fills up during one sync.
+#define WAL_BUFFER_RECORDS 8192
+
+// A snapshot is taken once this many changes were logged since the last one,
+// or once any change is older than SNAPSHOT_MAX_AGE_S. The snapshot thread
+// checks every SNAPSHOT_CHECK_MS.
+#define SNAPSHOT_MIN_RECORDS 100000
+#define SNAPSHOT_MAX_AGE_S 60
+#define SNAPSHOT_CHECK_MS 1000
+
+#define SNAPSHOT_FILE "snapshot.dat"
+#define SNAPSHOT_TMP_FILE "snapshot.tmp"
+#define SNAPSHOT_MAGIC "ITEMSNAP"
+#define SNAPSHOT_VERSION 3
+#define BYTE_ORDER_MARK 0x01020304u
+
+// Snapshot records arrays have room for at least this many items, so an
+// adopted shard does not have to be copied out of the mapping right away.
+#define SNAPSHOT_MIN_CAP 64
+
+// Alignment of the shard regions in snapshot.dat; a multiple of the page
+// size of every platform we run on, so regions can be unmapped one by one.
+#define SNAPSHOT_ALIGN 65536
+
+#define WAL_PREFIX "wal-"
+#define WAL_SUFFIX ".log"
+
+enum { WAL_PUT = 1, WAL_DELETE = 2 };
+
+// One log record. PUT carries the whole item, so replay never depends on
+// the state an update was applied to.
+typedef struct {
+    uint32_t crc;  // CRC-32 of the bytes after this field
+    uint32_t op;   // WAL_PUT or WAL_DELETE
+    uint64_t lsn;
+    int32_t id;
+    int32_t value;
+    char name[ITEM_NAME_SIZE]; // Null-terminated, zero-padded
+} wal_record_t;
+
+_Static_assert(sizeof(wal_record_t) == 24 + ITEM_NAME_SIZE, "log records must not contain padding");
+
+// Where one shard's region lies in snapshot.dat, and its sizes.
+typedef struct {
+    uint64_t offset; // Records at offset, index at offset + cap * record_size
+    uint64_t count;
+    uint64_t cap;
+    uint64_t index_cap;
+} snapshot_shard_t;
+
+// Header of snapshot.dat, at offset 0. The first region follows at SNAPSHOT_ALIGN.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;   // BYTE_ORDER_MARK as written by this host
+    uint32_t record_size;  // sizeof(item_t)
+    uint32_t shards;       // STORE_SHARDS
+    int32_t next_id;
+    uint32_t reserved;
+    uint64_t lsn;          // Last log record the snapshot includes
+    uint64_t store_version; // store_version() when the snapshot was taken
+    snapshot_shard_t shard[STORE_SHARDS];
+    uint32_t reserved2;
+    uint32_t crc;          // CRC-32 of the bytes before this field
+} snapshot_header_t;
+
+_Static_assert(sizeof(snapshot_header_t) <= SNAPSHOT_ALIGN, "the header must fit before the first region");
+
+static int s_enabled;
+static int s_dir_fd = -1;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER; // Protects the fields below
+static pthread_cond_t s_work_cv = PTHREAD_COND_INITIALIZER;     // Records queued, rotation or stop
+static pthread_cond_t s_space_cv = PTHREAD_COND_INITIALIZER;    // The writer took the active buffer
+static pthread_cond_t s_rotated_cv = PTHREAD_COND_INITIALIZER;  // A requested rotation is done
+static pthread_cond_t s_snapshot_cv = PTHREAD_COND_INITIALIZER; // Snapshot thread shutdown
+static wal_record_t *s_buffers[2];
+static wal_record_t *s_active;   // Buffer appenders fill
+static size_t s_active_count;
+static uint64_t s_next_lsn;      // LSN of the next record appended
+static uint64_t s_rotate_after;  // Start a new segment after this LSN (0: none requested)
+static uint64_t s_segment_start; // First LSN of the segment being written
+static uint64_t s_snapshot_lsn;  // Last LSN covered by the snapshot on disk
+static int s_writer_stopping;
+static int s_snapshot_stopping;
+
+static int s_segment_fd = -1; // Writer thread only
+static int s_write_failed;    // Writer thread only: an error was logged
+static pthread_t s_writer;
+static pthread_t s_snapshotter;
+
+static uint32_t s_crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        s_crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_of(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = s_crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static uint32_t record_crc(const wal_record_t *rec) {
+    return crc32_of((const char *) rec + sizeof(rec->crc), sizeof(*rec) - sizeof(rec->crc));
+}
+
+// Writes len bytes at offset, retrying short writes. Returns 0 or -1.
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t) n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static void segment_name(char *buf, size_t size, uint64_t start) {
+    snprintf(buf, size, WAL_PREFIX "%020" PRIu64 WAL_SUFFIX, start);
+}
+
+// Parses a segment file name. Returns 1 and sets *start if it is one.
+static int parse_segment_name(const char *name, uint64_t *start) {
+    size_t len = strlen(name);
+    size_t prefix = sizeof(WAL_PREFIX) - 1, suffix = sizeof(WAL_SUFFIX) - 1;
+    if (len != prefix + 20 + suffix || strncmp(name, WAL_PREFIX, prefix) != 0 ||
+        strcmp(name + len - suffix, WAL_SUFFIX) != 0) {
+        return 0;
+    }
+    uint64_t v = 0;
+    for (size_t i = prefix; i < prefix + 20; i++) {
+        if (name[i] < '0' || name[i] > '9') {
+            return 0;
+        }
+        v = v * 10 + (uint64_t) (name[i] - '0');
+    }
+    *start = v;
+    return 1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// Lists the log segments in the data directory, sorted by first LSN.
+// Returns the number found (*starts must be freed), or -1.
+static long list_segments(uint64_t **starts) {
+    int fd = dup(s_dir_fd);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    rewinddir(dir);
+    uint64_t *list = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t start;
+        if (!parse_segment_name(entry->d_name, &start)) {
+            continue;
+        }
+        if (count == cap) {
+            size_t new_cap = cap ? cap * 2 : 16;
+            uint64_t *grown = realloc(list, new_cap * sizeof(*grown));
+            if (grown == NULL) {
+                free(list);
+                closedir(dir);
+                return -1;
+            }
+            list = grown;
+            cap = new_cap;
+        }
+        list[count++] = start;
+    }
+    closedir(dir);
+    if (count > 1) {
+        qsort(list, count, sizeof(*list), compare_u64);
+    }
+    *starts = list;
+    return (long) count;
+}
+
+// Creates the segment whose first record will be start and makes its
+// directory entry durable.
+static int open_segment(uint64_t start) {
+    char name[64];
+    segment_name(name, sizeof(name), start);
+    int fd = openat(s_dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "msg=\"cannot create log segment\" file=%s error=\"%s\"", name, strerror(errno));
+        return -1;
+    }
+    fsync(s_dir_fd);
+    return fd;
+}
+
+// --- Appending ---
+
+static void append(uint32_t op, int id, int value, const char *name) {
+    if (!s_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&s_lock);
+    while (s_active_count == WAL_BUFFER_RECORDS) {
+        // The writer is still syncing the other buffer; this is the only
+        // place a request waits for the disk.
+        pthread_cond_signal(&s_work_cv);
+        pthread_cond_wait(&s_space_cv, &s_lock);
+    }
+    wal_record_t *rec = &s_active[s_active_count++];
+    memset(rec, 0, sizeof(*rec));
+    rec->op = op;
+    rec->lsn = s_next_lsn++;
+    rec->id = id;
+    rec->value = value;
+    if (name != NULL) {
+        memcpy(rec->name, name, strlen(name)); // Shorter than ITEM_NAME_SIZE; the rest stays zero
+    }
+    rec->crc = record_crc(rec);
+    if (s_active_count == 1) {
+        pthread_cond_signal(&s_work_cv); // The writer sleeps only on an empty buffer
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+// The store's change hook (see store_set_change_hook).
+static void log_change(int id, const item_t *item) {
+    if (item != NULL) {
+        append(WAL_PUT, id, item->value, item->name);
+    } else {
+        append(WAL_DELETE, id, 0, NULL);
+    }
+}
+
+// --- Log writer thread ---
+
+static void write_failed(const char *what) {
+    if (!s_write_failed) {
+        s_write_failed = 1;
+        log_message(LOG_ERROR, "msg=\"write-ahead log %s failed, changes are no longer durable\" error=\"%s\"", what, strerror(errno));
+    }
+}
+
+// Without a segment (its creation failed) the records cannot be kept.
+static void write_records(const wal_record_t *records, size_t count) {
+    if (count > 0 && s_segment_fd >= 0 && write_all(s_segment_fd, records, count * sizeof(*records)) != 0) {
+        write_failed("write");
+    }
+}
+
+static void *writer_thread(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        while (s_active_count == 0 && s_rotate_after == 0 && !s_writer_stopping) {
+            pthread_cond_wait(&s_work_cv, &s_lock);
+        }
+        if (s_active_count == 0 && s_rotate_after == 0) {
+            break; // Stopping, and everything is written
+        }
+
+        // Take every record queued since the last sync; appenders move on
+        // to the other buffer.
+        wal_record_t *batch = s_active;
+        size_t count = s_active_count;
+        uint64_t rotate_after = s_rotate_after;
+        s_active = batch == s_buffers[0] ? s_buffers[1] : s_buffers[0];
+        s_active_count = 0;
+        pthread_cond_broadcast(&s_space_cv);
+        pthread_mutex_unlock(&s_lock);
+
+        // Records up to a requested rotation point close the current segment.
+        size_t head = count;
+        if (rotate_after != 0) {
+            head = 0;
+            while (head < count && batch[head].lsn <= rotate_after) {
+                head++;
+            }
+        }
+        write_records(batch, head);
+        if (rotate_after != 0) {
+            if (s_segment_fd >= 0) {
+                if (fdatasync(s_segment_fd) != 0) {
+                    write_failed("sync");
+                }
+                close(s_segment_fd);
+            }
+            s_segment_fd = open_segment(rotate_after + 1);
+            s_write_failed |= s_segment_fd < 0; // open_segment() logged it
+        }
+        write_records(batch + head, count - head);
+        if (count > head && s_segment_fd >= 0 && fdatasync(s_segment_fd) != 0) {
+            write_failed("sync");
+        }
+
+        pthread_mutex_lock(&s_lock);
+        if (rotate_after != 0) {
+            s_rotate_after = 0;
+            s_segment_start = rotate_after + 1;
+            pthread_cond_broadcast(&s_rotated_cv);
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+// --- Snapshots ---
+
+// Capacity the snapshot gives a records array: room to double.
+static size_t snapshot_cap(size_t count) {
+    size_t cap = SNAPSHOT_MIN_CAP;
+    while (cap < 2 * count) {
+        cap *= 2;
+    }
+    return cap;
+}
+
+// Bytes of a shard region with the given capacity, rounded up to SNAPSHOT_ALIGN.
+static uint64_t region_size(uint64_t cap, uint64_t index_cap) {
+    uint64_t bytes = cap * sizeof(item_t) + index_cap * sizeof(uint32_t);
+    return (bytes + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+// Writes a snapshot to snapshot.tmp and renames it into place. items holds
+// shard after shard, counts[i] items of shard i.
+static int write_snapshot(const item_t *items, const size_t *counts, int next_id, uint64_t version, uint64_t lsn) {
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.record_size = sizeof(item_t);
+    header.shards = STORE_SHARDS;
+    header.next_id = next_id;
+    header.lsn = lsn;
+    header.store_version = version;
+    uint64_t offset = SNAPSHOT_ALIGN;
+    size_t max_index_cap = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        snapshot_shard_t *sh = &header.shard[i];
+        sh->offset = offset;
+        sh->count = counts[i];
+        sh->cap = snapshot_cap(counts[i]);
+        sh->index_cap = 2 * sh->cap;
+        offset += region_size(sh->cap, sh->index_cap);
+        if (sh->index_cap > max_index_cap) {
+            max_index_cap = (size_t) sh->index_cap;
+        }
+    }
+    header.crc = crc32_of(&header, offsetof(snapshot_header_t, crc));
+
+    // Indexes are built for the larger capacity, so an adopted shard can
+    // grow to cap items before it rehashes.
+    uint32_t *index = malloc(max_index_cap * sizeof(*index));
+    if (index == NULL) {
+        log_message(LOG_ERROR, "msg=\"out of memory for the snapshot index\" slots=%zu", max_index_cap);
+        return -1;
+    }
+    int fd = openat(s_dir_fd, SNAPSHOT_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    // ftruncate first: the records arrays' spare room stays a hole.
+    int rc = (fd < 0 || ftruncate(fd, (off_t) offset) != 0 || pwrite_all(fd, &header, sizeof(header), 0) != 0) ? -1 : 0;
+    const item_t *shard_items = items;
+    for (int i = 0; rc == 0 && i < STORE_SHARDS; i++) {
+        const snapshot_shard_t *sh = &header.shard[i];
+        store_build_index(shard_items, counts[i], index, (size_t) sh->index_cap);
+        if (pwrite_all(fd, shard_items, counts[i] * sizeof(*items), (off_t) sh->offset) != 0 ||
+            pwrite_all(fd, index, (size_t) sh->index_cap * sizeof(*index), (off_t) (sh->offset + sh->cap * sizeof(item_t))) != 0) {
+            rc = -1;
+        }
+        shard_items += counts[i];
+    }
+    if (rc == 0 && fsync(fd) != 0) {
+        rc = -1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(index);
+    if (rc == 0 && renameat(s_dir_fd, SNAPSHOT_TMP_FILE, s_dir_fd, SNAPSHOT_FILE) == 0) {
+        fsync(s_dir_fd);
+        return 0;
+    }
+    log_message(LOG_ERROR, "msg=\"cannot write snapshot\" error=\"%s\"", strerror(errno));
+    unlinkat(s_dir_fd, SNAPSHOT_TMP_FILE, 0);
+    return -1;
+}
+
+// Deletes the segments that precede the current one; the snapshot on disk
+// covers every record in them.
+static void drop_covered_segments(uint64_t current_start) {
+    uint64_t *starts;
+    long n = list_segments(&starts);
+    for (long i = 0; i < n; i++) {
+        if (starts[i] < current_start) {
+            char name[64];
+            segment_name(name, sizeof(name), starts[i]);
+            unlinkat(s_dir_fd, name, 0);
+        }
+    }
+    if (n >= 0) {
+        free(starts);
+    }
+}
+
+// Copies the store, writes it out and trims the log.
+static void take_snapshot(void) {
+    // With every shard locked no change can be logged, so lsn is exactly
+    // the last change the copy contains. Readers are not held up.
+    store_lock_all();
+    size_t counts[STORE_SHARDS], total = 0;
+    store_image_t images[STORE_SHARDS];
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        store_get_image(i, &images[i]);
+        counts[i] = images[i].count;
+        total += counts[i];
+    }
+    item_t *items = malloc((total ? total : 1) * sizeof(*items));
+    if (items == NULL) {
+        store_unlock_all();
+        log_message(LOG_ERROR, "msg=\"out of memory for the snapshot copy\" items=%zu", total);
+        return;
+    }
+    item_t *dst = items;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (counts[i] > 0) {
+            memcpy(dst, images[i].records, counts[i] * sizeof(*items));
+        }
+        dst += counts[i];
+    }
+    int next_id = store_max_id() + 1;
+    uint64_t version = store_version();
+    pthread_mutex_lock(&s_lock);
+    uint64_t lsn = s_next_lsn - 1;
+    if (s_segment_start <= lsn) {
+        s_rotate_after = lsn;
+        pthread_cond_signal(&s_work_cv);
+    }
+    pthread_mutex_unlock(&s_lock);
+    store_unlock_all();
+
+    int rc = write_snapshot(items, counts, next_id, version, lsn);
+    free(items);
+
+    pthread_mutex_lock(&s_lock);
+    while (s_rotate_after != 0) {
+        pthread_cond_wait(&s_rotated_cv, &s_lock);
+    }
+    if (rc == 0) {
+        s_snapshot_lsn = lsn;
+    }
+    uint64_t current_start = s_segment_start;
+    pthread_mutex_unlock(&s_lock);
+    if (rc == 0) {
+        drop_covered_segments(current_start);
+        log_message(LOG_INFO, "msg=\"snapshot written\" items=%zu lsn=%" PRIu64, total, lsn);
+    }
+}
+
+static void *snapshot_thread(void *arg) {
+    (void) arg;
+    struct timespec last;
+    clock_gettime(CLOCK_REALTIME, &last);
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SNAPSHOT_CHECK_MS / 1000;
+        deadline.tv_nsec += (long) (SNAPSHOT_CHECK_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (!s_snapshot_stopping) {
+            pthread_cond_timedwait(&s_snapshot_cv, &s_lock, &deadline);
+        }
+        int stopping = s_snapshot_stopping;
+        uint64_t pending = s_next_lsn - 1 - s_snapshot_lsn;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int due = pending >= SNAPSHOT_MIN_RECORDS ||
+                  (pending > 0 && (stopping || now.tv_sec - last.tv_sec >= SNAPSHOT_MAX_AGE_S));
+        if (due) {
+            pthread_mutex_unlock(&s_lock);
+            take_snapshot();
+            clock_gettime(CLOCK_REALTIME, &last);
+            pthread_mutex_lock(&s_lock);
+        }
+        if (stopping) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+// --- Recovery ---
+
+// Checks a header read from a file of file_size bytes: its identity, and the
+// store's invariants for every shard (count <= cap, an index of twice cap,
+// regions back to back from SNAPSHOT_ALIGN up to the end of the file).
+static int header_ok(const snapshot_header_t *h, uint64_t file_size) {
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAPSHOT_VERSION ||
+        h->byte_order != BYTE_ORDER_MARK || h->record_size != sizeof(item_t) || h->shards != STORE_SHARDS ||
+        h->crc != crc32_of(h, offsetof(snapshot_header_t, crc)) || h->next_id <= 0) {
+        return 0;
+    }
+    uint64_t offset = SNAPSHOT_ALIGN;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        const snapshot_shard_t *sh = &h->shard[i];
+        if (sh->offset != offset || sh->count > sh->cap || sh->count >= UINT32_MAX - 1 ||
+            sh->cap < SNAPSHOT_MIN_CAP || sh->cap > ((uint64_t) 1 << 40) || (sh->cap & (sh->cap - 1)) != 0 ||
+            sh->index_cap != 2 * sh->cap) {
+            return 0;
+        }
+        offset += region_size(sh->cap, sh->index_cap);
+    }
+    return offset == file_size;
+}
+
+// Maps snapshot.dat into the store, if there is one. Sets *lsn to the last
+// log record it includes (0 without a snapshot).
+static int load_snapshot(uint64_t *lsn) {
+    *lsn = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0 || SNAPSHOT_ALIGN % page != 0) {
+        log_message(LOG_ERROR, "msg=\"page size does not divide the snapshot alignment\" page=%ld", page);
+        return -1;
+    }
+    int fd = openat(s_dir_fd, SNAPSHOT_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        log_message(LOG_ERROR, "msg=\"cannot open snapshot\" error=\"%s\"", strerror(errno));
+        return -1;
+    }
+    snapshot_header_t h;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h) || !header_ok(&h, (uint64_t) st.st_size)) {
+        close(fd);
+        log_message(LOG_ERROR, "msg=\"snapshot is damaged or from another build\" file=" SNAPSHOT_FILE);
+        return -1;
+    }
+
+    // A private mapping: pages load on first touch, and the store's writes
+    // stay in memory (copy-on-write) instead of reaching the file.
+    char *map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message(LOG_ERROR, "msg=\"cannot map snapshot\" error=\"%s\"", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        const snapshot_shard_t *sh = &h.shard[i];
+        store_image_t image;
+        image.records = (item_t *) (map + sh->offset);
+        image.count = (size_t) sh->count;
+        image.cap = (size_t) sh->cap;
+        image.index = (uint32_t *) (map + sh->offset + sh->cap * sizeof(item_t));
+        image.index_cap = (size_t) sh->index_cap;
+        if (store_adopt_image(i, &image, map + sh->offset, (size_t) region_size(sh->cap, sh->index_cap), h.next_id,
+                              h.store_version) != 0) {
+            log_message(LOG_ERROR, "msg=\"out of memory adopting the snapshot\"");
+            return -1;
+        }
+    }
+    munmap(map, SNAPSHOT_ALIGN); // The header; each shard owns its region now
+    *lsn = h.lsn;
+    return 0;
+}
+
+static int apply_record(const wal_record_t *rec) {
+    if (rec->op == WAL_PUT) {
+        return store_put(rec->id, rec->name, rec->value);
+    }
+    store_delete(rec->id);
+    return 0;
+}
+
+// Replays one segment, expecting its records to continue after *last_lsn
+// and applying those above snapshot_lsn. A bad record ends the segment: in
+// the last one it is a torn write and is cut off, elsewhere it is an error.
+static int replay_segment(uint64_t start, int is_last, uint64_t snapshot_lsn, uint64_t *last_lsn, wal_record_t *buf) {
+    char name[64];
+    segment_name(name, sizeof(name), start);
+    int fd = openat(s_dir_fd, name, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "msg=\"cannot open log segment\" file=%s error=\"%s\"", name, strerror(errno));
+        return -1;
+    }
+    off_t good = 0;
+    int bad = 0;
+    ssize_t n;
+    while (!bad && (n = read(fd, buf, WAL_BUFFER_RECORDS * sizeof(*buf))) > 0) {
+        size_t whole = (size_t) n / sizeof(*buf);
+        for (size_t i = 0; i < whole; i++) {
+            const wal_record_t *rec = &buf[i];
+            if (rec->crc != record_crc(rec) || rec->lsn != *last_lsn + 1 ||
+                (rec->op != WAL_PUT && rec->op != WAL_DELETE) || rec->name[ITEM_NAME_SIZE - 1] != '\0') {
+                bad = 1;
+                break;
+            }
+            if (rec->lsn > snapshot_lsn && apply_record(rec) != 0) {
+                close(fd);
+                log_message(LOG_ERROR, "msg=\"out of memory replaying the log\" lsn=%" PRIu64, rec->lsn);
+                return -1;
+            }
+            *last_lsn = rec->lsn;
+            good += (off_t) sizeof(*rec);
+        }
+        if ((size_t) n % sizeof(*buf) != 0) {
+            bad = 1; // A partial record; reads of a regular file only come up short at its end
+        }
+    }
+    if (bad) {
+        if (!is_last) {
+            close(fd);
+            log_message(LOG_ERROR, "msg=\"log segment is damaged\" file=%s offset=%lld", name, (long long) good);
+            return -1;
+        }
+        log_message(LOG_WARN, "msg=\"cutting off torn log tail\" file=%s offset=%lld", name, (long long) good);
+        if (ftruncate(fd, good) != 0 || fsync(fd) != 0) {
+            close(fd);
+            log_message(LOG_ERROR, "msg=\"cannot truncate log segment\" file=%s error=\"%s\"", name, strerror(errno));
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// Replays the segments after the snapshot. Sets *last_lsn to the last
+// record recovered.
+static int replay_log(uint64_t snapshot_lsn, uint64_t *last_lsn) {
+    uint64_t *starts;
+    long n = list_segments(&starts);
+    if (n < 0) {
+        log_message(LOG_ERROR, "msg=\"cannot list the data directory\" error=\"%s\"", strerror(errno));
+        return -1;
+    }
+    wal_record_t *buf = malloc(WAL_BUFFER_RECORDS * sizeof(*buf));
+    int rc = buf == NULL ? -1 : 0;
+    *last_lsn = snapshot_lsn;
+    for (long i = 0; rc == 0 && i < n; i++) {
+        if (i + 1 < n && starts[i + 1] <= snapshot_lsn + 1) {
+            continue; // Left over from before the snapshot: wholly covered
+        }
+        if (starts[i] > *last_lsn + 1) {
+            log_message(LOG_ERROR, "msg=\"log records are missing\" first_missing=%" PRIu64, *last_lsn + 1);
+            rc = -1;
+            break;
+        }
+        // Only the first segment replayed may start below the snapshot.
+        uint64_t expect = starts[i] - 1;
+        rc = replay_segment(starts[i], i + 1 == n, snapshot_lsn, &expect, buf);
+        if (expect > *last_lsn) {
+            *last_lsn = expect;
+        }
+        if (rc == 0 && i + 1 < n && expect + 1 != starts[i + 1]) {
+            log_message(LOG_ERROR, "msg=\"log records are missing\" first_missing=%" PRIu64, expect + 1);
+            rc = -1;
+        }
+    }
+    free(buf);
+    free(starts);
+    return rc;
+}
+
+// --- Setup and shutdown ---
+
+int persist_open(const char *dir) {
+    crc_init();
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log_message(LOG_ERROR, "msg=\"cannot create data directory\" dir=\"%s\" error=\"%s\"", dir, strerror(errno));
+        return -1;
+    }
+    s_dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s_dir_fd < 0) {
+        log_message(LOG_ERROR, "msg=\"cannot open data directory\" dir=\"%s\" error=\"%s\"", dir, strerror(errno));
+        return -1;
+    }
+
+    uint64_t snapshot_lsn, last_lsn;
+    if (load_snapshot(&snapshot_lsn) != 0 || replay_log(snapshot_lsn, &last_lsn) != 0) {
+        close(s_dir_fd);
+        s_dir_fd = -1;
+        return -1;
+    }
+    log_message(LOG_INFO, "msg=\"store recovered\" items=%zu snapshot_lsn=%" PRIu64 " replayed=%" PRIu64,
+                store_count(), snapshot_lsn, last_lsn - snapshot_lsn);
+
+    // New changes go to a fresh segment; the ones replayed are dropped with
+    // the next snapshot.
+    s_buffers[0] = malloc(WAL_BUFFER_RECORDS * sizeof(wal_record_t));
+    s_buffers[1] = malloc(WAL_BUFFER_RECORDS * sizeof(wal_record_t));
+    s_segment_fd = open_segment(last_lsn + 1);
+    if (s_buffers[0] == NULL || s_buffers[1] == NULL || s_segment_fd < 0) {
+        goto fail;
+    }
+    s_active = s_buffers[0];
+    s_active_count = 0;
+    s_next_lsn = last_lsn + 1;
+    s_segment_start = last_lsn + 1;
+    s_snapshot_lsn = snapshot_lsn;
+    if (pthread_create(&s_writer, NULL, writer_thread, NULL) != 0) {
+        log_message(LOG_ERROR, "msg=\"cannot start the log writer thread\"");
+        goto fail;
+    }
+    if (pthread_create(&s_snapshotter, NULL, snapshot_thread, NULL) != 0) {
+        log_message(LOG_ERROR, "msg=\"cannot start the snapshot thread\"");
+        pthread_mutex_lock(&s_lock);
+        s_writer_stopping = 1;
+        pthread_cond_signal(&s_work_cv);
+        pthread_mutex_unlock(&s_lock);
+        pthread_join(s_writer, NULL);
+        goto fail;
+    }
+    s_enabled = 1;
+    store_set_change_hook(log_change);
+    return 0;
+
+fail:
+    if (s_segment_fd >= 0) {
+        close(s_segment_fd);
+        s_segment_fd = -1;
+    }
+    free(s_buffers[0]);
+    free(s_buffers[1]);
+    s_buffers[0] = s_buffers[1] = NULL;
+    close(s_dir_fd);
+    s_dir_fd = -1;
+    return -1;
+}
+
+void persist_close(void) {
+    if (!s_enabled) {
+        return;
+    }
+    // The snapshot thread takes its final snapshot while the writer still
+    // runs (it has to rotate the segment), then the writer drains the rest.
+    pthread_mutex_lock(&s_lock);
+    s_snapshot_stopping = 1;
+    pthread_cond_signal(&s_snapshot_cv);
+    pthread_mutex_unlock(&s_lock);
+    pthread_join(s_snapshotter, NULL);
+
+    pthread_mutex_lock(&s_lock);
+    s_writer_stopping = 1;
+    pthread_cond_signal(&s_work_cv);
+    pthread_mutex_unlock(&s_lock);
+    pthread_join(s_writer, NULL);
+
+    store_set_change_hook(NULL);
+    s_enabled = 0;
+    if (s_segment_fd >= 0) {
+        close(s_segment_fd);
+        s_segment_fd = -1;
+    }
+    free(s_buffers[0]);
+    free(s_buffers[1]);
+    s_buffers[0] = s_buffers[1] = NULL;
+    close(s_dir_fd);
+    s_dir_fd = -1;
+}
@@ -0,0 +1,31 @@
+// persist.h
+// Durability for the item store: a write-ahead log of every change plus
+// periodic snapshots, both kept in a data directory (see --data-dir in main.c).
+//
+// A change is appended to an in-memory log buffer by the request that makes
+// it; a background thread writes out everything that accumulated while its
+// previous fdatasync ran with one write and one sync (group commit). Requests
+// never wait for the disk, so a crash can lose the changes of the last commit
+// (typically a few milliseconds' worth) but never corrupts the store.
+//
+// A snapshot thread periodically writes the store's arrays in their in-memory
+// layout (store_image_t) to a file that the next start maps straight back in,
+// then drops the log segments the snapshot covers, so a restart replays only
+// a short tail of the log.
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+// Recovers the store from dir (created if missing) by mapping the latest
+// snapshot and replaying the log written after it, then logs every later
+// change through the store's change hook and starts the log writer and
+// snapshot threads. Must be called once, before any event loop starts.
+// Returns 0 on success, or -1 (after logging why) if dir cannot be used or
+// its contents are damaged beyond a torn final write.
+int persist_open(const char *dir);
+
+// Snapshots any changes not covered yet, writes out the log and stops both
+// threads. Call once the event loops have stopped.
+void persist_close(void);
+
+#endif // PERSIST_H
@@ -0,0 +1,144 @@
+// psl.c
+// Public Suffix List lookups over the compiled trie in psl_data.c.
+// A lookup walks the domain's labels right to left. The TLD is found with
+// one probe of a hash table (psl_tld_slots), as the root has about 1500
+// children; each label below it with a binary search over the sorted
+// children of the current node, which number a few at most levels. The top
+// levels of the trie are stored first (breadth-first), so they stay hot in cache.
+
+#include "psl.h"
+#include "psl_data.h" // For psl_nodes, psl_labels and node flags
+
+// Compares a domain label (any case) with a lowercase trie label using the
+// order psl_compile.c sorts children in: bytewise, then shorter first.
+static int compare_label(const char *label, size_t len, const psl_node_t *node) {
+    const char *other = psl_labels + node->label;
+    size_t n = len < node->label_len ? len : node->label_len;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char a = (unsigned char)label[i];
+        unsigned char b = (unsigned char)other[i];
+        if (a >= 'A' && a <= 'Z') {
+            a = (unsigned char)(a - 'A' + 'a');
+        }
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    return (len > node->label_len) - (len < node->label_len);
+}
+
+// Returns the child of node whose label equals label, or NULL.
+static const psl_node_t *find_child(const psl_node_t *node, const char *label, size_t len) {
+    size_t lo = node->children;
+    size_t hi = lo + node->num_children;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int r = compare_label(label, len, &psl_nodes[mid]);
+        if (r == 0) {
+            return &psl_nodes[mid];
+        }
+        if (r < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+// Returns the root's child whose label equals label, or NULL.
+static const psl_node_t *find_tld(const char *label, size_t len) {
+    size_t mask = psl_tld_slot_count - 1;
+    for (size_t slot = psl_hash_label(label, len) & mask; psl_tld_slots[slot] != 0; slot = (slot + 1) & mask) {
+        const psl_node_t *node = &psl_nodes[psl_tld_slots[slot]];
+        if (node->label_len == len && compare_label(label, len, node) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+int psl_is_tld(const char *label, size_t len) {
+    return len > 0 && find_tld(label, len) != NULL;
+}
+
+// Walks the trie and returns the number of labels in the public suffix
+// (at least 1, per the implicit "*" rule). label_starts receives the start
+// offset of each label counted from the right, up to max_labels entries.
+static size_t match_suffix(const char *domain, size_t len, unsigned flags,
+                           size_t *label_starts, size_t max_labels, size_t *num_labels) {
+    const psl_node_t *node = &psl_nodes[0];
+    unsigned private_mask = (flags & PSL_ICANN_ONLY) ? PSL_NODE_PRIVATE : 0;
+    unsigned wildcard_private_mask = (flags & PSL_ICANN_ONLY) ? PSL_NODE_WILDCARD_PRIVATE : 0;
+    size_t suffix_labels = 1;
+    size_t depth = 0;
+    size_t end = len;
+    int walking = 1;
+
+    *num_labels = 0;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && domain[start - 1] != '.') {
+            start--;
+        }
+        if (*num_labels < max_labels) {
+            label_starts[(*num_labels)++] = start;
+        }
+
+        if (walking) {
+            const psl_node_t *child = depth == 0 ? find_tld(domain + start, end - start)
+                                                 : find_child(node, domain + start, end - start);
+            if (child != NULL && (child->flags & PSL_NODE_EXCEPTION) && !(child->flags & private_mask)) {
+                // An exception rule wins over everything: the suffix is the
+                // rule minus its leftmost label, i.e. the labels above this one.
+                suffix_labels = depth;
+                walking = 0;
+            } else {
+                if ((node->flags & PSL_NODE_WILDCARD) && !(node->flags & wildcard_private_mask)) {
+                    suffix_labels = depth + 1;
+                }
+                if (child != NULL && (child->flags & PSL_NODE_RULE) && !(child->flags & private_mask)) {
+                    suffix_labels = depth + 1;
+                }
+                if (child == NULL) {
+                    walking = 0;
+                } else {
+                    node = child;
+                }
+            }
+            depth++;
+        }
+        if (!walking && *num_labels > suffix_labels) {
+            break; // One label past the suffix is all the callers need
+        }
+        if (start == 0) {
+            break;
+        }
+        end = start - 1; // Skip the dot
+    }
+    return suffix_labels;
+}
+
+// Rules have at most a handful of labels; one more is needed for eTLD+1.
+#define PSL_MAX_LABELS 16
+
+size_t psl_public_suffix_len(const char *domain, size_t len, unsigned flags) {
+    size_t starts[PSL_MAX_LABELS];
+    size_t num_labels;
+    size_t suffix_labels = match_suffix(domain, len, flags, starts, PSL_MAX_LABELS, &num_labels);
+    if (suffix_labels > num_labels) {
+        suffix_labels = num_labels; // A rule longer than the domain itself
+    }
+    return suffix_labels == 0 ? 0 : len - starts[suffix_labels - 1];
+}
+
+int psl_registrable_domain(const char *domain, size_t len, unsigned flags, size_t *offset) {
+    size_t starts[PSL_MAX_LABELS];
+    size_t num_labels;
+    size_t suffix_labels = match_suffix(domain, len, flags, starts, PSL_MAX_LABELS, &num_labels);
+    if (suffix_labels >= num_labels) {
+        return -1; // The domain is a public suffix; nothing is registrable
+    }
+    *offset = starts[suffix_labels];
+    return 0;
+}
@@ -0,0 +1,29 @@
+// psl.h
+// Public Suffix List lookups against the trie compiled into the binary
+// at build time (see psl_compile.c). No lookup allocates memory.
+
+#ifndef PSL_H
+#define PSL_H
+
+#include <stddef.h> // For size_t
+
+// Lookup flags.
+#define PSL_ICANN_ONLY 0x01 // Ignore rules from the PRIVATE section of the list
+
+// Returns 1 if label (case-insensitive, in A-label form for IDN TLDs) is a
+// top-level domain known to the Public Suffix List, 0 otherwise.
+int psl_is_tld(const char *label, size_t len);
+
+// Returns the length in bytes of the public suffix of domain (e.g., 5 for
+// "www.example.co.uk" -> "co.uk"). The suffix starts at domain + len - result.
+// Domains with no matching rule fall back to the implicit "*" rule, i.e. their
+// last label. domain should already have passed is_valid_domain_n().
+size_t psl_public_suffix_len(const char *domain, size_t len, unsigned flags);
+
+// Computes the registrable domain (eTLD+1) of domain: the public suffix plus
+// one more label (e.g., "example.co.uk" for "www.example.co.uk").
+// offset: Receives the byte offset of the registrable domain within domain.
+// Returns 0 on success, or -1 if domain is itself a public suffix.
+int psl_registrable_domain(const char *domain, size_t len, unsigned flags, size_t *offset);
+
+#endif // PSL_H
@@ -0,0 +1,359 @@
+// psl_compile.c
+// Build-time tool that compiles the Public Suffix List (public_suffix_list.dat)
+// into the static reversed-label trie read by psl.c.
+// Usage: ./psl_compile public_suffix_list.dat > psl_data.c
+//
+// Rules are split into labels, reversed (TLD first), converted to lowercase
+// A-labels (IDN labels are punycode-encoded with an "xn--" prefix) and merged
+// into a trie. The trie is then written out breadth-first with each node's
+// children contiguous and sorted, so a lookup is one binary search per label;
+// the TLDs, the root's children, also get a hash table (psl_tld_slots).
+
+#include "psl_data.h" // Node layout and flags
+#include <stdio.h>    // For fopen, fgets, printf
+#include <stdlib.h>   // For malloc, realloc, qsort, exit
+#include <string.h>   // For strlen, strcmp, memcpy, strncmp
+
+#define MAX_LINE 1024
+#define MAX_LABEL 63
+
+// Trie node used while building; emitted as psl_node_t.
+typedef struct build_node {
+    char label[MAX_LABEL + 1];
+    unsigned flags;
+    struct build_node **children;
+    size_t num_children;
+    size_t cap_children;
+    size_t index; // Position in the emitted psl_nodes array
+} build_node_t;
+
+static void die(const char *msg) {
+    fprintf(stderr, "psl_compile: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        die("out of memory");
+    }
+    return p;
+}
+
+// --- Punycode (RFC 3492) ---
+
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 128
+
+static char puny_digit(unsigned d) {
+    return (char)(d < 26 ? 'a' + d : '0' + (d - 26));
+}
+
+static unsigned puny_adapt(unsigned delta, unsigned num_points, int first) {
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / num_points;
+    unsigned k = 0;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+// Decodes UTF-8 into code points. Returns the number of code points, or -1 if invalid.
+static long utf8_decode(const char *s, size_t len, unsigned *out, size_t cap) {
+    size_t n = 0;
+    for (size_t i = 0; i < len;) {
+        unsigned char c = (unsigned char)s[i];
+        unsigned cp;
+        size_t extra;
+        if (c < 0x80) { cp = c; extra = 0; }
+        else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+        else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+        else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; }
+        else return -1;
+        if (i + extra >= len || n == cap) return -1; // Truncated sequence or too long
+        for (size_t j = 1; j <= extra; j++) {
+            unsigned char cc = (unsigned char)s[i + j];
+            if ((cc & 0xC0) != 0x80) return -1;
+            cp = (cp << 6) | (cc & 0x3F);
+        }
+        out[n++] = cp;
+        i += extra + 1;
+    }
+    return (long)n;
+}
+
+// Encodes a UTF-8 label as an A-label ("xn--..."). ASCII labels are lowercased
+// and copied. Returns 0 on success, -1 if the label is invalid or too long.
+static int to_alabel(const char *label, size_t len, char *out, size_t out_cap) {
+    unsigned cps[MAX_LINE];
+    long n = utf8_decode(label, len, cps, MAX_LINE);
+    if (n < 0) {
+        return -1;
+    }
+
+    size_t o = 0;
+    int has_non_ascii = 0;
+    for (long i = 0; i < n; i++) {
+        if (cps[i] >= 0x80) {
+            has_non_ascii = 1;
+        }
+    }
+    if (has_non_ascii) {
+        if (out_cap < 5) return -1;
+        memcpy(out, "xn--", 4);
+        o = 4;
+    }
+    // Basic code points are copied first.
+    size_t basic = 0;
+    for (long i = 0; i < n; i++) {
+        if (cps[i] < 0x80) {
+            if (o + 1 >= out_cap) return -1;
+            char ch = (char)cps[i];
+            out[o++] = (ch >= 'A' && ch <= 'Z') ? (char)(ch - 'A' + 'a') : ch;
+            basic++;
+        }
+    }
+    if (has_non_ascii) {
+        if (basic > 0) {
+            if (o + 1 >= out_cap) return -1;
+            out[o++] = '-';
+        }
+        unsigned cur = PUNY_INITIAL_N, delta = 0, bias = PUNY_INITIAL_BIAS;
+        size_t handled = basic;
+        while (handled < (size_t)n) {
+            unsigned m = 0xFFFFFFFFu;
+            for (long i = 0; i < n; i++) {
+                if (cps[i] >= cur && cps[i] < m) m = cps[i];
+            }
+            delta += (m - cur) * (unsigned)(handled + 1);
+            cur = m;
+            for (long i = 0; i < n; i++) {
+                if (cps[i] < cur) delta++;
+                if (cps[i] == cur) {
+                    unsigned q = delta;
+                    for (unsigned k = PUNY_BASE;; k += PUNY_BASE) {
+                        unsigned t = k <= bias ? PUNY_TMIN : (k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias);
+                        if (q < t) break;
+                        if (o + 1 >= out_cap) return -1;
+                        out[o++] = puny_digit(t + (q - t) % (PUNY_BASE - t));
+                        q = (q - t) / (PUNY_BASE - t);
+                    }
+                    if (o + 1 >= out_cap) return -1;
+                    out[o++] = puny_digit(q);
+                    bias = puny_adapt(delta, (unsigned)(handled + 1), handled == basic);
+                    delta = 0;
+                    handled++;
+                }
+            }
+            delta++;
+            cur++;
+        }
+    }
+    if (o == 0 || o > MAX_LABEL) {
+        return -1;
+    }
+    out[o] = '\0';
+    return 0;
+}
+
+// --- Trie construction ---
+
+static build_node_t *new_node(const char *label) {
+    build_node_t *node = xrealloc(NULL, sizeof(*node));
+    memset(node, 0, sizeof(*node));
+    strcpy(node->label, label);
+    return node;
+}
+
+static build_node_t *get_child(build_node_t *parent, const char *label) {
+    for (size_t i = 0; i < parent->num_children; i++) {
+        if (strcmp(parent->children[i]->label, label) == 0) {
+            return parent->children[i];
+        }
+    }
+    if (parent->num_children == parent->cap_children) {
+        parent->cap_children = parent->cap_children ? parent->cap_children * 2 : 4;
+        parent->children = xrealloc(parent->children, parent->cap_children * sizeof(*parent->children));
+    }
+    build_node_t *child = new_node(label);
+    parent->children[parent->num_children++] = child;
+    return child;
+}
+
+// Adds one rule (without the leading '!' of exceptions) to the trie.
+static void add_rule(build_node_t *root, char *rule, int exception, int is_private) {
+    char *labels[128];
+    size_t num_labels = 0;
+    for (char *tok = rule;;) {
+        char *dot = strchr(tok, '.');
+        if (num_labels == 128) die("rule has too many labels");
+        labels[num_labels++] = tok;
+        if (dot == NULL) break;
+        *dot = '\0';
+        tok = dot + 1;
+    }
+
+    build_node_t *node = root;
+    for (size_t i = num_labels; i-- > 0;) {
+        if (i == 0 && strcmp(labels[0], "*") == 0 && !exception) {
+            node->flags |= PSL_NODE_WILDCARD | (is_private ? PSL_NODE_WILDCARD_PRIVATE : 0);
+            return;
+        }
+        char alabel[MAX_LABEL + 1];
+        if (to_alabel(labels[i], strlen(labels[i]), alabel, sizeof(alabel)) != 0) {
+            fprintf(stderr, "psl_compile: skipping rule with invalid label '%s'\n", labels[i]);
+            return;
+        }
+        node = get_child(node, alabel);
+    }
+    node->flags |= (exception ? PSL_NODE_EXCEPTION : PSL_NODE_RULE) | (is_private ? PSL_NODE_PRIVATE : 0);
+}
+
+// Sort order used by psl.c: bytewise on the common prefix, then shorter first.
+static int cmp_nodes(const void *a, const void *b) {
+    const build_node_t *x = *(build_node_t *const *)a;
+    const build_node_t *y = *(build_node_t *const *)b;
+    size_t lx = strlen(x->label), ly = strlen(y->label);
+    int r = memcmp(x->label, y->label, lx < ly ? lx : ly);
+    if (r != 0) return r;
+    return (lx > ly) - (lx < ly);
+}
+
+// --- Label pool (deduplicated through a small open-addressing hash set) ---
+
+static char *pool;
+static size_t pool_len, pool_cap;
+static size_t *pool_set; // pool offset + 1 per slot, 0 = empty
+static size_t pool_set_cap;
+
+static size_t hash_label(const char *s) {
+    size_t h = 2166136261u; // FNV-1a
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static size_t pool_add(const char *label) {
+    size_t len = strlen(label);
+    size_t slot = hash_label(label) & (pool_set_cap - 1);
+    while (pool_set[slot] != 0) {
+        size_t off = pool_set[slot] - 1;
+        if (strncmp(pool + off, label, len) == 0 && pool[off + len] == '\0') {
+            return off;
+        }
+        slot = (slot + 1) & (pool_set_cap - 1);
+    }
+    if (pool_len + len + 1 > pool_cap) {
+        pool_cap = (pool_cap + len + 1) * 2;
+        pool = xrealloc(pool, pool_cap);
+    }
+    size_t off = pool_len;
+    memcpy(pool + off, label, len + 1); // Keep the NUL as a separator for dedup
+    pool_len += len + 1;
+    pool_set[slot] = off + 1;
+    return off;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s public_suffix_list.dat > psl_data.c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    build_node_t *root = new_node("");
+    int is_private = 0;
+    size_t num_rules = 0;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (strncmp(line, "// ===BEGIN PRIVATE DOMAINS===", 30) == 0) {
+            is_private = 1;
+        }
+        // A rule is the first whitespace-delimited word of a non-comment line.
+        size_t n = strcspn(line, " \t\r\n");
+        line[n] = '\0';
+        if (n == 0 || strncmp(line, "//", 2) == 0) {
+            continue;
+        }
+        int exception = line[0] == '!';
+        add_rule(root, line + exception, exception, is_private);
+        num_rules++;
+    }
+    fclose(in);
+
+    // Breadth-first layout: the queue is the output order.
+    size_t queue_cap = 1024, queue_len = 1;
+    build_node_t **queue = xrealloc(NULL, queue_cap * sizeof(*queue));
+    queue[0] = root;
+    for (size_t head = 0; head < queue_len; head++) {
+        build_node_t *node = queue[head];
+        node->index = head;
+        qsort(node->children, node->num_children, sizeof(*node->children), cmp_nodes);
+        if (node->num_children > UINT16_MAX) die("node has too many children");
+        for (size_t i = 0; i < node->num_children; i++) {
+            if (queue_len == queue_cap) {
+                queue_cap *= 2;
+                queue = xrealloc(queue, queue_cap * sizeof(*queue));
+            }
+            queue[queue_len++] = node->children[i];
+        }
+    }
+
+    pool_set_cap = 1;
+    while (pool_set_cap < queue_len * 2) pool_set_cap *= 2;
+    pool_set = xrealloc(NULL, pool_set_cap * sizeof(*pool_set));
+    memset(pool_set, 0, pool_set_cap * sizeof(*pool_set));
+
+    printf("// psl_data.c\n");
+    printf("// GENERATED by psl_compile from %s (%zu rules). Do not edit.\n\n", argv[1], num_rules);
+    printf("#include \"psl_data.h\"\n\n");
+    printf("const psl_node_t psl_nodes[] = {\n");
+    for (size_t i = 0; i < queue_len; i++) {
+        build_node_t *node = queue[i];
+        size_t label = pool_add(node->label);
+        size_t children = node->num_children ? node->children[0]->index : 0;
+        printf("    {%zu, %zu, %zu, %zu, 0x%02x},\n", label, children, node->num_children,
+               strlen(node->label), node->flags);
+    }
+    printf("};\n\n");
+    printf("const size_t psl_node_count = %zu;\n\n", queue_len);
+
+    // The TLD hash table, with the hash and probing of psl.c.
+    size_t num_slots = 1;
+    while (num_slots < root->num_children * 4) num_slots *= 2;
+    uint16_t *slots = xrealloc(NULL, num_slots * sizeof(*slots));
+    memset(slots, 0, num_slots * sizeof(*slots));
+    for (size_t i = 0; i < root->num_children; i++) {
+        const build_node_t *tld = root->children[i];
+        size_t slot = psl_hash_label(tld->label, strlen(tld->label)) & (num_slots - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (num_slots - 1);
+        slots[slot] = (uint16_t)tld->index; // Never 0, the root's own index
+    }
+    printf("const uint16_t psl_tld_slots[] = {");
+    for (size_t i = 0; i < num_slots; i++) {
+        printf(i % 16 == 0 ? "\n    " : " ");
+        printf("%u,", (unsigned)slots[i]);
+    }
+    printf("\n};\n\n");
+    printf("const size_t psl_tld_slot_count = %zu;\n\n", num_slots);
+
+    // An initializer list rather than a string literal, which would exceed
+    // the length ISO C requires compilers to support (-Woverlength-strings).
+    printf("const char psl_labels[] = {");
+    for (size_t i = 0; i <= pool_len; i++) {
+        printf(i % 16 == 0 ? "\n    " : " ");
+        printf("%d,", i < pool_len ? (unsigned char) pool[i] : 0); // Ends with a null, as the literal did
+    }
+    printf("\n};\n");
+    return EXIT_SUCCESS;
+}
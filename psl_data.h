@@ -0,0 +1,55 @@
+// psl_data.h
+// Layout of the compiled Public Suffix List shared by psl_compile.c
+// (which generates psl_data.c at build time) and psl.c (which reads it).
+
+#ifndef PSL_DATA_H
+#define PSL_DATA_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For fixed-width node fields
+
+// Node flags.
+#define PSL_NODE_RULE             0x01 // A rule ends at this node (e.g., "co.uk")
+#define PSL_NODE_EXCEPTION        0x02 // An exception rule ends here (e.g., "!www.ck")
+#define PSL_NODE_WILDCARD         0x04 // A wildcard rule covers the children (e.g., "*.ck")
+#define PSL_NODE_PRIVATE          0x08 // The rule/exception ending here is from the PRIVATE section
+#define PSL_NODE_WILDCARD_PRIVATE 0x10 // The wildcard rule is from the PRIVATE section
+
+// One label of the suffix trie. Labels are stored reversed (the root's
+// children are TLDs), and the children of each node are stored contiguously,
+// sorted by label, in breadth-first order. Node 0 is the root.
+typedef struct {
+    uint32_t label;        // Offset of the (lowercase, ASCII) label in psl_labels
+    uint32_t children;     // Index of the first child in psl_nodes
+    uint16_t num_children; // Number of children
+    uint8_t label_len;     // Length of the label in bytes
+    uint8_t flags;         // PSL_NODE_* flags
+} psl_node_t;
+
+// Generated tables (psl_data.c).
+extern const psl_node_t psl_nodes[];
+extern const size_t psl_node_count;
+extern const char psl_labels[];
+
+// Hash table over the root's children (the TLDs), so that the level with by
+// far the most children takes one probe instead of a binary search. Open
+// addressing with linear probing; each slot holds a node index, 0 if empty.
+// The slot count is a power of two, at least four times the TLD count.
+extern const uint16_t psl_tld_slots[];
+extern const size_t psl_tld_slot_count;
+
+// Hash of a label for psl_tld_slots: FNV-1a over its bytes, with ASCII
+// letters lowercased so domains in any case find their TLD.
+static inline uint32_t psl_hash_label(const char *label, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)label[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (unsigned char)(c - 'A' + 'a');
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+#endif // PSL_DATA_H
@@ -0,0 +1,145 @@
+// qsbr.c
+// Implements quiescent-state-based reclamation with a global epoch.
+//
+// Retiring memory advances the epoch and tags the memory with the new
+// value. A quiescent state copies the current epoch into the reader's
+// record. Memory tagged E is safe to free once every registered reader has
+// recorded an epoch of at least E: each of them has passed a quiescent state
+// since the retirement, so none can still hold a pointer it read before the
+// writer unpublished the memory.
+
+#define _POSIX_C_SOURCE 200809L // For pthread mutexes
+
+#include "qsbr.h"      // Header for reclamation declarations
+#include <pthread.h>   // For the registry lock
+#include <stdatomic.h> // For the epoch and reader records
+#include <stdint.h>    // For uint64_t, UINT64_MAX
+#include <stdlib.h>    // For aligned_alloc, realloc, free
+#include <string.h>    // For memset
+
+// One registered reader, on a cache line of its own: it is written at every
+// quiescent state and read only when memory is reclaimed.
+typedef struct reader {
+    _Alignas(64) _Atomic uint64_t seen; // Epoch of the last quiescent state
+    struct reader *next;
+} reader_t;
+
+typedef struct {
+    void *ptr;
+    size_t len;
+    void (*release)(void *ptr, size_t len);
+    uint64_t epoch; // Safe once every reader has seen this epoch
+} retired_t;
+
+static _Atomic uint64_t s_epoch = 1;
+static atomic_size_t s_pending; // Entries in s_retired, checked without the lock
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER; // Protects the fields below
+static reader_t *s_readers;
+static retired_t *s_retired;
+static size_t s_retired_count;
+static size_t s_retired_cap;
+
+static _Thread_local reader_t *s_self;
+
+// Frees every retired entry that all readers are done with.
+static void reclaim_locked(void) {
+    uint64_t min_seen = UINT64_MAX;
+    for (reader_t *r = s_readers; r != NULL; r = r->next) {
+        uint64_t seen = atomic_load_explicit(&r->seen, memory_order_acquire);
+        if (seen < min_seen) {
+            min_seen = seen;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < s_retired_count; i++) {
+        if (s_retired[i].epoch <= min_seen) {
+            s_retired[i].release(s_retired[i].ptr, s_retired[i].len);
+        } else {
+            s_retired[kept++] = s_retired[i];
+        }
+    }
+    s_retired_count = kept;
+    atomic_store_explicit(&s_pending, kept, memory_order_relaxed);
+}
+
+int qsbr_register(void) {
+    reader_t *r = aligned_alloc(_Alignof(reader_t), sizeof(reader_t));
+    if (r == NULL) {
+        return -1;
+    }
+    memset(r, 0, sizeof(*r));
+    pthread_mutex_lock(&s_lock);
+    atomic_store_explicit(&r->seen, atomic_load_explicit(&s_epoch, memory_order_acquire), memory_order_relaxed);
+    r->next = s_readers;
+    s_readers = r;
+    pthread_mutex_unlock(&s_lock);
+    s_self = r;
+    return 0;
+}
+
+void qsbr_unregister(void) {
+    reader_t *self = s_self;
+    if (self == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s_lock);
+    for (reader_t **p = &s_readers; *p != NULL; p = &(*p)->next) {
+        if (*p == self) {
+            *p = self->next;
+            break;
+        }
+    }
+    reclaim_locked();
+    pthread_mutex_unlock(&s_lock);
+    s_self = NULL;
+    free(self);
+}
+
+void qsbr_quiescent(void) {
+    reader_t *self = s_self;
+    if (self != NULL) {
+        // Release: every read this thread made so far happens before a
+        // reclaimer sees the new epoch.
+        atomic_store_explicit(&self->seen, atomic_load_explicit(&s_epoch, memory_order_acquire), memory_order_release);
+    }
+    if (atomic_load_explicit(&s_pending, memory_order_relaxed) != 0 && pthread_mutex_trylock(&s_lock) == 0) {
+        reclaim_locked();
+        pthread_mutex_unlock(&s_lock);
+    }
+}
+
+void qsbr_retire(void *ptr, size_t len, void (*release)(void *ptr, size_t len)) {
+    if (ptr == NULL) {
+        return;
+    }
+    // The writer unpublished ptr before this point; readers that observe the
+    // new epoch also observe that.
+    uint64_t epoch = atomic_fetch_add_explicit(&s_epoch, 1, memory_order_acq_rel) + 1;
+    pthread_mutex_lock(&s_lock);
+    if (s_retired_count == s_retired_cap) {
+        size_t new_cap = s_retired_cap ? s_retired_cap * 2 : 16;
+        retired_t *grown = realloc(s_retired, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&s_lock);
+            return; // Leaking is the only safe choice
+        }
+        s_retired = grown;
+        s_retired_cap = new_cap;
+    }
+    s_retired[s_retired_count++] = (retired_t){ptr, len, release, epoch};
+    reclaim_locked();
+    pthread_mutex_unlock(&s_lock);
+}
+
+void qsbr_drain(void) {
+    pthread_mutex_lock(&s_lock);
+    for (size_t i = 0; i < s_retired_count; i++) {
+        s_retired[i].release(s_retired[i].ptr, s_retired[i].len);
+    }
+    free(s_retired);
+    s_retired = NULL;
+    s_retired_count = s_retired_cap = 0;
+    atomic_store_explicit(&s_pending, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&s_lock);
+}
@@ -0,0 +1,36 @@
+// qsbr.h
+// Quiescent-state-based reclamation for lock-free readers (see store.c).
+//
+// A writer that replaces a structure readers may still be traversing hands
+// the old memory to qsbr_retire() instead of freeing it. Reader threads
+// announce quiescent states, points where they hold no references into such
+// structures; the event loops do so once per poll iteration. Memory is freed
+// once every registered reader has announced one after it was retired, so
+// readers pay nothing per access and writers never wait.
+
+#ifndef QSBR_H
+#define QSBR_H
+
+#include <stddef.h> // For size_t
+
+// Registers the calling thread as a reader, online from now on. Threads that
+// read lock-free structures while others write them must be registered.
+// Returns 0 on success, or -1 on allocation failure.
+int qsbr_register(void);
+
+// Unregisters the calling thread; it must hold no references any more.
+void qsbr_unregister(void);
+
+// Announces that the calling thread holds no references right now, and
+// frees retired memory if that has become safe. Cheap; call often.
+void qsbr_quiescent(void);
+
+// Frees ptr (len bytes, passed on to release) with release(ptr, len) once no
+// reader can still reference it. Writers call this, under their own lock.
+void qsbr_retire(void *ptr, size_t len, void (*release)(void *ptr, size_t len));
+
+// Frees everything retired, regardless of readers. Call once all readers
+// have stopped.
+void qsbr_drain(void);
+
+#endif // QSBR_H
@@ -1,78 +1,335 @@
 // router.c
 // Implements the API routing logic, dispatching incoming HTTP requests
 // to the appropriate handler functions based on method and URI.
+//
+// At startup the route table is compiled into one trie per HTTP method, with
+// one node per path segment. Dispatch walks the request URI once: at each
+// segment it follows the matching literal child, or else the {param} child,
+// capturing the segment as a parameter. The cost depends on the path length,
+// not on the number of routes.
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
 
 #include "router.h"    // Header for route_t and router_dispatch declaration
-#include "mongoose.h"  // Mongoose library functions (for mg_vcmp)
+#include "mongoose.h"  // Mongoose library functions
 #include "handlers.h"  // Include specific handlers to register them in the routes array
-#include "utils.h"     // For send_error_response
-#include <string.h>    // For strcmp, strncmp, strlen
+#include "domain_handlers.h" // Domain validation handlers
+#include "utils.h"     // For send_static_response
+#include "conn.h"      // For deferred responses
+#include "log.h"       // For the access log
+#include "metrics.h"   // For request metrics and the /metrics handler
+#include "trace.h"     // For request tracing and the trace dump handler
+#include <stdlib.h>    // For malloc, free
+#include <string.h>    // For strlen, strchr, memcmp, memcpy
+#include <time.h>      // For clock_gettime
 
 // Array of registered routes.
 // This defines all the API endpoints and their corresponding handlers.
-// The order matters: more specific routes (e.g., exact matches) should
-// generally come before less specific ones (e.g., prefix matches),
-// especially if prefixes overlap.
+// Literal segments take precedence over {param} segments at the same
+// position, so the order of the entries does not matter.
 static const route_t routes[] = {
-    // GET all items: Matches exactly "/api/v1/items"
-    {"GET", "/api/v1/items", 1, handle_get_all_items},
-    // POST create item: Matches exactly "/api/v1/items"
-    {"POST", "/api/v1/items", 1, handle_create_item},
+    // Item collection
+    {"GET", "/api/v1/items", handle_get_all_items},
+    {"POST", "/api/v1/items", handle_create_item},
+    // Batch of item operations
+    {"POST", "/api/v1/items:batch", handle_batch_items},
 
     // Routes requiring an item ID (e.g., /api/v1/items/123)
-    // These use uri_prefix ending with '/' and exact_match=0 (prefix match).
-    // The handler function is responsible for parsing the ID from the URI.
-    {"GET", "/api/v1/items/", 0, handle_get_item_by_id},
-    {"PUT", "/api/v1/items/", 0, handle_update_item},
-    {"DELETE", "/api/v1/items/", 0, handle_delete_item},
+    {"GET", "/api/v1/items/{id}", handle_get_item_by_id},
+    {"PUT", "/api/v1/items/{id}", handle_update_item},
+    {"DELETE", "/api/v1/items/{id}", handle_delete_item},
+
+    // Bulk domain validation
+    {"POST", "/api/v1/domains/validate", handle_validate_domains},
+    // Single domain lookup (e.g., /api/v1/domains/www.example.co.uk)
+    {"GET", "/api/v1/domains/{domain}", handle_get_domain},
+    // Verdict cache counters
+    {"GET", "/api/v1/stats/cache", handle_get_cache_stats},
+    // Prometheus metrics
+    {"GET", "/metrics", handle_get_metrics},
+    // Sampled request traces (Chrome trace event format)
+    {"GET", "/api/v1/admin/trace", handle_get_trace},
 
-    // Root endpoint: Matches exactly "/"
-    {"GET", "/", 1, handle_root},
+    // Root endpoint
+    {"GET", "/", handle_root},
 
     // Add more routes here as your API grows.
     // Example for a different endpoint:
-    // {"GET", "/api/v1/users", 1, handle_get_all_users},
+    // {"GET", "/api/v1/users", handle_get_all_users},
 };
 
 // Calculate the total number of routes in the array.
 static const size_t num_routes = sizeof(routes) / sizeof(routes[0]);
 
-// Function to dispatch an incoming HTTP request to the appropriate handler.
-void router_dispatch(struct mg_connection *c, struct mg_http_message *hm) {
-    // Log the incoming request for debugging purposes.
-    fprintf(stdout, "Incoming request: %s %.*s\n", hm->method.p, (int)hm->uri.len, hm->uri.p);
+// Methods with their own trie. Requests with any other method get a 404.
+enum { METHOD_GET, METHOD_POST, METHOD_PUT, METHOD_DELETE, METHOD_PATCH, METHOD_HEAD, METHOD_OPTIONS, METHOD_COUNT };
+static const char *const method_names[METHOD_COUNT] = {"GET", "POST", "PUT", "DELETE", "PATCH", "HEAD", "OPTIONS"};
+
+// Upper bound on trie nodes: one root per method plus one per route segment.
+#define ROUTER_MAX_NODES 256
+
+#define NO_NODE -1
+
+// One path segment of the trie.
+typedef struct {
+    const char *segment;        // Literal segment, or parameter name for {param} nodes
+    size_t segment_len;
+    const route_t *route;       // Route ending here, or NULL
+    int first_child;            // First literal child
+    int next_sibling;           // Next literal child of the same parent
+    int param_child;            // {param} child
+} route_node_t;
+
+static route_node_t nodes[ROUTER_MAX_NODES];
+static int num_nodes = 0;
+static int method_roots[METHOD_COUNT];
+
+// Maps a request method to its trie index, or -1 if it has none.
+static int method_index(struct mg_str method) {
+    for (int i = 0; i < METHOD_COUNT; i++) {
+        if (mg_vcmp(&method, method_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int new_node(const char *segment, size_t segment_len) {
+    if (num_nodes == ROUTER_MAX_NODES) {
+        return NO_NODE;
+    }
+    route_node_t *node = &nodes[num_nodes];
+    node->segment = segment;
+    node->segment_len = segment_len;
+    node->route = NULL;
+    node->first_child = NO_NODE;
+    node->next_sibling = NO_NODE;
+    node->param_child = NO_NODE;
+    return num_nodes++;
+}
+
+// Returns the child of parent for one pattern segment, creating it if needed.
+static int get_child(int parent, const char *seg, size_t len) {
+    if (len >= 2 && seg[0] == '{' && seg[len - 1] == '}') {
+        if (nodes[parent].param_child == NO_NODE) {
+            nodes[parent].param_child = new_node(seg + 1, len - 2);
+        }
+        return nodes[parent].param_child;
+    }
+    for (int child = nodes[parent].first_child; child != NO_NODE; child = nodes[child].next_sibling) {
+        if (nodes[child].segment_len == len && memcmp(nodes[child].segment, seg, len) == 0) {
+            return child;
+        }
+    }
+    int child = new_node(seg, len);
+    if (child != NO_NODE) {
+        nodes[child].next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = child;
+    }
+    return child;
+}
+
+int router_init(void) {
+    num_nodes = 0;
+    for (int m = 0; m < METHOD_COUNT; m++) {
+        method_roots[m] = new_node("", 0);
+    }
 
     for (size_t i = 0; i < num_routes; ++i) {
         const route_t *route = &routes[i];
-
-        // 1. Check if the HTTP method matches.
-        if (strcmp(hm->method.p, route->method) != 0) {
-            continue; // Method does not match, try the next route.
+        int m = method_index(mg_str(route->method));
+        if (m < 0 || route->pattern[0] != '/') {
+            fprintf(stderr, "Error: Invalid route %s %s.\n", route->method, route->pattern);
+            return -1;
         }
 
-        // 2. Check if the URI matches the route's specification.
-        if (route->exact_match) {
-            // For exact matches, compare the full URI string.
-            if (mg_vcmp(&hm->uri, route->uri_prefix) == 0) {
-                // Found an exact matching route, call its handler.
-                route->handler(c, hm);
-                return; // Request handled, exit dispatch.
+        // "/" is the root itself; otherwise every '/' starts a segment.
+        int node = method_roots[m];
+        if (route->pattern[1] != '\0') {
+            const char *seg = route->pattern + 1;
+            for (;;) {
+                const char *slash = strchr(seg, '/');
+                size_t len = slash ? (size_t)(slash - seg) : strlen(seg);
+                node = get_child(node, seg, len);
+                if (node == NO_NODE || slash == NULL) {
+                    break;
+                }
+                seg = slash + 1;
             }
-        } else {
-            // For prefix matches, check if the URI starts with the defined prefix.
-            // This is typically used for routes like /api/v1/items/{id}
-            if (hm->uri.len >= strlen(route->uri_prefix) &&
-                mg_vcmp(&hm->uri, route->uri_prefix) == 0) {
-                // Found a matching route prefix, call its handler.
-                // The handler will then be responsible for parsing any ID from the URI.
-                route->handler(c, hm);
-                return; // Request handled, exit dispatch.
+        }
+        if (node == NO_NODE) {
+            fprintf(stderr, "Error: Route table too large (max %d segments).\n", ROUTER_MAX_NODES);
+            return -1;
+        }
+        if (nodes[node].route != NULL) {
+            fprintf(stderr, "Error: Duplicate route %s %s.\n", route->method, route->pattern);
+            return -1;
+        }
+        nodes[node].route = route;
+    }
+    return 0;
+}
+
+// Matches the remaining path [p, end) below node. has_segment is 0 once the
+// whole path has been consumed. Literal children are tried before the
+// {param} child, backtracking if the literal branch does not lead to a route.
+static const route_t *match(int node, const char *p, const char *end, int has_segment, route_params_t *params) {
+    if (!has_segment) {
+        return nodes[node].route;
+    }
+    const char *slash = memchr(p, '/', (size_t)(end - p));
+    const char *seg_end = slash ? slash : end;
+    size_t len = (size_t)(seg_end - p);
+    const char *next = slash ? slash + 1 : end;
+    int has_next = slash != NULL;
+
+    for (int child = nodes[node].first_child; child != NO_NODE; child = nodes[child].next_sibling) {
+        if (nodes[child].segment_len == len && memcmp(nodes[child].segment, p, len) == 0) {
+            const route_t *route = match(child, next, end, has_next, params);
+            if (route != NULL) {
+                return route;
             }
+            break; // Literal segments are unique among siblings
+        }
+    }
+
+    int param = nodes[node].param_child;
+    if (param != NO_NODE && params->count < ROUTER_MAX_PARAMS) {
+        size_t saved = params->count;
+        route_param_t *item = &params->items[params->count++];
+        item->name = nodes[param].segment;
+        item->name_len = nodes[param].segment_len;
+        item->value = mg_str_n(p, len);
+        const route_t *route = match(param, next, end, has_next, params);
+        if (route != NULL) {
+            return route;
+        }
+        params->count = saved;
+    }
+    return NULL;
+}
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+// Returns the status code of the response queued at offset start of c->send,
+// or 0 if nothing was queued.
+static int queued_status(const struct mg_connection *c, size_t start) {
+    // "HTTP/1.1 200 ..." - the code is at a fixed position.
+    if (c->send.len < start + 12 || memcmp(c->send.buf + start, "HTTP/1.", 7) != 0) {
+        return 0;
+    }
+    const unsigned char *d = c->send.buf + start + 9;
+    return (d[0] - '0') * 100 + (d[1] - '0') * 10 + (d[2] - '0');
+}
+
+// Finds and runs the handler for a request. A request without a route gets a 404.
+// Returns the index of the matched route, or -1 if there was none.
+static int dispatch(struct mg_connection *c, struct mg_http_message *hm) {
+    int m = method_index(hm->method);
+    if (m >= 0 && hm->uri.len > 0 && hm->uri.p[0] == '/') {
+        route_params_t params;
+        params.count = 0;
+        const char *path = hm->uri.p + 1;
+        const char *end = hm->uri.p + hm->uri.len;
+        TRACE_BEGIN(routing);
+        const route_t *route = match(method_roots[m], path, end, path < end, &params);
+        TRACE_END(routing, "route");
+        if (route != NULL) {
+            route->handler(c, hm, &params);
+            return (int)(route - routes); // Request handled, exit dispatch.
         }
     }
 
-    // If the loop completes, no matching route was found.
+    // No matching route was found.
     // Send a 404 Not Found error response.
-    send_error_response(c, 404, "Not Found", "The requested resource or endpoint was not found on this server.");
+    send_static_response(c, RESP_ROUTE_NOT_FOUND);
+    return -1;
+}
+
+// What is recorded of a request with a deferred response, kept until the
+// response has been queued. The request itself is gone by then.
+typedef struct {
+    int route;
+    size_t bytes_in;
+    uint64_t t0;
+    size_t method_len;
+    size_t uri_len;
+    char text[]; // Method, then URI
+} deferred_record_t;
+
+// Keeps what is needed to record the request once its deferred response has
+// been queued. Returns 0 on success, or -1 if memory is exhausted.
+static int keep_deferred(conn_t *conn, struct mg_http_message *hm, int route, uint64_t t0) {
+    deferred_record_t *r = malloc(sizeof(*r) + hm->method.len + hm->uri.len);
+    if (r == NULL) {
+        return -1;
+    }
+    r->route = route;
+    r->bytes_in = hm->message.len;
+    r->t0 = t0;
+    r->method_len = hm->method.len;
+    r->uri_len = hm->uri.len;
+    memcpy(r->text, hm->method.p, hm->method.len);
+    memcpy(r->text + hm->method.len, hm->uri.p, hm->uri.len);
+    free(conn->deferred_record);
+    conn->deferred_record = r;
+    return 0;
+}
+
+// Function to dispatch an incoming HTTP request to the appropriate handler.
+// Every request is recorded in the metrics and the access log once the
+// handler has run, or for a deferred response once that has been queued.
+void router_dispatch(struct mg_connection *c, struct mg_http_message *hm) {
+    size_t start = c->send.len;
+    uint64_t t0 = monotonic_us();
+    TRACE_REQUEST_BEGIN(traced);
+    int route = dispatch(c, hm);
+    TRACE_REQUEST_END(traced, route >= 0 ? routes[route].pattern : "unmatched");
+    conn_t *conn = conn_get(c);
+    if (conn != NULL && conn->deferred && keep_deferred(conn, hm, route, t0) == 0) {
+        return;
+    }
+    uint64_t elapsed = monotonic_us() - t0;
+    int status = queued_status(c, start);
+    size_t bytes_out = c->send.len - start;
+    metrics_record_request(route, status, hm->message.len, bytes_out, elapsed);
+    log_access(hm->method, hm->uri, status, bytes_out, elapsed);
+}
+
+void router_record_deferred(struct mg_connection *c) {
+    conn_t *conn = conn_get(c);
+    deferred_record_t *r = conn != NULL ? conn->deferred_record : NULL;
+    if (r == NULL) {
+        return; // Recorded by router_dispatch() already
+    }
+    uint64_t elapsed = monotonic_us() - r->t0;
+    int status = queued_status(c, conn->response_start);
+    size_t bytes_out = c->send.len - conn->response_start;
+    metrics_record_request(r->route, status, r->bytes_in, bytes_out, elapsed);
+    log_access(mg_str_n(r->text, r->method_len), mg_str_n(r->text + r->method_len, r->uri_len), status, bytes_out,
+               elapsed);
+    free(r);
+    conn->deferred_record = NULL;
+}
+
+size_t router_route_count(void) {
+    return num_routes;
+}
+
+const route_t *router_route(size_t index) {
+    return &routes[index];
 }
 
+struct mg_str router_get_param(const route_params_t *params, const char *name) {
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < params->count; i++) {
+        if (params->items[i].name_len == name_len && memcmp(params->items[i].name, name, name_len) == 0) {
+            return params->items[i].value;
+        }
+    }
+    return mg_str_n(NULL, 0);
+}
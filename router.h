@@ -7,22 +7,57 @@
 
 #include "mongoose.h" // Required for struct mg_connection and mg_http_message
 
+// Maximum number of path parameters (e.g., {id}) in one route.
+#define ROUTER_MAX_PARAMS 4
+
+// A path parameter captured while matching a route.
+typedef struct {
+    const char *name;    // Parameter name from the route pattern (not null-terminated)
+    size_t name_len;
+    struct mg_str value; // Slice of the request URI (not null-terminated)
+} route_param_t;
+
+// Path parameters of a matched request, in pattern order.
+typedef struct {
+    route_param_t items[ROUTER_MAX_PARAMS];
+    size_t count;
+} route_params_t;
+
 // Define a function pointer type for request handlers.
 // All API handler functions must conform to this signature.
-typedef void (*request_handler_fn)(struct mg_connection *c, struct mg_http_message *hm);
+// params holds the path parameters captured by the route pattern.
+typedef void (*request_handler_fn)(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
 
 // Structure to define a single API route.
 typedef struct {
     const char *method;      // HTTP method (e.g., "GET", "POST", "PUT", "DELETE")
-    const char *uri_prefix;  // URI prefix for matching (e.g., "/api/items", "/api/items/")
-                             // Use an exact string for non-ID routes, or a prefix ending with '/' for ID-based routes.
-    int exact_match;         // 1 if the URI must match exactly, 0 if it's a prefix match.
+    const char *pattern;     // URI pattern (e.g., "/api/v1/items", "/api/v1/items/{id}").
+                             // A segment written as {name} matches any single path segment
+                             // and is captured as a parameter; all other segments match exactly.
     request_handler_fn handler; // Pointer to the handler function that will process this route.
 } route_t;
 
+// Compiles the route table into per-method tries. Must be called once at
+// startup, before the first router_dispatch().
+// Returns 0 on success, or -1 if the route table is invalid (already reported).
+int router_init(void);
+
 // Function to dispatch an incoming HTTP request to the appropriate handler.
-// This function iterates through the defined routes and calls the matching handler.
+// Matching walks the URI once, segment by segment, and captures path parameters.
 void router_dispatch(struct mg_connection *c, struct mg_http_message *hm);
 
-#endif // ROUTER_H
+// Records a request whose handler deferred its response (see
+// conn_defer_response()) in the metrics and the access log. Call once the
+// response has been queued, before conn_end_request().
+void router_record_deferred(struct mg_connection *c);
+
+// Returns the number of routes in the route table, and the route at index
+// (0 <= index < router_route_count()). Route indices identify routes in metrics.
+size_t router_route_count(void);
+const route_t *router_route(size_t index);
 
+// Returns the value of the path parameter called name, or an empty slice
+// (p == NULL) if the matched route has no such parameter.
+struct mg_str router_get_param(const route_params_t *params, const char *name);
+
+#endif // ROUTER_H
@@ -0,0 +1,694 @@
+// store.c
+// Implements the item store as STORE_SHARDS shards, each a dense, growable
+// array of records (the slab) plus an open-addressing index mapping ids to
+// array positions.
+//
+// The index uses linear probing, and every shard keeps it at least twice
+// as large as the records array, so its load factor stays at or below 1/2.
+// Deletion moves the last record into the freed position (one index update)
+// and closes the gap in the probe sequence by shifting later entries back,
+// so no tombstones accumulate.
+//
+// Readers take no lock. A shard's arrays are reached through one pointer to
+// a table_t, and every change made in place (insert, update, delete) is
+// bracketed by a sequence count that is odd while the change is under way.
+// A reader copies the item out and retries if the count was odd or moved,
+// so it never returns a half-written item. Growing a shard builds new arrays
+// next to the old ones and publishes them with a single pointer store; the
+// old ones are freed through qsbr once no reader can still be using them.
+// Readers bound every index probe and array position by the table they
+// loaded, so even a read that is later retried stays inside live memory.
+// Records and index slots that readers may be loading are read and written
+// with relaxed atomic word accesses: the sequence count makes a torn copy
+// harmless, but plain accesses to them would still be data races.
+//
+// After a warm start a shard's arrays may live in a private mapping of a
+// snapshot file (see store_adopt_image); they move to the heap the first
+// time the shard grows.
+//
+// The records are unordered, so every shard also keeps its ids in order: a
+// bitmap over id / STORE_SHARDS with summary levels above it (bit i of level
+// k + 1 is set if word i of level k is not zero). Finding the next id walks
+// up to the first level with a set bit further on and back down, so it costs
+// O(levels) no matter how many deleted ids lie in between. Writers update
+// it under the shard lock, readers walk it without one; it grows the way
+// tables do, by publishing a copy and retiring the old one.
+
+#define _POSIX_C_SOURCE 200809L // For pthread mutexes
+
+#include "store.h"     // Header for store declarations
+#include "qsbr.h"      // For retiring replaced arrays
+#include <limits.h>    // For INT_MAX
+#include <pthread.h>   // For the shard locks
+#include <stdatomic.h> // For the sequence counts, tables, id counter and version
+#include <stdint.h>    // For uint32_t, uint64_t
+#include <stdlib.h>    // For malloc, calloc, free
+#include <string.h>    // For strcpy, memcpy
+#include <sys/mman.h>  // For munmap
+
+// Marks an unused index slot.
+#define INDEX_EMPTY 0
+
+// Records a shard has room for when its first item arrives.
+#define SHARD_INITIAL_CAP 64
+
+// Ids an id order covers at first, per shard (a multiple of 64).
+#define ORDER_INITIAL_BITS 4096
+
+// Levels of an id order covering every int: 2^27 bits per shard take five.
+#define ORDER_MAX_LEVELS 6
+
+// A shard's arrays. The sizes never change; a shard that outgrows them gets
+// a new table.
+typedef struct {
+    item_t *records;  // Dense array of items
+    size_t cap;       // Allocated size of records
+    uint32_t *index;  // Position in records + 1, or INDEX_EMPTY
+    size_t index_cap; // Number of slots, a power of two, at least 2 * cap
+} table_t;
+
+// A shard's ids in ascending order (see the top of the file). Bit p of
+// level 0 is set if id p * STORE_SHARDS + shard is stored. The size never
+// changes; a shard that gets a higher id gets a new one.
+typedef struct {
+    size_t bits;                               // Positions covered by level 0
+    int levels;                                // The top level is one word
+    size_t num_words[ORDER_MAX_LEVELS];
+    _Atomic uint64_t *words[ORDER_MAX_LEVELS]; // Point into the same allocation
+} order_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint seq; // Odd while a writer changes the shard in place
+    _Atomic(table_t *) table;     // NULL until the shard's first item
+    _Atomic(order_t *) order;     // NULL until the shard's first item
+    atomic_size_t count;          // Number of items in records
+    pthread_mutex_t lock;         // Serializes the shard's writers
+    void *mapping;                // Adopted snapshot region holding the arrays, if any
+    size_t mapping_len;
+} shard_t;
+
+static shard_t shards[STORE_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static atomic_int next_item_id = 1; // Counter for assigning unique IDs
+static _Atomic uint64_t store_version_counter; // See store_version()
+
+static store_change_fn change_hook = NULL;
+
+static void init_shards(void) {
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+}
+
+static inline shard_t *shard_for(int id) {
+    return &shards[(unsigned) id & (STORE_SHARDS - 1)];
+}
+
+static void lock_shard(shard_t *sh) {
+    pthread_once(&shards_once, init_shards);
+    pthread_mutex_lock(&sh->lock);
+}
+
+// Fibonacci hashing spreads sequential ids over the table.
+static inline size_t slot_in(int id, size_t cap) {
+    return (size_t) (((uint32_t) id * 2654435769u) >> 7) & (cap - 1);
+}
+
+// Version for an item changed in a locked shard. Changes to one item are
+// serialized by its shard lock, and each raises the store version after it
+// has been made, so an item's versions strictly increase.
+static inline uint64_t item_version(void) {
+    return atomic_load_explicit(&store_version_counter, memory_order_relaxed) + 1;
+}
+
+// Raises the store version once a change has become visible to readers.
+static inline void publish_version(void) {
+    atomic_fetch_add_explicit(&store_version_counter, 1, memory_order_seq_cst);
+}
+
+// Opens and closes a change made in place. Readers that overlap it retry.
+static inline void write_begin(shard_t *sh) {
+    atomic_store_explicit(&sh->seq, atomic_load_explicit(&sh->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void write_end(shard_t *sh) {
+    atomic_store_explicit(&sh->seq, atomic_load_explicit(&sh->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// A word of a record, for the atomic copies; may alias the record's fields.
+typedef uint64_t __attribute__((may_alias)) record_word_t;
+
+_Static_assert(sizeof(item_t) % sizeof(record_word_t) == 0 && _Alignof(item_t) >= _Alignof(record_word_t),
+               "records are copied in whole words");
+
+#define RECORD_WORDS (sizeof(item_t) / sizeof(record_word_t))
+
+// Copies a record that a writer may be changing.
+static inline void record_load(const item_t *src, item_t *dst) {
+    const record_word_t *s = (const record_word_t *) src;
+    record_word_t *d = (record_word_t *) dst;
+    for (size_t i = 0; i < RECORD_WORDS; i++) {
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Overwrites a record that readers may be loading. For writers.
+static inline void record_store(item_t *dst, const item_t *src) {
+    record_word_t *d = (record_word_t *) dst;
+    const record_word_t *s = (const record_word_t *) src;
+    for (size_t i = 0; i < RECORD_WORDS; i++) {
+        __atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Sets an index slot that readers may be loading. For writers.
+static inline void index_store(uint32_t *slot, uint32_t pos) {
+    __atomic_store_n(slot, pos, __ATOMIC_RELAXED);
+}
+
+static void release_heap(void *ptr, size_t len) {
+    (void) len;
+    free(ptr);
+}
+
+static void release_mapping(void *ptr, size_t len) {
+    munmap(ptr, len);
+}
+
+// Allocates an empty id order covering bits positions (a multiple of 64).
+static order_t *order_alloc(size_t bits) {
+    size_t num_words[ORDER_MAX_LEVELS];
+    size_t total = 0;
+    int levels = 0;
+    size_t n = bits / 64;
+    for (;;) {
+        num_words[levels++] = n;
+        total += n;
+        if (n == 1) {
+            break;
+        }
+        n = (n + 63) / 64;
+    }
+    order_t *o = calloc(1, sizeof(*o) + total * sizeof(uint64_t));
+    if (o == NULL) {
+        return NULL;
+    }
+    _Atomic uint64_t *w = (_Atomic uint64_t *) (o + 1);
+    o->bits = bits;
+    o->levels = levels;
+    for (int k = 0; k < levels; k++) {
+        o->num_words[k] = num_words[k];
+        o->words[k] = w;
+        w += num_words[k];
+    }
+    return o;
+}
+
+// Sets bit pos of level k and the summary bits above it. For the shard's writer.
+static void order_mark(order_t *o, int k, size_t pos) {
+    for (; k < o->levels; k++, pos /= 64) {
+        _Atomic uint64_t *w = &o->words[k][pos / 64];
+        uint64_t old = atomic_load_explicit(w, memory_order_relaxed);
+        atomic_store_explicit(w, old | (uint64_t) 1 << (pos % 64), memory_order_relaxed);
+        if (old != 0) {
+            break; // The levels above already mark this word
+        }
+    }
+}
+
+static void order_set(order_t *o, size_t pos) {
+    order_mark(o, 0, pos);
+}
+
+// Marks position pos as clear, and every summary bit whose word became
+// empty. For the shard's writer.
+static void order_clear(order_t *o, size_t pos) {
+    for (int k = 0; k < o->levels; k++, pos /= 64) {
+        _Atomic uint64_t *w = &o->words[k][pos / 64];
+        uint64_t now = atomic_load_explicit(w, memory_order_relaxed) & ~((uint64_t) 1 << (pos % 64));
+        atomic_store_explicit(w, now, memory_order_relaxed);
+        if (now != 0) {
+            break;
+        }
+    }
+}
+
+// Returns the first set position at or after pos, or SIZE_MAX if none.
+// Safe to call while the shard's writer changes the order: a summary bit is
+// only cleared once its word is empty, so positions that stay set are found.
+static size_t order_next(const order_t *o, size_t pos) {
+    while (pos < o->bits) {
+        // Up: the first level where the rest of pos's word has a set bit.
+        int k = 0;
+        uint64_t w;
+        for (;;) {
+            w = atomic_load_explicit(&o->words[k][pos / 64], memory_order_relaxed) & (~(uint64_t) 0 << (pos % 64));
+            if (w != 0) {
+                break;
+            }
+            pos = pos / 64 + 1; // The next word, as a position of the level above
+            if (++k == o->levels || pos / 64 >= o->num_words[k]) {
+                return SIZE_MAX;
+            }
+        }
+        pos = (pos & ~(size_t) 63) + (size_t) __builtin_ctzll(w);
+        // Down: the first set bit of each word below.
+        while (k > 0) {
+            w = atomic_load_explicit(&o->words[--k][pos], memory_order_relaxed);
+            if (w == 0) {
+                break; // Emptied meanwhile; go on after it
+            }
+            pos = pos * 64 + (size_t) __builtin_ctzll(w);
+        }
+        if (w != 0) {
+            return pos;
+        }
+        pos = (pos + 1) << (6 * (k + 1));
+    }
+    return SIZE_MAX;
+}
+
+// Position of id in its shard's order.
+static inline size_t order_pos(int id) {
+    return (size_t) id / STORE_SHARDS;
+}
+
+// Makes a locked shard's order cover id, moving it to a larger copy if
+// needed. Returns 0 on success, or -1 if memory is exhausted.
+static int reserve_order(shard_t *sh, int id) {
+    order_t *old = atomic_load_explicit(&sh->order, memory_order_relaxed);
+    size_t pos = order_pos(id);
+    if (old != NULL && pos < old->bits) {
+        return 0;
+    }
+    size_t bits = old != NULL ? old->bits * 2 : ORDER_INITIAL_BITS;
+    while (bits <= pos) {
+        bits *= 2;
+    }
+    order_t *o = order_alloc(bits);
+    if (o == NULL) {
+        return -1;
+    }
+    if (old != NULL) {
+        for (size_t i = 0; i < old->num_words[0]; i++) {
+            uint64_t w = atomic_load_explicit(&old->words[0][i], memory_order_relaxed);
+            atomic_store_explicit(&o->words[0][i], w, memory_order_relaxed);
+            if (w != 0) {
+                order_mark(o, 1, i);
+            }
+        }
+        qsbr_retire(old, 0, release_heap);
+    }
+    atomic_store_explicit(&sh->order, o, memory_order_release);
+    return 0;
+}
+
+// Returns the index slot holding id, or the empty slot where it would go.
+// For writers, with the shard locked.
+static size_t find_slot(const table_t *t, int id) {
+    size_t slot = slot_in(id, t->index_cap);
+    while (t->index[slot] != INDEX_EMPTY && t->records[t->index[slot] - 1].id != id) {
+        slot = (slot + 1) & (t->index_cap - 1);
+    }
+    return slot;
+}
+
+// Returns the item with id in a locked shard, or NULL.
+static item_t *find_locked(shard_t *sh, int id) {
+    table_t *t = atomic_load_explicit(&sh->table, memory_order_relaxed);
+    if (t == NULL) {
+        return NULL;
+    }
+    uint32_t pos = t->index[find_slot(t, id)];
+    return pos == INDEX_EMPTY ? NULL : &t->records[pos - 1];
+}
+
+static void notify(int id, const item_t *item) {
+    if (change_hook != NULL) {
+        change_hook(id, item);
+    }
+}
+
+void store_build_index(const item_t *items, size_t count, uint32_t *slots, size_t cap) {
+    memset(slots, 0, cap * sizeof(*slots));
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = slot_in(items[i].id, cap);
+        while (slots[slot] != INDEX_EMPTY) {
+            slot = (slot + 1) & (cap - 1);
+        }
+        slots[slot] = (uint32_t) (i + 1);
+    }
+}
+
+// Moves a locked shard to a table with room for new_cap records and
+// publishes it. Readers keep using the old table until they next load the
+// pointer; it is retired, not freed.
+static int grow_shard(shard_t *sh, size_t new_cap) {
+    table_t *old = atomic_load_explicit(&sh->table, memory_order_relaxed);
+    size_t count = atomic_load_explicit(&sh->count, memory_order_relaxed);
+    table_t *t = malloc(sizeof(*t));
+    item_t *records = malloc(new_cap * sizeof(*records));
+    uint32_t *index = malloc(2 * new_cap * sizeof(*index));
+    if (t == NULL || records == NULL || index == NULL) {
+        free(t);
+        free(records);
+        free(index);
+        return -1;
+    }
+    if (count > 0) {
+        memcpy(records, old->records, count * sizeof(*records));
+    }
+    t->records = records;
+    t->cap = new_cap;
+    t->index = index;
+    t->index_cap = 2 * new_cap;
+    store_build_index(records, count, index, t->index_cap);
+    atomic_store_explicit(&sh->table, t, memory_order_release);
+
+    if (old != NULL) {
+        if (sh->mapping != NULL) {
+            qsbr_retire(sh->mapping, sh->mapping_len, release_mapping);
+            sh->mapping = NULL;
+            sh->mapping_len = 0;
+        } else {
+            qsbr_retire(old->records, 0, release_heap);
+            qsbr_retire(old->index, 0, release_heap);
+        }
+        qsbr_retire(old, 0, release_heap);
+    }
+    return 0;
+}
+
+// Makes room for one more record, with the given id, in a locked shard.
+// Returns the table, or NULL.
+static table_t *reserve_one(shard_t *sh, int id) {
+    table_t *t = atomic_load_explicit(&sh->table, memory_order_relaxed);
+    size_t count = atomic_load_explicit(&sh->count, memory_order_relaxed);
+    if (count >= UINT32_MAX - 1 || reserve_order(sh, id) != 0) {
+        return NULL; // Index positions or memory exhausted
+    }
+    if (t == NULL || count == t->cap) {
+        if (grow_shard(sh, t ? t->cap * 2 : SHARD_INITIAL_CAP) != 0) {
+            return NULL;
+        }
+        t = atomic_load_explicit(&sh->table, memory_order_relaxed);
+    }
+    return t;
+}
+
+// Appends a record for id to a locked shard with room for it; the id must
+// not be stored yet.
+static item_t *append_record(shard_t *sh, table_t *t, int id, const char *name, int value) {
+    size_t count = atomic_load_explicit(&sh->count, memory_order_relaxed);
+    uint64_t version = item_version();
+    item_t rec = {.id = id, .value = value, .version = version};
+    strcpy(rec.name, name); // Caller guarantees the length
+    write_begin(sh);
+    item_t *item = &t->records[count];
+    record_store(item, &rec);
+    index_store(&t->index[find_slot(t, id)], (uint32_t) (count + 1));
+    atomic_store_explicit(&sh->count, count + 1, memory_order_relaxed);
+    write_end(sh);
+    order_set(atomic_load_explicit(&sh->order, memory_order_relaxed), order_pos(id));
+    publish_version();
+    return item;
+}
+
+// Copies the item with id out of one table. Every value is read once and
+// bounds-checked, since a writer may be changing the table meanwhile; the
+// caller's sequence check decides whether the copy counts.
+static int read_item(const table_t *t, int id, item_t *out) {
+    size_t slot = slot_in(id, t->index_cap);
+    for (size_t probes = 0; probes < t->index_cap; probes++) {
+        uint32_t pos = __atomic_load_n(&t->index[slot], __ATOMIC_RELAXED);
+        if (pos == INDEX_EMPTY) {
+            return -1;
+        }
+        if (pos <= t->cap) {
+            item_t rec;
+            record_load(&t->records[pos - 1], &rec);
+            if (rec.id == id) {
+                *out = rec;
+                return 0;
+            }
+        }
+        slot = (slot + 1) & (t->index_cap - 1);
+    }
+    return -1;
+}
+
+int store_get(int id, item_t *out) {
+    shard_t *sh = shard_for(id);
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&sh->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue; // A change is under way; it takes a few stores
+        }
+        const table_t *t = atomic_load_explicit(&sh->table, memory_order_acquire);
+        int rc = t != NULL ? read_item(t, id, out) : -1;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&sh->seq, memory_order_relaxed) == seq) {
+            return rc;
+        }
+    }
+}
+
+int store_insert(const char *name, int value, item_t *out) {
+    int id = atomic_load_explicit(&next_item_id, memory_order_relaxed);
+    do {
+        if (id == INT_MAX) {
+            return -1; // Ids exhausted
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&next_item_id, &id, id + 1, memory_order_relaxed, memory_order_relaxed));
+
+    shard_t *sh = shard_for(id);
+    lock_shard(sh);
+    table_t *t = reserve_one(sh, id);
+    item_t *item = t != NULL ? append_record(sh, t, id, name, value) : NULL;
+    if (item != NULL) {
+        notify(id, item);
+        if (out != NULL) {
+            *out = *item;
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return item != NULL ? 0 : -1;
+}
+
+// Changes an item of a locked shard in place.
+static void update_record(shard_t *sh, item_t *item, const char *name, const int *value) {
+    item_t rec = *item;
+    if (name != NULL) {
+        strcpy(rec.name, name); // Caller guarantees the length
+    }
+    if (value != NULL) {
+        rec.value = *value;
+    }
+    rec.version = item_version();
+    write_begin(sh);
+    record_store(item, &rec);
+    write_end(sh);
+    publish_version();
+}
+
+int store_update(int id, const char *name, const int *value, item_t *out) {
+    shard_t *sh = shard_for(id);
+    lock_shard(sh);
+    item_t *item = find_locked(sh, id);
+    if (item != NULL) {
+        update_record(sh, item, name, value);
+        notify(id, item);
+        if (out != NULL) {
+            *out = *item;
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return item != NULL ? 0 : -1;
+}
+
+int store_put(int id, const char *name, int value) {
+    if (id <= 0 || id == INT_MAX) {
+        return -1;
+    }
+    int next = atomic_load_explicit(&next_item_id, memory_order_relaxed);
+    while (next <= id && !atomic_compare_exchange_weak_explicit(&next_item_id, &next, id + 1, memory_order_relaxed, memory_order_relaxed)) {
+        // next was reloaded; retry unless another thread raised it past id
+    }
+
+    shard_t *sh = shard_for(id);
+    lock_shard(sh);
+    item_t *item = find_locked(sh, id);
+    if (item != NULL) {
+        update_record(sh, item, name, &value);
+    } else {
+        table_t *t = reserve_one(sh, id);
+        item = t != NULL ? append_record(sh, t, id, name, value) : NULL;
+    }
+    if (item != NULL) {
+        notify(id, item);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return item != NULL ? 0 : -1;
+}
+
+int store_delete(int id) {
+    shard_t *sh = shard_for(id);
+    lock_shard(sh);
+    table_t *t = atomic_load_explicit(&sh->table, memory_order_relaxed);
+    size_t slot = t != NULL ? find_slot(t, id) : 0;
+    if (t == NULL || t->index[slot] == INDEX_EMPTY) {
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+    }
+    size_t pos = t->index[slot] - 1;
+
+    write_begin(sh);
+    // Move the last record into the freed position and repoint its index
+    // slot. The slot is found first: once records[pos] holds the moved id,
+    // the deleted id's slot (still pointing at pos) would match it too.
+    size_t last = atomic_load_explicit(&sh->count, memory_order_relaxed) - 1;
+    if (pos != last) {
+        size_t moved = find_slot(t, t->records[last].id);
+        record_store(&t->records[pos], &t->records[last]);
+        index_store(&t->index[moved], (uint32_t) (pos + 1));
+    }
+    atomic_store_explicit(&sh->count, last, memory_order_relaxed);
+
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole if their home slot does not lie strictly between hole and entry.
+    size_t mask = t->index_cap - 1;
+    size_t hole = slot;
+    size_t next = (hole + 1) & mask;
+    while (t->index[next] != INDEX_EMPTY) {
+        size_t home = slot_in(t->records[t->index[next] - 1].id, t->index_cap);
+        int movable = (next > hole) ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            index_store(&t->index[hole], t->index[next]);
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index_store(&t->index[hole], INDEX_EMPTY);
+    write_end(sh);
+    order_clear(atomic_load_explicit(&sh->order, memory_order_relaxed), order_pos(id));
+    publish_version();
+
+    notify(id, NULL);
+    pthread_mutex_unlock(&sh->lock);
+    return 0;
+}
+
+// Advances it->next[shard] to the shard's first stored id at or after it.
+static void iter_seek(store_iter_t *it, int shard) {
+    if (it->next[shard] == 0) {
+        return;
+    }
+    const order_t *o = atomic_load_explicit(&shards[shard].order, memory_order_acquire);
+    size_t pos = o != NULL ? order_next(o, order_pos(it->next[shard])) : SIZE_MAX;
+    it->next[shard] = pos <= (size_t) INT_MAX / STORE_SHARDS ? (int) (pos * STORE_SHARDS) + shard : 0;
+}
+
+void store_iter_init(store_iter_t *it, int after_id) {
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        // The shard's first id after after_id.
+        long long first = (long long) after_id + 1;
+        long long id = first + ((i - first) & (STORE_SHARDS - 1));
+        it->next[i] = id > INT_MAX ? 0 : (int) id;
+        iter_seek(it, i);
+    }
+}
+
+int store_iter_next(store_iter_t *it) {
+    int best = -1;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        if (it->next[i] != 0 && (best < 0 || it->next[i] < it->next[best])) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        return 0;
+    }
+    int id = it->next[best];
+    it->next[best] = id <= INT_MAX - STORE_SHARDS ? id + STORE_SHARDS : 0;
+    iter_seek(it, best);
+    return id;
+}
+
+int store_max_id(void) {
+    return atomic_load_explicit(&next_item_id, memory_order_relaxed) - 1;
+}
+
+uint64_t store_version(void) {
+    return atomic_load_explicit(&store_version_counter, memory_order_seq_cst);
+}
+
+size_t store_count(void) {
+    size_t total = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        total += atomic_load_explicit(&shards[i].count, memory_order_relaxed);
+    }
+    return total;
+}
+
+void store_set_change_hook(store_change_fn fn) {
+    change_hook = fn;
+}
+
+void store_lock_all(void) {
+    pthread_once(&shards_once, init_shards);
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+    }
+}
+
+void store_unlock_all(void) {
+    for (int i = STORE_SHARDS - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+void store_get_image(int shard, store_image_t *image) {
+    const table_t *t = atomic_load_explicit(&shards[shard].table, memory_order_relaxed);
+    image->records = t ? t->records : NULL;
+    image->count = atomic_load_explicit(&shards[shard].count, memory_order_relaxed);
+    image->cap = t ? t->cap : 0;
+    image->index = t ? t->index : NULL;
+    image->index_cap = t ? t->index_cap : 0;
+}
+
+int store_adopt_image(int shard, const store_image_t *image, void *region, size_t region_len, int next_id,
+                      uint64_t version) {
+    shard_t *sh = &shards[shard];
+    int max_id = 0;
+    for (size_t i = 0; i < image->count; i++) {
+        if (image->records[i].id > max_id) {
+            max_id = image->records[i].id;
+        }
+    }
+    table_t *t = malloc(sizeof(*t));
+    if (t == NULL || reserve_order(sh, max_id) != 0) {
+        free(t);
+        return -1;
+    }
+    order_t *o = atomic_load_explicit(&sh->order, memory_order_relaxed);
+    for (size_t i = 0; i < image->count; i++) {
+        order_set(o, order_pos(image->records[i].id));
+    }
+    t->records = image->records;
+    t->cap = image->cap;
+    t->index = image->index;
+    t->index_cap = image->index_cap;
+    atomic_store_explicit(&sh->table, t, memory_order_release);
+    atomic_store_explicit(&sh->count, image->count, memory_order_relaxed);
+    sh->mapping = region;
+    sh->mapping_len = region_len;
+    if (next_id > atomic_load_explicit(&next_item_id, memory_order_relaxed)) {
+        atomic_store_explicit(&next_item_id, next_id, memory_order_relaxed);
+    }
+    if (version > atomic_load_explicit(&store_version_counter, memory_order_relaxed)) {
+        atomic_store_explicit(&store_version_counter, version, memory_order_relaxed);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+// store.h
+// In-memory item store, sharded by id. Each shard is a dense array of
+// records plus a hash index by id; lookup, insert and delete are O(1) on
+// average.
+//
+// Reads are lock-free: they copy an item out and retry if a writer changed
+// the shard meanwhile (see store.c), so any number of threads can read in
+// parallel. Writes take the mutex of the item's shard only. Threads that
+// read while others write must be registered with qsbr (see qsbr.h).
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint32_t, uint64_t
+
+// Size of the name buffer of an item, including the null terminator.
+#define ITEM_NAME_SIZE 64
+
+// Number of shards (a power of two). id % STORE_SHARDS picks the shard.
+#define STORE_SHARDS 16
+
+// Structure to represent an item in our "database".
+typedef struct {
+    int id;
+    char name[ITEM_NAME_SIZE]; // Fixed-size buffer for item name
+    int value;
+    uint64_t version; // Raised by every change of the item (see store_version())
+} item_t;
+
+// Copies the item with the given id into *out.
+// Returns 0 on success, or -1 if there is no such item.
+int store_get(int id, item_t *out);
+
+// Adds an item with a newly assigned id and copies it into *out (if not
+// NULL). name must be shorter than ITEM_NAME_SIZE.
+// Returns 0 on success, or -1 if ids or memory are exhausted.
+int store_insert(const char *name, int value, item_t *out);
+
+// Changes the name (unless name is NULL) and the value (unless value is
+// NULL) of the item with the given id, and copies the result into *out (if
+// not NULL). name must be shorter than ITEM_NAME_SIZE.
+// Returns 0 on success, or -1 if there is no such item.
+int store_update(int id, const char *name, const int *value, item_t *out);
+
+// Stores an item under a given id, replacing any item with that id, and
+// makes sure later store_insert() calls assign higher ids. Used to replay
+// the write-ahead log. Returns 0 on success, or -1 if memory is exhausted.
+int store_put(int id, const char *name, int value);
+
+// Removes the item with the given id. The last record of its shard is moved
+// into the freed slot, so the arrays stay dense.
+// Returns 0 on success, or -1 if there is no such item.
+int store_delete(int id);
+
+// A walk over the stored ids in ascending order.
+typedef struct {
+    int next[STORE_SHARDS]; // Next stored id of each shard, 0 if none
+} store_iter_t;
+
+// Starts a walk at the first id after after_id.
+void store_iter_init(store_iter_t *it, int after_id);
+
+// Returns the next id of the walk, or 0 at its end. Each call costs O(1)
+// plus a seek that deleted ids do not slow down. Ids stored or deleted
+// while the walk runs may or may not show up, so the caller reads each with
+// store_get(). The walk holds no references into the store.
+int store_iter_next(store_iter_t *it);
+
+// Returns the highest id assigned so far (0 if none). Every stored item has
+// an id between 1 and this value, so walking that range with store_get()
+// visits the items in ascending id order.
+int store_max_id(void);
+
+// Number of items.
+size_t store_count(void);
+
+// Returns the store version, a counter that every insert, update and delete
+// raises, so an unchanged version means an unchanged store. It is raised
+// once the change is visible: whatever is read after loading version v
+// includes every change up to v (and possibly later ones).
+uint64_t store_version(void);
+
+// Called after every change, with the item's shard still locked, so calls
+// for one id arrive in the order of the changes. item is the stored item, or
+// NULL if id was deleted. Used by the write-ahead log (see persist.c).
+typedef void (*store_change_fn)(int id, const item_t *item);
+void store_set_change_hook(store_change_fn fn);
+
+// One shard's arrays as they are laid out in memory (see store.c). Snapshots
+// are written in this layout so that they can be adopted without a rebuild.
+typedef struct {
+    item_t *records;    // count used entries, room for cap
+    size_t count;
+    size_t cap;
+    uint32_t *index;    // index_cap slots: position in records + 1, or 0
+    size_t index_cap;   // A power of two, at least twice cap
+} store_image_t;
+
+// Lock every shard against writers (readers carry on), e.g. to take a
+// consistent copy of the whole store.
+void store_lock_all(void);
+void store_unlock_all(void);
+
+// Returns views of a shard's live arrays; store_lock_all() must be held.
+void store_get_image(int shard, store_image_t *image);
+
+// Fills index (index_cap slots, a power of two) for records[0..count) the way
+// the store would, so that a snapshot can carry a roomier index than the live one.
+void store_build_index(const item_t *records, size_t count, uint32_t *index, size_t index_cap);
+
+// Makes an image a shard's contents, replacing the (empty) shard. The
+// arrays must lie inside region, a page-aligned part of a private mapping
+// that the shard takes over: they are used in place and copied to the heap,
+// and the region unmapped, only once the shard needs to grow them. Raises
+// the next id to at least next_id and the store version to at least version
+// (no lower than that of any adopted item). Used to warm-start from an
+// mmapped snapshot, before any other thread uses the store.
+// Returns 0 on success, or -1 on allocation failure.
+int store_adopt_image(int shard, const store_image_t *image, void *region, size_t region_len, int next_id,
+                      uint64_t version);
+
+#endif // STORE_H
@@ -0,0 +1,94 @@
+// store_test.c
+// Regression tests for the item store: deletes that move a record whose
+// probe run passes the deleted id's index slot, and random churn checked
+// against a model of which ids are stored.
+// Run with: make check
+
+#define _POSIX_C_SOURCE 200809L // For rand_r
+
+#include "store.h" // The store under test
+#include "qsbr.h"  // Readers must be registered
+#include <stdio.h>  // For printf, fprintf
+#include <stdlib.h> // For EXIT_FAILURE, EXIT_SUCCESS, rand_r
+#include <string.h> // For memset
+
+// Ids the churn test uses; they all fall into one shard.
+#define CHURN_IDS 8192
+#define CHURN_LIVE 2000
+#define CHURN_ROUNDS 300000
+
+static int s_failures = 0;
+
+#define CHECK(cond)                                                               \
+    do {                                                                          \
+        if (!(cond)) {                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            s_failures++;                                                         \
+        }                                                                         \
+    } while (0)
+
+// Ids 16 and 2208 share a shard and an index slot; deleting 16, which is
+// not the last record, moves 2208 into its position.
+static void test_delete_colliding(void) {
+    item_t item;
+    CHECK(store_put(16, "a", 1) == 0);
+    CHECK(store_put(2208, "b", 2) == 0);
+    CHECK(store_delete(16) == 0);
+    CHECK(store_put(48, "c", 3) == 0);
+    CHECK(store_get(2208, &item) == 0 && item.value == 2);
+    CHECK(store_get(48, &item) == 0 && item.value == 3);
+    CHECK(store_get(16, &item) == -1);
+    CHECK(store_delete(2208) == 0);
+    CHECK(store_delete(48) == 0);
+    CHECK(store_count() == 0);
+}
+
+// Inserts and deletes ids of one shard at random, keeping about CHURN_LIVE
+// stored, and checks every stored id is found and the count matches.
+static void test_churn(void) {
+    static unsigned char live[CHURN_IDS];
+    memset(live, 0, sizeof(live));
+    unsigned seed = 1;
+    size_t count = 0;
+    for (int round = 0; round < CHURN_ROUNDS; round++) {
+        int slot = rand_r(&seed) % CHURN_IDS;
+        int id = 1 + slot * STORE_SHARDS; // Same shard for every id
+        if (live[slot] || count >= CHURN_LIVE) {
+            if (live[slot]) {
+                CHECK(store_delete(id) == 0);
+                live[slot] = 0;
+                count--;
+            }
+        } else {
+            CHECK(store_put(id, "x", slot) == 0);
+            live[slot] = 1;
+            count++;
+        }
+    }
+    CHECK(store_count() == count);
+    item_t item;
+    for (int slot = 0; slot < CHURN_IDS; slot++) {
+        int found = store_get(1 + slot * STORE_SHARDS, &item) == 0;
+        CHECK(found == live[slot]);
+        if (found) {
+            CHECK(item.value == slot);
+        }
+    }
+}
+
+int main(void) {
+    if (qsbr_register() != 0) {
+        fprintf(stderr, "Error: Failed to register as a store reader.\n");
+        return EXIT_FAILURE;
+    }
+    test_delete_colliding();
+    test_churn();
+    qsbr_unregister();
+    qsbr_drain();
+    if (s_failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", s_failures);
+        return EXIT_FAILURE;
+    }
+    printf("store tests passed\n");
+    return EXIT_SUCCESS;
+}
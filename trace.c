@@ -0,0 +1,282 @@
+// trace.c
+// Implements sampled request tracing and the trace dump endpoint.
+//
+// A ring is written only by its own thread: a span goes into the slot at
+// head % TRACE_RING_SIZE, then head is advanced. A dump on another thread
+// reads head, copies the spans before it, and drops those the writer may
+// have overwritten meanwhile (a ring or more behind the head read after the
+// copy). Span fields are relaxed atomics, as the counters in metrics.c, so a
+// dump never reads torn values.
+//
+// Times are ticks of the cycle counter (rdtsc on x86-64, the virtual counter
+// on AArch64, CLOCK_MONOTONIC nanoseconds elsewhere). A dump converts them
+// to microseconds with the tick rate measured since the first registration.
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "trace.h"       // Header for trace declarations
+#include "json_writer.h" // For writing the dump
+#include "utils.h"       // For send_error_response
+#include "arena.h"       // For the span copies of a dump
+#include <pthread.h>     // For the registry lock
+#include <stdatomic.h>   // For the rings
+#include <stdio.h>       // For snprintf
+#include <stdlib.h>      // For calloc, free
+#include <time.h>        // For clock_gettime
+#if defined(__x86_64__)
+#include <x86intrin.h>   // For __rdtsc
+#endif
+
+// Typical size of one dumped span, used to presize the response.
+#define TRACE_SPAN_JSON_SIZE_GUESS 120
+
+typedef struct {
+    _Atomic uint64_t start;
+    _Atomic uint64_t end;
+    _Atomic uint64_t request; // Number of the traced request within its thread
+    _Atomic(const char *) name;
+} trace_span_t;
+
+// A copy of a span, taken by a dump.
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t request;
+    const char *name;
+} span_copy_t;
+
+typedef struct trace_ring {
+    trace_span_t spans[TRACE_RING_SIZE];
+    _Atomic uint64_t head;   // Spans recorded so far
+    int index;               // Thread number in the dump
+    uint64_t requests;       // Requests traced so far (owner only)
+    unsigned countdown;      // Requests until the next traced one (owner only)
+    struct trace_ring *next;
+} trace_ring_t;
+
+static unsigned s_sample_every = 0;
+static _Thread_local trace_ring_t *s_mine = NULL;
+static _Thread_local int s_tracing = 0; // A traced request is running
+static trace_ring_t *s_all = NULL;
+static int s_num_rings = 0;
+static pthread_mutex_t s_all_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Tick count and time of the first registration, for converting ticks.
+static uint64_t s_base_ticks;
+static uint64_t s_base_ns;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return monotonic_ns();
+#endif
+}
+
+void trace_set_sample(unsigned every) {
+    s_sample_every = every;
+}
+
+int trace_register_thread(void) {
+#if TRACE_ENABLED
+    trace_ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return -1;
+    }
+    r->countdown = s_sample_every;
+    pthread_mutex_lock(&s_all_lock);
+    if (s_all == NULL) {
+        s_base_ticks = ticks();
+        s_base_ns = monotonic_ns();
+    }
+    r->index = s_num_rings++;
+    r->next = s_all;
+    s_all = r;
+    pthread_mutex_unlock(&s_all_lock);
+    s_mine = r;
+#endif
+    return 0;
+}
+
+void trace_free_all(void) {
+    pthread_mutex_lock(&s_all_lock);
+    while (s_all != NULL) {
+        trace_ring_t *next = s_all->next;
+        free(s_all);
+        s_all = next;
+    }
+    s_num_rings = 0;
+    pthread_mutex_unlock(&s_all_lock);
+}
+
+// Appends a span to the calling thread's ring.
+static void record(trace_ring_t *r, uint64_t start, uint64_t end, const char *name) {
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_span_t *s = &r->spans[h & (TRACE_RING_SIZE - 1)];
+    // A dump that sees any of the stores below also sees the head that
+    // made the slot's previous span stale.
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->start, start, memory_order_relaxed);
+    atomic_store_explicit(&s->end, end, memory_order_relaxed);
+    atomic_store_explicit(&s->request, r->requests, memory_order_relaxed);
+    atomic_store_explicit(&s->name, name, memory_order_relaxed);
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+uint64_t trace_request_begin(void) {
+    trace_ring_t *r = s_mine;
+    if (r == NULL || s_sample_every == 0 || --r->countdown != 0) {
+        return 0;
+    }
+    r->countdown = s_sample_every;
+    r->requests++;
+    s_tracing = 1;
+    return ticks();
+}
+
+void trace_request_end(uint64_t start, const char *name) {
+    if (start == 0) {
+        return;
+    }
+    record(s_mine, start, ticks(), name);
+    s_tracing = 0;
+}
+
+uint64_t trace_span_begin(void) {
+    return s_tracing ? ticks() : 0;
+}
+
+void trace_span_end(uint64_t start, const char *name) {
+    if (start != 0) {
+        record(s_mine, start, ticks(), name);
+    }
+}
+
+// Copies the spans of a ring that are still intact into out (room for
+// TRACE_RING_SIZE). Returns their number.
+static size_t copy_ring(trace_ring_t *r, span_copy_t *out) {
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    for (uint64_t i = first; i < head; i++) {
+        const trace_span_t *s = &r->spans[i & (TRACE_RING_SIZE - 1)];
+        span_copy_t *o = &out[i - first];
+        o->start = atomic_load_explicit(&s->start, memory_order_relaxed);
+        o->end = atomic_load_explicit(&s->end, memory_order_relaxed);
+        o->request = atomic_load_explicit(&s->request, memory_order_relaxed);
+        o->name = atomic_load_explicit(&s->name, memory_order_relaxed);
+    }
+    // Spans the writer has started to overwrite since are dropped.
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t now = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t intact = now >= TRACE_RING_SIZE ? now - TRACE_RING_SIZE + 1 : 0;
+    size_t skip = intact > first ? (size_t) (intact - first) : 0;
+    size_t count = (size_t) (head - first);
+    if (skip >= count) {
+        return 0;
+    }
+    for (size_t i = skip; i < count; i++) {
+        out[i - skip] = out[i];
+    }
+    return count - skip;
+}
+
+// Writes a number of microseconds as a JSON value.
+static void write_us(json_writer_t *w, double us) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.3f", us);
+    jw_raw(w, buf, (size_t) n);
+}
+
+// Handles GET requests to "/api/v1/admin/trace".
+// Responds with {"traceEvents":[...],"displayTimeUnit":"ns"}: one complete
+// ("X") event per span, on one track per event loop thread, with the number
+// of its request within the thread in args.request.
+void handle_get_trace(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params) {
+    (void) hm; // Unused
+    (void) params; // Unused
+    span_copy_t *spans = request_alloc(TRACE_RING_SIZE * sizeof(*spans));
+    if (spans == NULL) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the trace.");
+        return;
+    }
+
+    json_writer_t w;
+    jw_begin(&w, c, 200);
+    jw_object_open(&w);
+    jw_key(&w, "traceEvents");
+    jw_array_open(&w);
+
+    // Holding the registry lock keeps threads from registering mid-dump;
+    // recording never takes it.
+    pthread_mutex_lock(&s_all_lock);
+    double ticks_per_us = 1.0;
+    uint64_t elapsed_ns = monotonic_ns() - s_base_ns;
+    if (s_all != NULL && elapsed_ns > 0) {
+        ticks_per_us = (double) (ticks() - s_base_ticks) * 1000.0 / (double) elapsed_ns;
+    }
+    for (trace_ring_t *r = s_all; r != NULL; r = r->next) {
+        // Names the thread's track.
+        jw_object_open(&w);
+        jw_key(&w, "name");
+        jw_string(&w, "thread_name");
+        jw_key(&w, "ph");
+        jw_string(&w, "M");
+        jw_key(&w, "pid");
+        jw_int(&w, 1);
+        jw_key(&w, "tid");
+        jw_int(&w, r->index);
+        jw_key(&w, "args");
+        jw_object_open(&w);
+        jw_key(&w, "name");
+        char thread_name[32];
+        snprintf(thread_name, sizeof(thread_name), "event loop %d", r->index);
+        jw_string(&w, thread_name);
+        jw_object_close(&w);
+        jw_object_close(&w);
+
+        size_t count = copy_ring(r, spans);
+        jw_reserve(&w, count * TRACE_SPAN_JSON_SIZE_GUESS);
+        for (size_t i = 0; i < count; i++) {
+            const span_copy_t *s = &spans[i];
+            jw_object_open(&w);
+            jw_key(&w, "name");
+            jw_string(&w, s->name != NULL ? s->name : "?");
+            jw_key(&w, "ph");
+            jw_string(&w, "X");
+            jw_key(&w, "pid");
+            jw_int(&w, 1);
+            jw_key(&w, "tid");
+            jw_int(&w, r->index);
+            jw_key(&w, "ts");
+            write_us(&w, (double) (int64_t) (s->start - s_base_ticks) / ticks_per_us);
+            jw_key(&w, "dur");
+            write_us(&w, (double) (s->end - s->start) / ticks_per_us);
+            jw_key(&w, "args");
+            jw_object_open(&w);
+            jw_key(&w, "request");
+            jw_int(&w, (long long) s->request);
+            jw_object_close(&w);
+            jw_object_close(&w);
+        }
+    }
+    pthread_mutex_unlock(&s_all_lock);
+
+    jw_array_close(&w);
+    jw_key(&w, "displayTimeUnit");
+    jw_string(&w, "ns");
+    jw_object_close(&w);
+    if (jw_finish(&w) != 0) {
+        send_error_response(c, 500, "Internal Server Error", "Failed to allocate memory for the trace.");
+    }
+    request_free(spans);
+}
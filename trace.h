@@ -0,0 +1,73 @@
+// trace.h
+// Sampled per-request tracing. A traced request records a span for itself
+// and for each phase its trace points mark (routing, body parsing, the store
+// operation, serialization, queuing the response), timed with the CPU's
+// cycle counter and kept in a ring per event loop thread.
+// GET /api/v1/admin/trace returns the spans still in the rings in the Chrome
+// trace event format, which chrome://tracing and ui.perfetto.dev load.
+//
+// One request in every --trace-sample N is traced (0, the default: none).
+// On requests that are not traced a trace point costs a call and a
+// thread-local load; built with TRACE_ENABLED=0 (make TRACE=0), the trace
+// points compile to nothing.
+//
+// Usage:
+//   TRACE_BEGIN(parse);
+//   ... parse the body ...
+//   TRACE_END(parse, "parse");
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "mongoose.h" // For struct mg_connection
+#include "router.h"   // For route_params_t
+#include <stdint.h>   // For uint64_t
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Spans kept per thread (a power of two); older ones are overwritten.
+#define TRACE_RING_SIZE 8192
+
+// Traces one request in every `every` (0: none). Call before any event loop starts.
+void trace_set_sample(unsigned every);
+
+// Allocates the calling thread's ring and registers it for dumping. Each
+// event loop thread calls this once at startup; on threads that did not
+// (or on allocation failure, which returns -1), trace points do nothing.
+int trace_register_thread(void);
+
+// Releases every thread's ring. Call once all event loops have stopped.
+void trace_free_all(void);
+
+// Starts a request: decides whether it is sampled, and if so returns its
+// start time (otherwise 0). Spans are only recorded while a request is traced.
+uint64_t trace_request_begin(void);
+
+// Ends the request started at start, recording its span under name (a string
+// with static storage, such as a route pattern).
+void trace_request_end(uint64_t start, const char *name);
+
+// Returns the start time of a span, or 0 if no traced request is running.
+uint64_t trace_span_begin(void);
+
+// Records the span started at start under name (static storage), if it was started.
+void trace_span_end(uint64_t start, const char *name);
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(span) uint64_t span = trace_span_begin()
+#define TRACE_END(span, name) trace_span_end(span, name)
+#define TRACE_REQUEST_BEGIN(span) uint64_t span = trace_request_begin()
+#define TRACE_REQUEST_END(span, name) trace_request_end(span, name)
+#else
+#define TRACE_BEGIN(span) ((void) 0)
+#define TRACE_END(span, name) ((void) 0)
+#define TRACE_REQUEST_BEGIN(span) ((void) 0)
+#define TRACE_REQUEST_END(span, name) ((void) 0)
+#endif
+
+// Handles GET requests to "/api/v1/admin/trace".
+void handle_get_trace(struct mg_connection *c, struct mg_http_message *hm, const route_params_t *params);
+
+#endif // TRACE_H
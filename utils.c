@@ -3,54 +3,173 @@
 
 #include "utils.h"     // Header for utility function declarations
 #include "mongoose.h"  // Mongoose types and functions
-#include "cJSON.h"     // Required for creating JSON error responses
-#include <stdio.h>     // For snprintf (used implicitly by cJSON_PrintUnformatted)
-#include <stdlib.h>    // For free (used for cJSON_PrintUnformatted result)
-#include <string.h>    // For strlen
+#include "json_writer.h" // For writing responses into the send buffer
+#include "log.h"       // For log_message
+#include "trace.h"     // For the "send" span
+#include <string.h>    // For strlen, memset
+#include <limits.h>    // For INT_MAX, INT_MIN
 
 // Helper function to send a JSON response to the client.
 void send_json_response(struct mg_connection *c, int status_code, const char *json_data) {
-    // mg_http_reply constructs and sends an HTTP response.
-    // Parameters:
-    // c: The connection.
-    // status_code: HTTP status code (e.g., 200 OK, 201 Created).
-    // fmt: Format string for HTTP headers.
-    // ...: Arguments for the format string (the response body).
+    // The response is written straight into the connection's send buffer
+    // (see json_writer.c); the body is copied as is, without printf-style
+    // formatting.
 
     // Content-Type: application/json tells the client the response is JSON.
     // Access-Control-Allow-Origin: * enables Cross-Origin Resource Sharing (CORS)
     // for all domains. This is convenient for development (e.g., if your frontend
     // is on a different port), but for production, you should restrict this
     // to specific trusted domains (e.g., "http://your-frontend-domain.com").
-    mg_http_reply(c, status_code, "Content-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\n", "%s", json_data);
+    // The "send" span covers queuing the response; the socket write
+    // happens later, once the handler has returned.
+    TRACE_BEGIN(send);
+    json_writer_t w;
+    jw_begin(&w, c, status_code);
+    jw_raw(&w, json_data, strlen(json_data));
+    if (jw_finish(&w) != 0) {
+        log_message(LOG_ERROR, "msg=\"failed to allocate memory for a response\" status=%d", status_code);
+    }
+    TRACE_END(send, "send");
 }
 
 // Helper function to send an error response in JSON format.
-// This creates a structured JSON error message for consistency.
+// This creates a structured JSON error message for consistency:
+// {"status_code":404,"error":"Not Found","message":"..."}.
 void send_error_response(struct mg_connection *c, int status_code, const char *status_text, const char *message) {
-    cJSON *error_obj = cJSON_CreateObject(); // Create a new JSON object for the error.
-    if (!error_obj) {
-        // Fallback: If cJSON object creation fails, send a basic plain text error.
-        fprintf(stderr, "Critical Error: Failed to create cJSON error object. Falling back to plain text error.\n");
+    json_writer_t w;
+    jw_begin(&w, c, status_code);
+    jw_object_open(&w);
+    jw_key(&w, "status_code");
+    jw_int(&w, status_code);
+    jw_key(&w, "error");
+    jw_string(&w, status_text);
+    jw_key(&w, "message");
+    jw_string(&w, message);
+    jw_object_close(&w);
+    if (jw_finish(&w) != 0) {
+        // Fallback: If the error could not be rendered, send a basic plain text error.
+        log_message(LOG_ERROR, "msg=\"failed to render JSON error response, falling back to plain text\"");
         mg_http_reply(c, 500, "Content-Type: text/plain\r\nAccess-Control-Allow-Origin: *\r\n", "Internal Server Error: Failed to generate structured error response.");
-        return;
     }
+}
+
+// --- Pre-rendered responses ---
+// Fixed responses are rendered once by static_responses_init(), including
+// status line and headers, and then sent with one mg_send() each.
+
+// Body of a fixed success response, or status text and message of a fixed error.
+typedef struct {
+    int status_code;
+    const char *status_text; // Error responses only
+    const char *text;        // JSON body, or the error message
+} static_response_spec_t;
+
+static const static_response_spec_t s_specs[STATIC_RESPONSE_COUNT] = {
+    [RESP_ROOT] = {200, NULL, "{ \"message\": \"Welcome to the C API Backend! Navigate to /api/v1/items for data.\" }"},
+    [RESP_ITEM_DELETED] = {200, NULL, "{ \"message\": \"Item deleted successfully.\" }"},
+    [RESP_ROUTE_NOT_FOUND] = {404, "Not Found", "The requested resource or endpoint was not found on this server."},
+    [RESP_INVALID_ITEM_ID] = {400, "Bad Request", "Invalid or missing item ID in URI. Expected format: /api/v1/items/{id}"},
+    [RESP_ITEM_NOT_FOUND] = {404, "Not Found", "Item with specified ID not found."},
+    [RESP_ITEM_NOT_FOUND_FOR_UPDATE] = {404, "Not Found", "Item with specified ID not found for update."},
+    [RESP_ITEM_NOT_FOUND_FOR_DELETE] = {404, "Not Found", "Item with specified ID not found for deletion."},
+    [RESP_INVALID_JSON_BODY] = {400, "Bad Request", "Invalid JSON format in request body."},
+    [RESP_INVALID_JSON_BODY_FOR_UPDATE] = {400, "Bad Request", "Invalid JSON format in request body for update."},
+    [RESP_INVALID_ITEM_FIELDS] = {400, "Bad Request", "Missing or invalid 'name' (string) or 'value' (number) in JSON body."},
+    [RESP_ITEM_NAME_TOO_LONG] = {400, "Bad Request", "Item name provided is too long (max 63 characters)."},
+    [RESP_UPDATED_NAME_TOO_LONG] = {400, "Bad Request", "Updated item name too long (max 63 characters)."},
+    [RESP_STORAGE_FULL] = {507, "Insufficient Storage", "Cannot create more items, failed to grow in-memory storage."},
+    [RESP_INVALID_BATCH_BODY] = {400, "Bad Request", "Request body must be a JSON array of item operations."},
+    [RESP_BATCH_TOO_LARGE] = {413, "Payload Too Large", "Too many operations in batch (max 10000)."},
+    [RESP_INVALID_BATCH_OP] = {400, "Bad Request", "Expected 'op' to be \"create\", \"get\", \"update\" or \"delete\", with an integer 'id' except for create."},
+    [RESP_MISSING_DOMAIN] = {400, "Bad Request", "Missing domain in URI. Expected format: /api/v1/domains/{domain}"},
+    [RESP_DOMAIN_TOO_LONG] = {400, "Bad Request", "Domain in URI is too long (max 253 characters)."},
+    [RESP_EMPTY_DOMAIN_LIST] = {400, "Bad Request", "Request body must contain a JSON array or a newline-delimited list of domains."},
+    [RESP_INVALID_DOMAIN_LIST] = {400, "Bad Request", "Invalid JSON in request body. Expected an array of domain strings."},
+    [RESP_HEADERS_TOO_LARGE] = {431, "Request Header Fields Too Large", "Request headers are too large (max 16 KiB)."},
+    [RESP_REQUEST_TOO_LARGE] = {413, "Payload Too Large", "Request body is too large (max 2 MiB)."},
+};
 
-    // Populate the error JSON object with relevant details.
-    cJSON_AddNumberToObject(error_obj, "status_code", status_code);
-    cJSON_AddStringToObject(error_obj, "error", status_text);
-    cJSON_AddStringToObject(error_obj, "message", message); // Fixed the typo here: 'mess age' -> 'message'
+// Rendered responses; read-only once static_responses_init() has returned.
+static struct mg_iobuf s_rendered[STATIC_RESPONSE_COUNT];
 
-    char *json_str = cJSON_PrintUnformatted(error_obj); // Convert the cJSON object to a compact string.
-    if (json_str) {
-        // Send the formatted JSON error response.
-        send_json_response(c, status_code, json_str);
-        free(json_str); // IMPORTANT: Free the memory allocated by cJSON_PrintUnformatted.
+// Renders with the regular (dynamic) response functions.
+static void send_dynamic_response(struct mg_connection *c, static_response_t id) {
+    const static_response_spec_t *spec = &s_specs[id];
+    if (spec->status_text == NULL) {
+        send_json_response(c, spec->status_code, spec->text);
     } else {
-        // Fallback: If cJSON stringification fails, send a basic plain text error.
-        fprintf(stderr, "Critical Error: Failed to stringify cJSON error object. Falling back to plain text error.\n");
-        mg_http_reply(c, 500, "Content-Type: text/plain\r\nAccess-Control-Allow-Origin: *\r\n", "Internal Server Error: Failed to stringify error JSON response.");
+        send_error_response(c, spec->status_code, spec->status_text, spec->text);
+    }
+}
+
+int static_responses_init(void) {
+    for (int id = 0; id < STATIC_RESPONSE_COUNT; id++) {
+        // Render into the send buffer of a scratch connection, so the bytes
+        // are exactly what the dynamic path would produce; keep the buffer.
+        struct mg_connection scratch;
+        memset(&scratch, 0, sizeof(scratch));
+        send_dynamic_response(&scratch, (static_response_t) id);
+        if (scratch.send.len == 0) {
+            mg_iobuf_free(&scratch.send);
+            return -1; // Out of memory; the remaining responses stay dynamic
+        }
+        s_rendered[id] = scratch.send;
+    }
+    return 0;
+}
+
+void send_static_response(struct mg_connection *c, static_response_t id) {
+    const struct mg_iobuf *r = &s_rendered[id];
+    if (r->len == 0) {
+        send_dynamic_response(c, id); // Not pre-rendered
+        return;
+    }
+    TRACE_BEGIN(send);
+    if (!mg_send(c, r->buf, r->len)) {
+        log_message(LOG_ERROR, "msg=\"failed to queue a response\" status=%d", s_specs[id].status_code);
     }
-    cJSON_Delete(error_obj); // IMPORTANT: Always free the cJSON object to prevent memory leaks.
+    TRACE_END(send, "send");
+}
+
+int static_response_status(static_response_t id) {
+    return s_specs[id].status_code;
+}
+
+const char *static_response_message(static_response_t id) {
+    return s_specs[id].text;
 }
 
+// Helper function to parse a base-10 integer from a Mongoose string slice.
+// Overflow is detected while accumulating, so at most s.len bytes are read.
+int parse_int_str(struct mg_str s, int *out) {
+    size_t i = 0;
+    int negative = 0;
+    if (s.len > 0 && (s.p[0] == '+' || s.p[0] == '-')) {
+        negative = (s.p[0] == '-');
+        i = 1;
+    }
+    if (i == s.len) {
+        return -1; // No digits
+    }
+
+    // Accumulate as a negative number so INT_MIN is representable.
+    long value = 0;
+    for (; i < s.len; i++) {
+        char ch = s.p[i];
+        if (ch < '0' || ch > '9') {
+            return -1; // Trailing or embedded non-digit characters
+        }
+        value = value * 10 - (ch - '0');
+        if (value < INT_MIN) {
+            return -1; // Out of int range
+        }
+    }
+    if (!negative) {
+        if (value < -(long)INT_MAX) {
+            return -1; // Out of int range
+        }
+        value = -value;
+    }
+    *out = (int)value;
+    return 0;
+}
@@ -20,5 +20,55 @@ void send_json_response(struct mg_connection *c, int status_code, const char *js
 // message: A more detailed error message for the client.
 void send_error_response(struct mg_connection *c, int status_code, const char *status_text, const char *message);
 
+// Fixed responses that are rendered once, at startup.
+typedef enum {
+    RESP_ROOT,                       // 200, welcome message
+    RESP_ITEM_DELETED,               // 200, item deleted
+    RESP_ROUTE_NOT_FOUND,            // 404, no matching route
+    RESP_INVALID_ITEM_ID,            // 400
+    RESP_ITEM_NOT_FOUND,             // 404
+    RESP_ITEM_NOT_FOUND_FOR_UPDATE,  // 404
+    RESP_ITEM_NOT_FOUND_FOR_DELETE,  // 404
+    RESP_INVALID_JSON_BODY,          // 400
+    RESP_INVALID_JSON_BODY_FOR_UPDATE, // 400
+    RESP_INVALID_ITEM_FIELDS,        // 400
+    RESP_ITEM_NAME_TOO_LONG,         // 400
+    RESP_UPDATED_NAME_TOO_LONG,      // 400
+    RESP_STORAGE_FULL,               // 507
+    RESP_INVALID_BATCH_BODY,         // 400
+    RESP_BATCH_TOO_LARGE,            // 413
+    RESP_INVALID_BATCH_OP,           // 400, per operation of a batch
+    RESP_MISSING_DOMAIN,             // 400
+    RESP_DOMAIN_TOO_LONG,            // 400
+    RESP_EMPTY_DOMAIN_LIST,          // 400
+    RESP_INVALID_DOMAIN_LIST,        // 400
+    RESP_HEADERS_TOO_LARGE,          // 431
+    RESP_REQUEST_TOO_LARGE,          // 413
+    STATIC_RESPONSE_COUNT
+} static_response_t;
+
+// Renders every static_response_t into a ready-to-send buffer (status line,
+// headers and body). Must be called once at startup, before any event loop
+// starts. Returns 0 on success, or -1 if memory is exhausted; responses that
+// were not rendered are then built on every send instead.
+int static_responses_init(void);
+
+// Sends a fixed response with a single mg_send().
+void send_static_response(struct mg_connection *c, static_response_t id);
+
+// Status code and message of a fixed error response (the JSON body for
+// successes), for responses that embed them, such as the results of a batch.
+int static_response_status(static_response_t id);
+const char *static_response_message(static_response_t id);
+
+// Helper function to parse a base-10 integer from a Mongoose string slice
+// without copying it into a null-terminated buffer.
+// Accepts an optional leading '+' or '-' followed by at least one digit;
+// anything else (including surrounding whitespace) is rejected.
+// s: The string slice to parse.
+// out: Receives the parsed value on success.
+// Returns 0 on success, or -1 if the slice is not a valid integer or overflows int.
+int parse_int_str(struct mg_str s, int *out);
+
 #endif // UTILS_H
 
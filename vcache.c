@@ -0,0 +1,255 @@
+// vcache.c
+// Set-associative verdict cache with CLOCK eviction.
+// The table is an array of buckets of VCACHE_WAYS entries. A key hashes to one
+// bucket and is probed within it only, so a lookup touches a bounded, small
+// run of memory. When a bucket is full, a CLOCK hand sweeps its entries,
+// clearing reference bits, and evicts the first entry that was not used since
+// the last sweep. Memory is allocated once in vcache_create().
+//
+// An entry always holds the verdict with its reject reason and offset; the
+// suffix information is computed only once a vcache_lookup() needs it, so
+// the bulk endpoint's misses (vcache_check()) cost no suffix lookups.
+
+#include "vcache.h"
+#include "libtld.h" // For is_valid_domain_simd, tld_check_domain_simd
+#include "psl.h"    // For psl_public_suffix_len, psl_registrable_domain
+#include <stdatomic.h> // For the counters
+#include <stdlib.h> // For calloc, free
+#include <string.h> // For memcpy, memcmp, memset
+#include <time.h>   // For time (hash seed)
+
+// Entries per bucket.
+#define VCACHE_WAYS 8
+
+// Marks an unused entry.
+#define VCACHE_EMPTY 0
+
+// Registrable offset meaning "no registrable domain".
+#define VCACHE_NO_REGISTRABLE 0xFF
+
+typedef struct {
+    uint64_t hash;            // Full key hash; 0 is reserved for VCACHE_EMPTY
+    uint8_t len;              // Key length
+    uint8_t referenced;       // CLOCK reference bit
+    uint8_t reason;           // Cached verdict (a tld_reason_t)
+    uint8_t offset;           // Offset of the reject reason
+    uint8_t has_suffix;       // The two fields below are set
+    uint8_t suffix_len;       // Cached public suffix length
+    uint8_t registrable;      // Cached eTLD+1 offset, or VCACHE_NO_REGISTRABLE
+    char key[VCACHE_MAX_KEY]; // Domain bytes
+} vcache_entry_t;
+
+typedef struct {
+    vcache_entry_t entries[VCACHE_WAYS];
+    unsigned hand; // CLOCK hand for this bucket
+} vcache_bucket_t;
+
+// Counters are written only by the thread that owns the cache, but may be
+// read concurrently by vcache_get_stats(), so they are relaxed atomics
+// updated with plain load/store pairs (no read-modify-write).
+typedef struct {
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t bypasses;
+    _Atomic uint64_t evictions;
+} vcache_counters_t;
+
+struct vcache {
+    vcache_bucket_t *buckets;
+    size_t num_buckets; // Power of two
+    uint64_t seed;
+    size_t capacity;
+    size_t bytes;
+    vcache_counters_t counters;
+};
+
+static inline void counter_inc(_Atomic uint64_t *counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Reads 8 bytes in native order without alignment requirements.
+static inline uint64_t load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiply-xorshift hash over 8-byte words, seeded per cache.
+static uint64_t hash_key(uint64_t seed, const char *p, size_t len) {
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = seed ^ (len * k);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        h = (h ^ load64(p + i)) * k;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        uint64_t tail = 0;
+        memcpy(&tail, p + i, len - i);
+        h = (h ^ tail) * k;
+    }
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h == VCACHE_EMPTY ? 1 : h;
+}
+
+vcache_t *vcache_create(size_t max_bytes) {
+    size_t num_buckets = 1;
+    while (num_buckets * 2 * sizeof(vcache_bucket_t) <= max_bytes) {
+        num_buckets *= 2;
+    }
+    if (sizeof(vcache_bucket_t) > max_bytes) {
+        return NULL;
+    }
+
+    vcache_t *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->buckets = calloc(num_buckets, sizeof(*cache->buckets));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->num_buckets = num_buckets;
+    // A per-process seed keeps crafted inputs from all landing in one bucket.
+    cache->seed = ((uint64_t)time(NULL) << 20) ^ (uint64_t)(uintptr_t)cache;
+    cache->capacity = num_buckets * VCACHE_WAYS;
+    cache->bytes = num_buckets * sizeof(vcache_bucket_t);
+    return cache;
+}
+
+void vcache_destroy(vcache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+// Fills in the suffix information of a valid domain.
+static void compute_suffix(const char *domain, size_t len, domain_info_t *info) {
+    info->suffix_len = psl_public_suffix_len(domain, len, 0);
+    info->has_registrable = psl_registrable_domain(domain, len, 0, &info->registrable_offset) == 0;
+}
+
+void domain_info_compute(const char *domain, size_t len, domain_info_t *info) {
+    info->valid = is_valid_domain_simd(domain, len);
+    info->suffix_len = 0;
+    info->has_registrable = 0;
+    info->registrable_offset = 0;
+    if (info->valid) {
+        compute_suffix(domain, len, info);
+    }
+}
+
+static void entry_to_info(const vcache_entry_t *e, domain_info_t *info) {
+    info->valid = e->reason == TLD_OK;
+    info->suffix_len = e->suffix_len;
+    info->has_registrable = e->registrable != VCACHE_NO_REGISTRABLE;
+    info->registrable_offset = info->has_registrable ? e->registrable : 0;
+}
+
+static void info_to_entry(const domain_info_t *info, vcache_entry_t *e) {
+    e->has_suffix = 1;
+    e->suffix_len = (uint8_t)info->suffix_len;
+    e->registrable = info->has_registrable ? (uint8_t)info->registrable_offset : VCACHE_NO_REGISTRABLE;
+}
+
+// Returns the entry of domain (len at most VCACHE_MAX_KEY), counting a hit.
+// On a miss, computes the verdict into a newly claimed entry, evicting one
+// if the bucket is full, and counts a miss.
+static vcache_entry_t *find_entry(vcache_t *cache, const char *domain, size_t len) {
+    uint64_t h = hash_key(cache->seed, domain, len);
+    vcache_bucket_t *bucket = &cache->buckets[h & (cache->num_buckets - 1)];
+    vcache_entry_t *free_slot = NULL;
+    for (unsigned i = 0; i < VCACHE_WAYS; i++) {
+        vcache_entry_t *e = &bucket->entries[i];
+        if (e->hash == h && e->len == len && memcmp(e->key, domain, len) == 0) {
+            e->referenced = 1;
+            counter_inc(&cache->counters.hits);
+            return e;
+        }
+        if (e->hash == VCACHE_EMPTY && free_slot == NULL) {
+            free_slot = e;
+        }
+    }
+
+    counter_inc(&cache->counters.misses);
+    if (free_slot == NULL) {
+        // CLOCK: give referenced entries a second chance, evict the first that is not.
+        for (;;) {
+            vcache_entry_t *e = &bucket->entries[bucket->hand];
+            bucket->hand = (bucket->hand + 1) % VCACHE_WAYS;
+            if (!e->referenced) {
+                free_slot = e;
+                break;
+            }
+            e->referenced = 0;
+        }
+        counter_inc(&cache->counters.evictions);
+    }
+
+    size_t offset = 0;
+    free_slot->hash = h;
+    free_slot->len = (uint8_t)len;
+    free_slot->referenced = 0; // Set on the first hit
+    free_slot->reason = (uint8_t)tld_check_domain_simd(domain, len, &offset);
+    free_slot->offset = (uint8_t)offset;
+    free_slot->has_suffix = 0;
+    memcpy(free_slot->key, domain, len);
+    return free_slot;
+}
+
+void vcache_lookup(vcache_t *cache, const char *domain, size_t len, domain_info_t *info) {
+    if (cache == NULL) {
+        domain_info_compute(domain, len, info);
+        return;
+    }
+    if (len > VCACHE_MAX_KEY) {
+        counter_inc(&cache->counters.bypasses);
+        domain_info_compute(domain, len, info);
+        return;
+    }
+
+    vcache_entry_t *e = find_entry(cache, domain, len);
+    if (!e->has_suffix) {
+        info->valid = e->reason == TLD_OK;
+        info->suffix_len = 0;
+        info->has_registrable = 0;
+        info->registrable_offset = 0;
+        if (info->valid) {
+            compute_suffix(domain, len, info);
+        }
+        info_to_entry(info, e);
+        return;
+    }
+    entry_to_info(e, info);
+}
+
+tld_reason_t vcache_check(vcache_t *cache, const char *domain, size_t len, size_t *offset) {
+    if (cache == NULL) {
+        return tld_check_domain_simd(domain, len, offset);
+    }
+    if (len > VCACHE_MAX_KEY) {
+        counter_inc(&cache->counters.bypasses);
+        return tld_check_domain_simd(domain, len, offset);
+    }
+    const vcache_entry_t *e = find_entry(cache, domain, len);
+    *offset = e->offset;
+    return (tld_reason_t)e->reason;
+}
+
+void vcache_get_stats(const vcache_t *cache, vcache_stats_t *stats) {
+    if (cache == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    stats->hits = atomic_load_explicit(&cache->counters.hits, memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&cache->counters.misses, memory_order_relaxed);
+    stats->bypasses = atomic_load_explicit(&cache->counters.bypasses, memory_order_relaxed);
+    stats->evictions = atomic_load_explicit(&cache->counters.evictions, memory_order_relaxed);
+    stats->capacity = cache->capacity;
+    stats->bytes = cache->bytes;
+}
@@ -0,0 +1,64 @@
+// vcache.h
+// Fixed-memory cache of domain verdicts and suffix lookups.
+// Sits in front of is_valid_domain_simd() and the Public Suffix List lookups
+// for skewed workloads where a small set of domains makes up most requests.
+// GET /api/v1/domains/{domain} uses vcache_lookup(); the bulk endpoint uses
+// vcache_check() for batches validated on the event loop thread (see
+// domain_handlers.c). Both share the entries.
+
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include "libtld.h" // For tld_reason_t
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint64_t
+
+// Domains longer than this are not cached (they are looked up directly).
+#define VCACHE_MAX_KEY 64
+
+// Result of a domain lookup.
+typedef struct {
+    int valid;                 // 1 if the domain passed is_valid_domain_simd()
+    size_t suffix_len;         // Length of the public suffix (0 if invalid)
+    int has_registrable;       // 1 if registrable_offset is set
+    size_t registrable_offset; // Offset of the registrable domain (eTLD+1)
+} domain_info_t;
+
+// Cache counters.
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bypasses;  // Lookups too long to be cached
+    uint64_t evictions;
+    size_t capacity;    // Number of entries
+    size_t bytes;       // Memory used by the entries
+} vcache_stats_t;
+
+// Opaque; see vcache.c.
+typedef struct vcache vcache_t;
+
+// Creates a cache using at most max_bytes for its entries.
+// Returns NULL on failure or if max_bytes is too small for one bucket.
+vcache_t *vcache_create(size_t max_bytes);
+
+// Frees the cache. NULL is ignored.
+void vcache_destroy(vcache_t *cache);
+
+// Computes the verdict and suffix information of domain without the cache.
+void domain_info_compute(const char *domain, size_t len, domain_info_t *info);
+
+// Looks domain up in the cache, computing and inserting it on a miss.
+// Never allocates. A NULL cache computes the result directly.
+// A cache must only be used by one thread at a time; multi-threaded servers
+// give each event loop its own cache.
+void vcache_lookup(vcache_t *cache, const char *domain, size_t len, domain_info_t *info);
+
+// Same as tld_check_domain_simd(), through the cache: returns the verdict of
+// domain and sets *offset to the position of its reject reason. Never
+// allocates; a NULL cache checks the domain directly.
+tld_reason_t vcache_check(vcache_t *cache, const char *domain, size_t len, size_t *offset);
+
+// Copies the cache counters into stats. Safe to call from any thread.
+void vcache_get_stats(const vcache_t *cache, vcache_stats_t *stats);
+
+#endif // VCACHE_H